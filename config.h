@@ -39,7 +39,7 @@ Boston, MA  02110-1301, USA.
 //                              (((2048-1) - (3+1+1)) / 3 / nch) = 680 / nch
 
 extern int fw_sel, fpga_id, rx_chans, wf_chans, nrx_bufs, nrx_samps, nrx_samps_loop, nrx_samps_rem,
-    snd_rate, rx_decim;
+    snd_rate, rx_decim, wf_virt;
 
 // INET6_ADDRSTRLEN (46) plus some extra in case ipv6 scope/zone is an issue
 // can't be in net.h due to #include recursion problems
@@ -60,6 +60,7 @@ typedef struct {
 	 const char *name;
 	 int port, port_ext;
 	 struct mg_server *server;
+	 u4_t s2c_pending;      // set by app_to_web() to wake up web_server() early
 } user_iface_t;
 
 extern user_iface_t user_iface[];
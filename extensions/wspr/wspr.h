@@ -36,6 +36,7 @@
 
 #include <time.h>
 #include <fftw3.h>
+#include "fftw_wisdom.h"
 
 #ifdef MULTI_CORE
     //#define BBAI_WSPR_ASAN
@@ -129,7 +130,7 @@
 	#define WSPR_FFTW_MALLOC fftwf_malloc
 	#define WSPR_FFTW_FREE fftwf_free
 	#define WSPR_FFTW_PLAN fftwf_plan
-	#define WSPR_FFTW_PLAN_DFT_1D fftwf_plan_dft_1d
+	#define WSPR_FFTW_PLAN_DFT_1D fftw_wisdom_plan_dft_1d
 	#define WSPR_FFTW_DESTROY_PLAN fftwf_destroy_plan
 	#define WSPR_FFTW_EXECUTE fftwf_execute
 #else
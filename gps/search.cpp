@@ -25,6 +25,7 @@
 #include "cfg.h"
 #include "misc.h"
 #include "gps.h"
+#include "fftw_wisdom.h"
 #include "spi.h"
 #include "cacode.h"
 #include "e1bcode.h"
@@ -236,8 +237,8 @@ void SearchInit() {
 	#endif
 
 	printf("DECIM %d FFT %d planning..\n", DECIM, FFT_LEN);
-    fwd_plan = fftwf_plan_dft_1d(FFT_LEN, fwd_buf, fwd_buf, FFTW_FORWARD,  FFTW_ESTIMATE);
-    rev_plan = fftwf_plan_dft_1d(FFT_LEN, rev_buf, rev_buf, FFTW_BACKWARD, FFTW_ESTIMATE);
+    fwd_plan = fftw_wisdom_plan_dft_1d(FFT_LEN, fwd_buf, fwd_buf, FFTW_FORWARD,  FFTW_ESTIMATE);
+    rev_plan = fftw_wisdom_plan_dft_1d(FFT_LEN, rev_buf, rev_buf, FFTW_BACKWARD, FFTW_ESTIMATE);
 
     for (sp = Sats; sp->prn != -1; sp++) {
         if (sp->type != Navstar && sp->type != QZSS) continue;
@@ -56,7 +56,8 @@ extern int p0, p1, p2, wf_sim, wf_real, wf_time, ev_dump, wf_flip, wf_exit, wf_s
 	port, print_stats, ecpu_cmds, ecpu_tcmds, serial_number, ip_limit_mins, is_locked,
 	use_spidev, inactivity_timeout_mins, S_meter_cal, waterfall_cal, current_nusers, debug_v, debian_ver, drm_nreg_chans,
 	utc_offset, dst_offset, reg_kiwisdr_com_status, reg_kiwisdr_com_tid, sdr_hu_lo_kHz, sdr_hu_hi_kHz,
-	debian_maj, debian_min, gps_debug, gps_var, gps_lo_gain, gps_cg_gain, use_foptim, web_caching_debug;
+	debian_maj, debian_min, gps_debug, gps_var, gps_lo_gain, gps_cg_gain, use_foptim, web_caching_debug,
+	iq_replay;
 
 extern char **main_argv;
 
@@ -109,7 +110,7 @@ void c2s_sound(void *param);
 void c2s_sound_shutdown(void *param);
 
 void c2s_waterfall_init();
-void c2s_waterfall_compression(int rx_chan, bool compression);
+void c2s_waterfall_compression(int rx_chan, int compression);
 void c2s_waterfall_setup(void *param);
 void c2s_waterfall(void *param);
 void c2s_waterfall_shutdown(void *param);
@@ -37,6 +37,8 @@ Boston, MA  02110-1301, USA.
 #include "ext_int.h"
 #include "sanitizer.h"
 #include "shmem.h"
+#include "iq_replay.h"
+#include "fftw_wisdom.h"
 
 #include "debug.h"
 
@@ -58,7 +60,7 @@ Boston, MA  02110-1301, USA.
 
 int version_maj, version_min;
 int fw_sel, fpga_id, rx_chans, wf_chans, nrx_bufs, nrx_samps, nrx_samps_loop, nrx_samps_rem,
-    snd_rate, rx_decim;
+    snd_rate, rx_decim, wf_virt;
 
 int p0=0, p1=0, p2=0, wf_sim, wf_real, wf_time, ev_dump=0, wf_flip, wf_start=1, tone, down,
 	rx_cordic, rx_cic, rx_cic2, rx_dump, wf_cordic, wf_cic, wf_mult, wf_mult_gen, do_slice=-1,
@@ -66,7 +68,7 @@ int p0=0, p1=0, p2=0, wf_sim, wf_real, wf_time, ev_dump=0, wf_flip, wf_start=1,
 	do_gps, do_sdr=1, navg=1, wf_olap, meas, spi_delay=100, do_fft, debian_ver,
 	noisePwr=-160, unwrap=0, rev_iq, ineg, qneg, fft_file, fftsize=1024, fftuse=1024, bg, alt_port,
 	print_stats, ecpu_cmds, ecpu_tcmds, use_spidev, debian_maj, debian_min,
-	gps_debug, gps_var, gps_lo_gain, gps_cg_gain, use_foptim, is_locked, drm_nreg_chans;
+	gps_debug, gps_var, gps_lo_gain, gps_cg_gain, use_foptim, is_locked, drm_nreg_chans, iq_replay;
 
 u4_t ov_mask, snd_intr_usec;
 
@@ -155,6 +157,8 @@ int main(int argc, char *argv[])
 		if (strcmp(argv[i], "-ext")==0) ext_clk = true;
 		if (strcmp(argv[i], "-use_spidev")==0) { i++; use_spidev = strtol(argv[i], 0, 0); }
 		if (strcmp(argv[i], "-eeprom")==0) create_eeprom = true;
+		if (strcmp(argv[i], "-iq_replay")==0) { i++; iq_replay = IQ_REPLAY_FILE; iq_replay_file = argv[i]; }
+		if (strcmp(argv[i], "-iq_synth")==0) iq_replay = IQ_REPLAY_SYNTH;
 		if (strcmp(argv[i], "-sim")==0) wf_sim = 1;
 		if (strcmp(argv[i], "-real")==0) wf_real = 1;
 		if (strcmp(argv[i], "-time")==0) wf_time = 1;
@@ -305,7 +309,12 @@ int main(int argc, char *argv[])
     if (err) no_wf = false;
     if (no_wf) wf_chans = 0;
 
-    lprintf("firmware: rx_chans=%d wf_chans=%d\n", rx_chans, wf_chans);
+    // virtual waterfalls use the last hardware waterfall channel as the full-span source
+    bool virt_wf = cfg_bool("virt_wf", &err, CFG_OPTIONAL);
+    if (err) virt_wf = false;
+    wf_virt = (virt_wf && wf_chans)? (wf_chans - 1) : -1;
+
+    lprintf("firmware: rx_chans=%d wf_chans=%d%s\n", rx_chans, wf_chans, (wf_virt >= 0)? " (virtual waterfalls)" : "");
 
     assert(rx_chans <= MAX_RX_CHANS);
     assert(wf_chans <= MAX_WF_CHANS);
@@ -331,7 +340,13 @@ int main(int argc, char *argv[])
     if (p_gps != 0) do_gps = (p_gps == 1)? 1:0;
     
 	if (down) do_sdr = do_gps = 0;
-	need_hardware = (do_gps || do_sdr);
+	
+	// no cape: run the SDR side from the replay source, SPI requests are completed locally
+	if (iq_replay) {
+	    do_sdr = 1;
+	    do_gps = 0;
+	}
+	need_hardware = (do_gps || do_sdr) && !iq_replay;
 
 	// called early, in case another server already running so we can detect the busy socket and bail
 	web_server_init(WS_INIT_CREATE);
@@ -364,6 +379,11 @@ int main(int argc, char *argv[])
 		printf("device DNA %08x|%08x\n", PRINTF_U64_ARG(net.dna));
 	}
 	
+	if (iq_replay) {
+	    lprintf("iq_replay: running without hardware\n");
+	    spi_init();
+	}
+	
 	if (do_fft) {
 		printf("==== IQ %s\n", rev_iq? "reverse":"normal");
 		if (ineg) printf("==== I neg\n");
@@ -371,6 +391,7 @@ int main(int argc, char *argv[])
 		printf("==== unwrap %s\n", (unwrap==0)? "none" : ((unwrap==1)? "normal":"reverse"));
 	}
 	
+	fftw_wisdom_init();
 	rx_server_init();
 
 #ifndef CFG_GPS_ONLY
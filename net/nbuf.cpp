@@ -40,8 +40,37 @@
 	static lock_t nbuf_lock;
 	#define NNBUF 1024
 	static nbuf_t nbuf[NNBUF];
+	static nbuf_t *nbuf_free_list;      // linked through next
+	static int nbuf_busy, nbuf_busy_hiwat;
 #endif
 
+// Payloads come from per size class free lists, filled a slab at a time and never returned to malloc.
+// Every payload is refcounted so it can be queued on several ndesc without a copy (nbuf_allocq_ref()).
+// Payloads too big for the largest class are malloc'd as before.
+
+typedef struct nbuf_pay_st {
+	#define NB_PAY_MAGIC 0xbabeface
+	u4_t magic;
+	s2_t cls;                           // NBUF_CLS_MALLOC if not from the pool
+	int refcnt;
+	struct nbuf_pay_st *next;           // when on a free list
+} nbuf_pay_t;
+
+#define NBUF_CLS_MALLOC     -1
+#define NBUF_CLS_MIN_SHIFT  7           // 128 bytes
+#define NBUF_NCLS           5           // .. 2K, 8K, 32K (x4 each)
+#define NBUF_CLS_SIZE(c)    (1 << (NBUF_CLS_MIN_SHIFT + 2*(c)))
+#define NBUF_SLAB           (64*1024)
+
+static struct {
+	nbuf_pay_t *free;
+	int busy, total;
+} nbuf_pool[NBUF_NCLS];
+
+static u4_t nbuf_pool_mallocs;
+
+static u4_t nbuf_cls_drops[ND_NCLS];
+
 void nbuf_init()
 {
 #ifdef NBUF_STATIC_ALLOC
@@ -49,33 +78,38 @@ void nbuf_init()
 	lock_register(&nbuf_lock);
 	memset(nbuf, 0, sizeof(nbuf));
 	int i;
-	for (i=0; i<NNBUF; i++) {
+	for (i=NNBUF-1; i >= 0; i--) {
 		nbuf_t *nb = &nbuf[i];
 		nb->isFree = TRUE;
+		nb->next = nbuf_free_list;
+		nbuf_free_list = nb;
 	}
 #endif
 }
 
 void nbuf_stat()
 {
-//#ifdef NBUF_STATIC_ALLOC
-#if 0
-	int i, busy = 0;
-	for (i=0; i<NNBUF; i++) {
-		nbuf_t *nb = &nbuf[i];
-		if (!nb->isFree) busy++;
-	}
-	printf("NBUF %d/%d busy\n", busy, NNBUF);
+	if (!(print_stats & STATS_TASK)) return;
+	
+#ifdef NBUF_STATIC_ALLOC
+	lprintf("NBUF %d/%d busy, hiwat %d, pool", nbuf_busy, NNBUF, nbuf_busy_hiwat);
+#else
+	lprintf("NBUF pool");
 #endif
+	for (int c=0; c < NBUF_NCLS; c++)
+		lprintf(" %d:%d/%d", NBUF_CLS_SIZE(c), nbuf_pool[c].busy, nbuf_pool[c].total);
+	lprintf(", %d oversize, drops ctrl %d audio %d bulk %d\n", nbuf_pool_mallocs,
+		nbuf_cls_drops[ND_CLS_CTRL], nbuf_cls_drops[ND_CLS_AUDIO], nbuf_cls_drops[ND_CLS_BULK]);
 }
 
-void ndesc_init(ndesc_t *nd, struct mg_connection *mc)
+void ndesc_init(ndesc_t *nd, struct mg_connection *mc, int cls)
 {
 	memset(nd, 0, sizeof(ndesc_t));
 	nd->magic_b = NDESC_MAGIC_B;
 	nd->magic_e = NDESC_MAGIC_E;
 	lock_init(&nd->lock);
 	nd->mc = mc;
+	nd->cls = cls;
 }
 
 void ndesc_register(ndesc_t *nd)
@@ -90,13 +124,11 @@ static nbuf_t *nbuf_malloc()
 #ifdef NBUF_STATIC_ALLOC
 	// FIXME: don't need a lock here because there is no task preemption to cause contention
 	lock_enter(&nbuf_lock);
-		int i;
-		for (i=0; i<NNBUF; i++) {
-			nb = &nbuf[i];
-			if (nb->isFree)
-				break;
-		}
-		if (i == NNBUF) panic("out of nbufs");
+		nb = nbuf_free_list;
+		if (nb == NULL) panic("out of nbufs");
+		nbuf_free_list = nb->next;
+		nbuf_busy++;
+		if (nbuf_busy > nbuf_busy_hiwat) nbuf_busy_hiwat = nbuf_busy;
 	lock_leave(&nbuf_lock);
 #else
 	nb = (nbuf_t*) kiwi_malloc("nbuf", sizeof(nbuf_t));
@@ -115,87 +147,159 @@ static void nbuf_free(nbuf_t *nb)
 	nb->magic = nb->magic_b = nb->magic_e = 0;
 	nb->isFree = TRUE;
 #ifdef NBUF_STATIC_ALLOC
+	lock_enter(&nbuf_lock);
+		nb->next = nbuf_free_list;
+		nbuf_free_list = nb;
+		nbuf_busy--;
+	lock_leave(&nbuf_lock);
 #else
 	kiwi_free("nbuf", nb);
 #endif
 }
 
-static void nbuf_dumpq(ndesc_t *nd)
+static nbuf_pay_t *nbuf_pay(char *buf)
 {
-	nbuf_t *bp;
+	nbuf_pay_t *pay = ((nbuf_pay_t *) buf) - 1;
+	if (pay->magic != NB_PAY_MAGIC || pay->refcnt <= 0) {
+		lprintf("BAD NBUF PAYLOAD magic 0x%x refcnt %d\n", pay->magic, pay->refcnt);
+		dump_panic("nbuf_pay");
+	}
+	return pay;
+}
+
+// payload of sl bytes with refcnt 1
+static char *nbuf_pay_alloc(char *s, int sl)
+{
+	nbuf_pay_t *pay;
+	int c;
+
+	// +1 so buffers which are strings can be null terminated after the fact
+	// but don't reflect this extra byte in the nb->len count
+	int size = sizeof(nbuf_pay_t) + sl+1;
+	for (c=0; c < NBUF_NCLS && size > NBUF_CLS_SIZE(c); c++)
+		;
 	
-	//lock_enter(&nd->lock);
+	if (c == NBUF_NCLS) {
+		pay = (nbuf_pay_t *) kiwi_malloc("nbuf:buf", size);
+		pay->cls = NBUF_CLS_MALLOC;
+		nbuf_pool_mallocs++;
+	} else {
+		if (nbuf_pool[c].free == NULL) {
+			int csize = NBUF_CLS_SIZE(c), n = MAX(NBUF_SLAB / csize, 1);
+			char *slab = (char *) kiwi_malloc("nbuf:slab", n * csize);
+			for (int i=0; i < n; i++) {
+				nbuf_pay_t *p = (nbuf_pay_t *) (slab + i * csize);
+				p->magic = 0;
+				p->next = nbuf_pool[c].free;
+				nbuf_pool[c].free = p;
+			}
+			nbuf_pool[c].total += n;
+		}
+		pay = nbuf_pool[c].free;
+		nbuf_pool[c].free = pay->next;
+		nbuf_pool[c].busy++;
+		pay->cls = c;
+	}
+	
+	pay->magic = NB_PAY_MAGIC;
+	pay->refcnt = 1;
+	char *buf = (char *) (pay + 1);
+	memcpy(buf, s, sl);
+	return buf;
+}
 
-	if (nd->dbug) printf("[");
-	bp = nd->q;
-	while (bp) {
-		if (nd->dbug) printf("%d%s%s%d ", bp->id, bp->done? "d":".", bp->dequeued? "q":".", bp->ttl);
-		bp = bp->next;
+// The caller holds the initial reference and must nbuf_ref_release() it after
+// the last nbuf_allocq_ref().
+char *nbuf_ref_alloc(char *s, int sl)
+{
+	return nbuf_pay_alloc(s, sl);
+}
+
+void nbuf_ref_release(char *buf)
+{
+	nbuf_pay_t *pay = nbuf_pay(buf);
+	if (--pay->refcnt) return;
+	
+	pay->magic = 0;
+	int c = pay->cls;
+	if (c == NBUF_CLS_MALLOC) {
+		kiwi_free("nbuf:buf", pay);
+		nbuf_pool_mallocs--;
+	} else {
+		pay->next = nbuf_pool[c].free;
+		nbuf_pool[c].free = pay;
+		nbuf_pool[c].busy--;
 	}
-	if (nd->dbug) printf("] ");
+}
 
-	//lock_leave(&nd->lock);
+static void nbuf_free_buf(nbuf_t *nb)
+{
+	nbuf_ref_release(nb->buf);
+	nb->buf = NULL;
+}
+
+#define ND_SLOT(nd, i)  ((nd)->ring[(i) & (ND_RING-1)])
+
+static void nbuf_dumpq(ndesc_t *nd)
+{
+	if (!nd->dbug) return;
+	printf("[");
+	for (u4_t i = nd->head; i != nd->tail; i++) {
+		nbuf_t *bp = ND_SLOT(nd, i);
+		printf("%d%s%s ", bp->id, bp->done? "d":".", ((s4_t) (i - nd->deq) < 0)? "q":".");
+	}
+	printf("] ");
 }
 
 static bool nbuf_enqueue(ndesc_t *nd, nbuf_t *nb)
 {
 	check_ndesc(nd);
-	nbuf_t **q = &nd->q, **q_head = &nd->q_head;
 	nbuf_t *dp;
 	bool ovfl = FALSE;
 	
 	lock_enter(&nd->lock);
 	
 		// collect done buffers (same thread where they're allocated)
-#if 1
-		// decrement ttl counters
-		if (nd->ttl) {
-			dp = *q_head;
-			while (dp) {
-				check_nbuf(dp);
-				if (dp->done) {
-					assert(dp->ttl);
-					dp->ttl--;
-				}
-				dp = dp->prev;
-			}
-		}
-		
-		while ((dp = *q_head) && (((nd->ttl == 0) && dp->done) || ((nd->ttl != 0) && dp->done && (dp->ttl == 0))) ) {
+		while (nd->head != nd->deq && (dp = ND_SLOT(nd, nd->head))->done) {
 			check_nbuf(dp);
 			if (nd->dbug) printf("R%d ", dp->id);
-			if (nd->dbug) nbuf_dumpq(nd);
 			assert(dp->buf);
-			kiwi_free("nbuf:buf", dp->buf);
-			*q_head = dp->prev;
-			if (*q == dp) {
-				*q = NULL;
-				assert(*q_head == NULL);
-			} else {
-				(*q_head)->next = NULL;
-			}
+			nbuf_free_buf(dp);
 			nbuf_free(dp);
-			if (nd->dbug) nbuf_dumpq(nd);
+			ND_SLOT(nd, nd->head) = NULL;
+			nd->head++;
+			nbuf_dumpq(nd);
 		}
-#endif
 		
 		check_nbuf(nb);
-		if (nd->ovfl && (nd->cnt < ND_LOWAT)) {
+		int depth = ND_DEPTH(nd);
+		if (nd->ovfl && (depth < ND_LOWAT)) {
 			nd->ovfl = FALSE;
 		}
 
-		if (nd->ovfl || (nd->cnt > ND_HIWAT)) {
-			//if (!nd->ovfl && (nd->cnt > ND_HIWAT)) printf("HIWAT\n");
+		// bulk: make room by dropping the oldest queued buffer instead (marked done so it's collected)
+		if (nd->cls == ND_CLS_BULK && depth > ND_HIWAT && (nd->tail - nd->head) != ND_RING) {
+			dp = ND_SLOT(nd, nd->deq);
+			check_nbuf(dp);
+			if (nd->dbug) printf("C%d ", dp->id);
+			dp->done = TRUE;
+			nd->deq++;
+			depth--;
+			nd->drops++;
+			nbuf_cls_drops[nd->cls]++;
+		}
+
+		// ring full only if the buffer at head is held (expecting_done) for a very long time
+		if (nd->ovfl || (depth > ND_HIWAT) || (nd->tail - nd->head) == ND_RING) {
+			//if (!nd->ovfl && (depth > ND_HIWAT)) printf("HIWAT\n");
 			nd->ovfl = TRUE;
+			nd->drops++;
+			nbuf_cls_drops[nd->cls]++;
 			ovfl = TRUE;
 		} else {
-			nd->cnt++;
-			check_nbuf(nb);
-			if (*q) (*q)->prev = nb;
-			nb->next = *q;
-			*q = nb;
-			nb->prev = NULL;
-			if (!*q_head) *q_head = nb;
+			ND_SLOT(nd, nd->tail) = nb;
+			nd->tail++;
+			if (depth+1 > nd->depth_hiwat) nd->depth_hiwat = depth+1;
 		}
 
 	lock_leave(&nd->lock);
@@ -203,112 +307,107 @@ static bool nbuf_enqueue(ndesc_t *nd, nbuf_t *nb)
 	return ovfl;
 }
 
-void nbuf_allocq(ndesc_t *nd, char *s, int sl)
+static void nbuf_queue(ndesc_t *nd, nbuf_t *nb)
 {
-	check_ndesc(nd);
-	nbuf_t *nb;
 	bool ovfl;
 	static int id;
 	
-	assert(s != NULL);
-	assert(sl > 0);
-	nb = nbuf_malloc();
 	//assert(nd->mc);
 	nb->mc = nd->mc;
-	// +1 so buffers which are strings can be null terminated after the fact
-	// but don't reflect this extra byte in the nb->len count
-	nb->buf = (char*) kiwi_malloc("nbuf:buf", sl+1);
-    memcpy(nb->buf, s, sl);
-	nb->len = sl;
 	nb->done = FALSE;
-	nb->dequeued = FALSE;
-	nb->ttl = nd->ttl;
+	nb->enq_us = timer_us64();
 	if (nd->dbug) nb->id = id++;
 	ovfl = nbuf_enqueue(nd, nb);
 	if (nd->dbug) printf("A%d ", nb->id);
-	if (nd->dbug) nbuf_dumpq(nd);
+	nbuf_dumpq(nd);
 	
 	check_nbuf(nb);
 	if (ovfl) {
-		kiwi_free("nbuf:buf", nb->buf);
+		nbuf_free_buf(nb);
 		nbuf_free(nb);
 	}
 }
 
-nbuf_t *nbuf_dequeue(ndesc_t *nd)
+void nbuf_allocq(ndesc_t *nd, char *s, int sl)
 {
 	check_ndesc(nd);
-	nbuf_t **q_head = &nd->q_head;
 	nbuf_t *nb;
 	
+	assert(s != NULL);
+	assert(sl > 0);
+	nb = nbuf_malloc();
+	nb->buf = nbuf_pay_alloc(s, sl);
+	nb->len = sl;
+	nbuf_queue(nd, nb);
+}
+
+// buf from nbuf_ref_alloc(): queued by reference
+void nbuf_allocq_ref(ndesc_t *nd, char *buf, int sl)
+{
+	check_ndesc(nd);
+	nbuf_t *nb;
+	
+	assert(buf != NULL);
+	assert(sl > 0);
+	nb = nbuf_malloc();
+	nbuf_pay(buf)->refcnt++;
+	nb->buf = buf;
+	nb->len = sl;
+	nbuf_queue(nd, nb);
+}
+
+nbuf_t *nbuf_dequeue(ndesc_t *nd)
+{
+	check_ndesc(nd);
+	nbuf_t *nb = NULL;
+	
 	lock_enter(&nd->lock);
 	
-		nb = *q_head;
-		if (nb) check_nbuf(nb);
-		while (nb && nb->dequeued) {
-			nb = nb->prev;
-			if (nb) check_nbuf(nb);
-		}
-		if (nb) {
+		if (nd->deq != nd->tail) {
+			nb = ND_SLOT(nd, nd->deq);
+			check_nbuf(nb);
+			nd->deq++;
 			if (nd->dbug) printf("D%d ", nb->id);
-			nb->dequeued = TRUE;
-			nd->cnt--;
-			if (nd->dbug) nbuf_dumpq(nd);
+			nbuf_dumpq(nd);
 		}
 		
 	lock_leave(&nd->lock);
 	
 	assert(!nb || (nb && !nb->done));
 	//assert(!nb || ((nb->mc->remote_port == nd->mc->remote_port) && (strcmp(nb->mc->remote_ip, nd->mc->remote_ip) == 0)));
-	if (nb) check_nbuf(nb);
 	return nb;
 }
 
+// no lock needed: the cursors are only changed by tasks, which are not preempted
 int nbuf_queued(ndesc_t *nd)
 {
 	check_ndesc(nd);
-	nbuf_t *bp;
-	int queued = 0;
-	
-	lock_enter(&nd->lock);
-		bp = nd->q;
-		if (bp) check_nbuf(bp);
-		while (bp) {
-			if (!bp->dequeued) {
-				queued++;
-			}
-			bp = bp->next;
-			if (bp) check_nbuf(bp);
-		}
-	lock_leave(&nd->lock);
-	
-	return queued;
+	return ND_DEPTH(nd);
 }
 
 void nbuf_cleanup(ndesc_t *nd)
 {
 	check_ndesc(nd);
-	nbuf_t **q = &nd->q, **q_head = &nd->q_head;
 	nbuf_t *dp;
 	int i=0;
 	
 	lock_enter(&nd->lock);
 	
-		while ((dp = *q_head) != NULL) {
+		for (; nd->head != nd->tail; nd->head++) {
+			dp = ND_SLOT(nd, nd->head);
 			check_nbuf(dp);
 			//assert(dp->buf);
 			if (dp->buf == 0)
 				lprintf("WARNING: dp->buf == NULL\n");
 			else
-			kiwi_free("nbuf:buf", dp->buf);
+			nbuf_free_buf(dp);
 
-			*q_head = dp->prev;
-			if (dp == *q) *q = NULL;
 			nbuf_free(dp);
+			ND_SLOT(nd, nd->head) = NULL;
 			i++;
 		}
 		
-		nd->cnt = 0;
+		nd->head = nd->deq = nd->tail = 0;
 		nd->ovfl = FALSE;
 		
 	lock_leave(&nd->lock);
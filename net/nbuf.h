@@ -13,37 +13,66 @@ typedef struct nbuf_st {
 	u4_t magic;
 	struct mg_connection *mc;
 	char *buf;
-	u2_t len, ttl, id;
-	bool done, expecting_done, dequeued, isFree;
+	u2_t len, id;
+	bool done, expecting_done, isFree;
+	u64_t enq_us;
 	u4_t magic_b;
-	struct nbuf_st *next, *prev;
+	struct nbuf_st *next;               // when on the free list
 	u4_t magic_e;
 } nbuf_t;
 
 #define NDESC_MAGIC_B	0xddddbbbb
 #define NDESC_MAGIC_E	0xddddeeee
 
+#define	ND_HIWAT	64
+#define	ND_LOWAT	32
+#define ND_RING     256     // power of 2, > ND_HIWAT plus buffers dequeued but not yet done
+
+// Traffic class of an ndesc, determines what is dropped above ND_HIWAT and the send order.
+// A user's SND and W/F streams are separate connections sharing one link, so the classes
+// are per ndesc rather than per buffer.
+#define ND_CLS_CTRL     0       // drop new buffers until the depth is below ND_LOWAT again
+#define ND_CLS_AUDIO    1       // same but sent first, and bulk is held back while its socket is backed up
+#define ND_CLS_BULK     2       // drop the oldest queued buffer so the newest data gets through
+#define ND_NCLS         3
+
+// Bounded ring of queued nbufs. The cursors are free running and masked on use:
+//  head    oldest buffer not yet freed, advanced over done buffers on enqueue
+//  deq     next buffer for nbuf_dequeue()
+//  tail    next free slot
+// so head <= deq <= tail and the queue depth (queued, not yet dequeued) is tail - deq.
+
 typedef struct {
 	struct mg_connection *mc;
 	lock_t lock;
 	u4_t magic_b;
-	nbuf_t *q, *q_head;
+	nbuf_t *ring[ND_RING];
+	u4_t head, deq, tail;
 	u4_t magic_e;
-	u2_t cnt, ttl;
 	bool ovfl, dbug;
+	u1_t cls;
+	
+	// stats, depth_hiwat reset by the reader
+	u2_t depth_hiwat;
+	u4_t drops;
 } ndesc_t;
 
-#define	ND_HIWAT	64
-#define	ND_LOWAT	32
+#define ND_DEPTH(nd)    ((int) ((nd)->tail - (nd)->deq))
 
-void ndesc_init(ndesc_t *nd, struct mg_connection *mc);
+void ndesc_init(ndesc_t *nd, struct mg_connection *mc, int cls = ND_CLS_CTRL);
 void ndesc_register(ndesc_t *nd);
 
 void nbuf_init();
 void nbuf_stat();
 void nbuf_allocq(ndesc_t *nd, char *s, int sl);
+
+// refcounted payload that can be queued to several ndesc without a copy for each
+char *nbuf_ref_alloc(char *s, int sl);
+void nbuf_ref_release(char *buf);
+void nbuf_allocq_ref(ndesc_t *nd, char *buf, int sl);
+
 nbuf_t *nbuf_dequeue(ndesc_t *nd);
-int nbuf_queued(ndesc_t *nd);
+int nbuf_queued(ndesc_t *nd);     // O(1)
 void nbuf_cleanup(ndesc_t *nd);
 
 #endif
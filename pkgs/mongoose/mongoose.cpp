@@ -41,6 +41,7 @@
 #define NS_ENABLE_IPV6
 #define MONGOOSE_NO_THREADS
 //#define NS_ENABLE_SSL
+#define NS_USE_EPOLL
 
 #ifndef NS_SKELETON_HEADER_INCLUDED
 #define NS_SKELETON_HEADER_INCLUDED
@@ -121,6 +122,10 @@
 	#include <netinet/in.h>
 	#include <sys/socket.h>
 	#include <sys/select.h>
+	#include <sys/uio.h>
+	#ifdef NS_USE_EPOLL
+	 #include <sys/epoll.h>
+	#endif
 	#define closesocket(x) close(x)
 	#define __cdecl
 	#define INVALID_SOCKET (-1)
@@ -183,6 +188,10 @@ struct ns_server {
   SSL_CTX *ssl_ctx;
   SSL_CTX *client_ssl_ctx;
   sock_t ctl[2];
+#ifdef NS_USE_EPOLL
+  int epfd;
+  sock_t ep_listening_sock;   // listening_sock as registered with epfd
+#endif
 };
 
 struct ns_connection {
@@ -195,6 +204,9 @@ struct ns_connection {
   struct iobuf send_iobuf;
   SSL *ssl;
   unsigned int flags;
+#ifdef NS_USE_EPOLL
+  unsigned int ep_events;     // as registered with epfd, 0 if not yet
+#endif
 #define NSF_FINISHED_SENDING_DATA   (1 << 0)
 #define NSF_BUFFER_BUT_DONT_SEND    (1 << 1)
 #define NSF_SSL_HANDSHAKE_DONE      (1 << 2)
@@ -342,11 +354,28 @@ printf("pthread_create f %p th %p\n", f, thread_id);
 }
 #endif  // NS_DISABLE_THREADS
 
+#ifdef NS_USE_EPOLL
+// KiwiSDR: Sockets stay registered with the server's epoll fd for their lifetime, so a poll
+// costs one epoll_wait() plus an epoll_ctl() only when a connection starts or stops
+// having data to send, instead of building and scanning fd_sets of every socket.
+static void ns_ep_update(struct ns_connection *c, unsigned int events) {
+  struct epoll_event ev;
+  if (c->server->epfd < 0 || c->sock == INVALID_SOCKET || c->ep_events == events) return;
+  ev.events = events;
+  ev.data.ptr = c;
+  if (epoll_ctl(c->server->epfd, c->ep_events? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c->sock, &ev) == 0)
+    c->ep_events = events;
+}
+#endif
+
 static void ns_add_conn(struct ns_server *server, struct ns_connection *c) {
   c->next = server->active_connections;
   server->active_connections = c;
   c->prev = NULL;
   if (c->next != NULL) c->next->prev = c;
+#ifdef NS_USE_EPOLL
+  ns_ep_update(c, EPOLLIN);
+#endif
 }
 
 static void ns_remove_conn(struct ns_connection *conn) {
@@ -424,6 +453,10 @@ static void ns_close_conn(struct ns_connection *conn) {
   DBG(("%p %d", conn, conn->flags));
   ns_call(conn, NS_CLOSE, NULL);
   ns_remove_conn(conn);
+#ifdef NS_USE_EPOLL
+  // explicitly: the socket may still be open in a fork()ed child and so not be removed by the close
+  if (conn->ep_events) epoll_ctl(conn->server->epfd, EPOLL_CTL_DEL, conn->sock, NULL);
+#endif
   closesocket(conn->sock);
   iobuf_free(&conn->recv_iobuf);
   iobuf_free(&conn->send_iobuf);
@@ -745,6 +778,8 @@ static void ns_write_to_socket(struct ns_connection *conn) {
   } else
 #endif
   { n = send(conn->sock, io->buf, io->len, 0); }
+  mg_tx_stats.calls++;
+  if (n > 0) mg_tx_stats.bytes += n;
 
 
 #ifdef NS_ENABLE_HEXDUMP
@@ -772,6 +807,95 @@ int ns_send(struct ns_connection *conn, const void *buf, int len) {
   return iobuf_append(&conn->send_iobuf, buf, len);
 }
 
+#ifdef NS_USE_EPOLL
+#define NS_EP_MAX_EVENTS 64
+
+int ns_server_poll(struct ns_server *server, int milli) {
+  struct ns_connection *conn, *tmp_conn;
+  struct epoll_event evs[NS_EP_MAX_EVENTS], ev;
+  int i, n, num_active_connections = 0;
+  time_t current_time = time(NULL);
+
+  if (server->listening_sock == INVALID_SOCKET &&
+      server->active_connections == NULL) return 0;
+
+  // listening_sock can be replaced by ns_bind() / mg_set_listening_socket()
+  if (server->ep_listening_sock != server->listening_sock) {
+    if (server->ep_listening_sock != INVALID_SOCKET)
+      epoll_ctl(server->epfd, EPOLL_CTL_DEL, server->ep_listening_sock, NULL);
+    server->ep_listening_sock = server->listening_sock;
+    if (server->listening_sock != INVALID_SOCKET) {
+      ev.events = EPOLLIN;
+      ev.data.ptr = &server->listening_sock;
+      epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->listening_sock, &ev);
+    }
+  }
+
+  for (conn = server->active_connections; conn != NULL; conn = tmp_conn) {
+    tmp_conn = conn->next;
+    ns_call(conn, NS_POLL, &current_time);
+    if (conn->flags & NSF_CONNECTING) {
+      ns_ep_update(conn, EPOLLIN | EPOLLOUT);
+    } else if (conn->send_iobuf.len > 0 && !(conn->flags & NSF_BUFFER_BUT_DONT_SEND)) {
+      ns_ep_update(conn, EPOLLIN | EPOLLOUT);
+    } else if (conn->flags & NSF_CLOSE_IMMEDIATELY) {
+      ns_close_conn(conn);
+    } else {
+      ns_ep_update(conn, EPOLLIN);
+    }
+  }
+
+  n = epoll_wait(server->epfd, evs, NS_EP_MAX_EVENTS, milli);
+
+  // Each fd is reported at most once and nothing is closed before the loop below,
+  // so the data.ptr of every event is still a live connection.
+  for (i = 0; i < n; i++) {
+    unsigned int e = evs[i].events;
+
+    // Accept new connections
+    if (evs[i].data.ptr == &server->listening_sock) {
+      if ((conn = accept_conn(server)) != NULL) {
+        conn->last_io_time = current_time;
+      }
+      continue;
+    }
+
+    // Read possible wakeup calls
+    if (evs[i].data.ptr == &server->ctl[1]) {
+      unsigned char ch;
+      recv(server->ctl[1], &ch, 1, 0);
+      send(server->ctl[1], &ch, 1, 0);
+      continue;
+    }
+
+    conn = (struct ns_connection *) evs[i].data.ptr;
+    if (e & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+      conn->last_io_time = current_time;
+      ns_read_from_socket(conn);
+    }
+    if ((e & EPOLLOUT) && !(conn->flags & NSF_CLOSE_IMMEDIATELY)) {
+      if (conn->flags & NSF_CONNECTING) {
+        ns_read_from_socket(conn);
+      } else if (!(conn->flags & NSF_BUFFER_BUT_DONT_SEND)) {
+        conn->last_io_time = current_time;
+        ns_write_to_socket(conn);
+      }
+    }
+  }
+
+  for (conn = server->active_connections; conn != NULL; conn = tmp_conn) {
+    tmp_conn = conn->next;
+    num_active_connections++;
+    if (conn->flags & NSF_CLOSE_IMMEDIATELY) {
+      ns_close_conn(conn);
+    }
+  }
+
+  return num_active_connections;
+}
+
+#else
+
 static void ns_add_to_set(sock_t sock, fd_set *set, sock_t *max_fd) {
   if (sock != INVALID_SOCKET) {
     FD_SET(sock, set);
@@ -862,6 +986,7 @@ int ns_server_poll(struct ns_server *server, int milli) {
 
   return num_active_connections;
 }
+#endif
 
 struct ns_connection *ns_connect(struct ns_server *server, const char *host,
                                  int port, int use_ssl, void *param) {
@@ -950,6 +1075,10 @@ void ns_server_init(struct ns_server *s, void *server_data, ns_callback_t cb) {
   s->listening_sock = s->ctl[0] = s->ctl[1] = INVALID_SOCKET;
   s->server_data = server_data;
   s->callback = cb;
+#ifdef NS_USE_EPOLL
+  s->ep_listening_sock = INVALID_SOCKET;
+  s->epfd = epoll_create1(EPOLL_CLOEXEC);
+#endif
 
 #ifdef _WIN32
   { WSADATA data; WSAStartup(MAKEWORD(2, 2), &data); }
@@ -963,6 +1092,14 @@ void ns_server_init(struct ns_server *s, void *server_data, ns_callback_t cb) {
   do {
     ns_socketpair(s->ctl);
   } while (s->ctl[0] == INVALID_SOCKET);
+#ifdef NS_USE_EPOLL
+  {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &s->ctl[1];
+    epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->ctl[1], &ev);
+  }
+#endif
 #endif
 
 #ifdef NS_ENABLE_SSL
@@ -989,6 +1126,12 @@ void ns_server_free(struct ns_server *s) {
     ns_close_conn(conn);
   }
 
+#ifdef NS_USE_EPOLL
+  if (s->epfd >= 0) close(s->epfd);
+  s->epfd = -1;
+  s->ep_listening_sock = INVALID_SOCKET;
+#endif
+
 #ifdef NS_ENABLE_SSL
   if (s->ssl_ctx != NULL) SSL_CTX_free(s->ssl_ctx);
   if (s->client_ssl_ctx != NULL) SSL_CTX_free(s->client_ssl_ctx);
@@ -2582,52 +2725,109 @@ static int deliver_websocket_frame(struct connection *conn) {
   return buffered;
 }
 
+mg_tx_stats_t mg_tx_stats;
+
+int mg_send_backlog(struct mg_connection *conn) {
+  return MG_CONN_2_CONN(conn)->ns_conn->send_iobuf.len;
+}
+
+// Frame format: http://tools.ietf.org/html/rfc6455#section-5.2
+static int ws_frame_header(unsigned char *hdr, int opcode, size_t data_len) {
+  hdr[0] = 0x80 + (opcode & 0x0f);
+  if (data_len < 126) {
+    // Inline 7-bit length field
+    hdr[1] = data_len;
+    return 2;
+  } else if (data_len <= 0xFFFF) {
+    // 16-bit length field
+    hdr[1] = 126;
+    * (uint16_t *) (hdr + 2) = (uint16_t) htons((uint16_t) data_len);
+    return 4;
+  } else {
+    // 64-bit length field
+    hdr[1] = 127;
+    * (uint32_t *) (hdr + 2) = (uint32_t)
+      htonl((uint32_t) ((uint64_t) data_len >> 32));
+    * (uint32_t *) (hdr + 6) = (uint32_t) htonl(data_len & 0xffffffff);
+    return 10;
+  }
+}
+
+// KiwiSDR: header and data appended separately instead of via a malloc'd copy of the frame
 int mg_websocket_write(struct mg_connection* conn, int opcode,
                        const char *data, size_t data_len) {
-    unsigned char *copy;
-    size_t copy_len = 0;
-    int retval = -1;
+    unsigned char hdr[10];
+    int hdr_len = ws_frame_header(hdr, opcode, data_len);
+    int retval = mg_write(conn, hdr, hdr_len);
+    if (data_len > 0) retval += mg_write(conn, data, data_len);
+    mg_tx_stats.frames++;
 
-    if ((copy = (unsigned char *) malloc(data_len + 10)) == NULL) {
-      return -1;
+    // If we send closing frame, schedule a connection to be closed after
+    // data is drained to the client.
+    if (opcode == 0x08) {
+        MG_CONN_2_CONN(conn)->ns_conn->flags |= NSF_FINISHED_SENDING_DATA;
     }
 
-    copy[0] = 0x80 + (opcode & 0x0f);
-
-    // Frame format: http://tools.ietf.org/html/rfc6455#section-5.2
-    if (data_len < 126) {
-      // Inline 7-bit length field
-      copy[1] = data_len;
-      memcpy(copy + 2, data, data_len);
-      copy_len = 2 + data_len;
-    } else if (data_len <= 0xFFFF) {
-      // 16-bit length field
-      copy[1] = 126;
-      * (uint16_t *) (copy + 2) = (uint16_t) htons((uint16_t) data_len);
-      memcpy(copy + 4, data, data_len);
-      copy_len = 4 + data_len;
-    } else {
-      // 64-bit length field
-      copy[1] = 127;
-      * (uint32_t *) (copy + 2) = (uint32_t)
-        htonl((uint32_t) ((uint64_t) data_len >> 32));
-      * (uint32_t *) (copy + 6) = (uint32_t) htonl(data_len & 0xffffffff);
-      memcpy(copy + 10, data, data_len);
-      copy_len = 10 + data_len;
+    return retval;
+}
+
+// KiwiSDR: Frames the n buffers and, if nothing is already waiting in the send buffer,
+// writes them to the socket with one writev() directly from the caller's buffers.
+// Whatever the socket doesn't take is appended to the send buffer for the next poll,
+// so the data can be released as soon as this returns.
+int mg_websocket_writev(struct mg_connection* conn, int opcode,
+                        const char **data, const size_t *data_len, int n) {
+    struct ns_connection *nc = MG_CONN_2_CONN(conn)->ns_conn;
+    unsigned char hdr[MG_WS_WRITEV_MAX][10];
+    struct iovec iov[MG_WS_WRITEV_MAX * 2];
+    int i, niov = 0, total = 0, sent = 0;
+
+    if (n > MG_WS_WRITEV_MAX) n = MG_WS_WRITEV_MAX;
+    for (i = 0; i < n; i++) {
+      iov[niov].iov_base = hdr[i];
+      iov[niov].iov_len = ws_frame_header(hdr[i], opcode, data_len[i]);
+      total += iov[niov++].iov_len;
+      if (data_len[i] > 0) {
+        iov[niov].iov_base = (void *) data[i];
+        iov[niov].iov_len = data_len[i];
+        total += iov[niov++].iov_len;
+      }
     }
+    mg_tx_stats.frames += n;
 
-    if (copy_len > 0) {
-      retval = mg_write(conn, copy, copy_len);
+    if (nc->send_iobuf.len == 0 && !(nc->flags & (NSF_BUFFER_BUT_DONT_SEND | NSF_CLOSE_IMMEDIATELY))
+#ifdef NS_ENABLE_SSL
+        && nc->ssl == NULL
+#endif
+      ) {
+      sent = writev(nc->sock, iov, niov);
+      mg_tx_stats.calls++;
+      if (ns_is_error(sent)) {
+        nc->flags |= NSF_CLOSE_IMMEDIATELY;
+        return -1;
+      }
+      if (sent < 0) sent = 0;   // EAGAIN etc
+      if (sent > 0) {
+        mg_tx_stats.bytes += sent;
+        nc->last_io_time = time(NULL);
+      }
+    }
+
+    for (i = 0; i < niov; i++) {
+      int len = iov[i].iov_len;
+      if (sent >= len) {
+        sent -= len;
+      } else {
+        ns_send(nc, (char *) iov[i].iov_base + sent, len - sent);
+        sent = 0;
+      }
     }
-    free(copy);
 
-    // If we send closing frame, schedule a connection to be closed after
-    // data is drained to the client.
     if (opcode == 0x08) {
-        MG_CONN_2_CONN(conn)->ns_conn->flags |= NSF_FINISHED_SENDING_DATA;
+      nc->flags |= (nc->send_iobuf.len > 0)? NSF_FINISHED_SENDING_DATA : NSF_CLOSE_IMMEDIATELY;
     }
 
-    return retval;
+    return total;
 }
 
 static void send_websocket_handshake_if_requested(struct mg_connection *conn) {
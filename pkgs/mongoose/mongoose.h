@@ -110,6 +110,20 @@ void mg_printf_data(struct mg_connection *, const char *format, ...);
 int mg_websocket_write(struct mg_connection *, int opcode,
                        const char *data, size_t data_len);
 
+// KiwiSDR: n frames with a single writev(), only copied to the send buffer if the socket would block
+#define MG_WS_WRITEV_MAX 32
+int mg_websocket_writev(struct mg_connection *, int opcode,
+                        const char **data, const size_t *data_len, int n);
+
+// KiwiSDR: bytes waiting in the send buffer because the socket wouldn't take them
+int mg_send_backlog(struct mg_connection *);
+
+// KiwiSDR: socket send syscalls, bytes and websocket frames since last reset
+typedef struct {
+	unsigned int calls, bytes, frames;
+} mg_tx_stats_t;
+extern mg_tx_stats_t mg_tx_stats;
+
 // Deprecated in favor of mg_send_* interface
 int mg_write(struct mg_connection *, const void *buf, int len);
 int mg_printf(struct mg_connection *conn, const char *fmt, ...);
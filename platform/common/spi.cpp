@@ -87,6 +87,7 @@ void spi_stats()
 static int wait_avail(const char *where, SPI_CMD cmd)
 {
     int wait = 0;
+    if (iq_replay) return wait;
     
 	for (int max = 0; !GPIO_READ_BIT(CMD_READY) && max < 1000; max++) {
 	    wait++;
@@ -199,6 +200,15 @@ static void spi_scan(int wait, SPI_MOSI *mosi, int tbytes=0, SPI_MISO *miso=junk
 	// also note in some cases it is possible for: miso == prev == junk on entry
 	miso->status = BUSY;	// for loop in spi_get()
 	prev->status = BUSY;	// for loop below
+	
+	// no FPGA when replaying: previous request completes immediately with a zeroed reply
+	if (iq_replay) {
+	    if (prev->len_bytes > sizeof(prev->status))     // junk has len_bytes == 0 on the first call
+	        memset(prev->word, 0, prev->len_bytes - sizeof(prev->status));
+	    prev->status = 0;
+	    prev = miso;
+	    return;
+	}
 
 	int retries=0;
     for (i=0; i < 32; i++) {
@@ -88,7 +88,7 @@ typedef struct {
  #define MFFTW_MALLOC fftwf_malloc
  #define MFFTW_FREE fftwf_free
  #define MFFTW_PLAN fftwf_plan
- #define MFFTW_PLAN_DFT_1D fftwf_plan_dft_1d
+ #define MFFTW_PLAN_DFT_1D fftw_wisdom_plan_dft_1d		// fftw_wisdom.h
  #define MFFTW_DESTROY_PLAN fftwf_destroy_plan
  #define MFFTW_EXECUTE fftwf_execute
 #endif
@@ -110,9 +110,8 @@ CFastFIR::CFastFIR()
 	}
 #endif
 
-	m_FFT_CoefPlan = MFFTW_PLAN_DFT_1D(CONV_FFT_SIZE, (MFFTW_COMPLEX*) m_pFilterCoef, (MFFTW_COMPLEX*) m_pFilterCoef, FFTW_FORWARD, FFTW_ESTIMATE);
-	m_FFT_FwdPlan = MFFTW_PLAN_DFT_1D(CONV_FFT_SIZE, (MFFTW_COMPLEX*) m_pFFTBuf, (MFFTW_COMPLEX*) m_pFFTBuf, FFTW_FORWARD, FFTW_ESTIMATE);
-	m_FFT_RevPlan = MFFTW_PLAN_DFT_1D(CONV_FFT_SIZE, (MFFTW_COMPLEX*) m_pFFTBuf, (MFFTW_COMPLEX*) m_pFFTBuf, FFTW_BACKWARD, FFTW_ESTIMATE);
+	// plans are made by CreatePlans() since m_PassbandFIR[] is constructed before main() has imported the FFTW wisdom
+	m_FFT_CoefPlan = m_FFT_FwdPlan = m_FFT_RevPlan = NULL;
 	
 	m_FLoCut = -1.0;
 	m_FHiCut = 1.0;
@@ -124,6 +123,14 @@ CFastFIR::~CFastFIR()
 {
 }
 
+void CFastFIR::CreatePlans()
+{
+	if (m_FFT_CoefPlan != NULL) return;
+	m_FFT_CoefPlan = MFFTW_PLAN_DFT_1D(CONV_FFT_SIZE, (MFFTW_COMPLEX*) m_pFilterCoef, (MFFTW_COMPLEX*) m_pFilterCoef, FFTW_FORWARD, FFTW_ESTIMATE);
+	m_FFT_FwdPlan = MFFTW_PLAN_DFT_1D(CONV_FFT_SIZE, (MFFTW_COMPLEX*) m_pFFTBuf, (MFFTW_COMPLEX*) m_pFFTBuf, FFTW_FORWARD, FFTW_ESTIMATE);
+	m_FFT_RevPlan = MFFTW_PLAN_DFT_1D(CONV_FFT_SIZE, (MFFTW_COMPLEX*) m_pFFTBuf, (MFFTW_COMPLEX*) m_pFFTBuf, FFTW_BACKWARD, FFTW_ESTIMATE);
+}
+
 //////////////////////////////////////////////////////////////////////
 //  Call to setup filter parameters
 // SampleRate in Hz
@@ -211,13 +218,14 @@ int i;
 //input samples due to FFT block size processing.
 //600ns/samp
 ///////////////////////////////////////////////////////////////////////////////
-int CFastFIR::ProcessData(int rx_chan, int InLength, TYPECPX* InBuf, TYPECPX* OutBuf)
+int CFastFIR::ProcessData(int rx_chan, int InLength, TYPECPX* InBuf, TYPECPX* OutBuf,
+    ext_receive_FFT_samps_t receive_FFT, ext_FFT_filtering_e filtering)
 {
 //print_max_min_c("FIRin", InBuf, InLength);
 
-ext_receive_FFT_samps_t receive_FFT = ext_users[rx_chan].receive_FFT;
-bool receive_FFT_pre = (receive_FFT != NULL && ext_users[rx_chan].filtering == PRE_FILTERED);
-bool receive_FFT_post = (receive_FFT != NULL && ext_users[rx_chan].filtering == POST_FILTERED);
+// the caller samples the extension callback once so the decision to run on a worker thread holds
+bool receive_FFT_pre = (receive_FFT != NULL && filtering == PRE_FILTERED);
+bool receive_FFT_post = (receive_FFT != NULL && filtering == POST_FILTERED);
 
 int i = 0;
 int j;
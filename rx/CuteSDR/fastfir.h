@@ -15,6 +15,8 @@
 #include "datatypes.h"
 #include "kiwi.h"
 #include <fftw3.h>
+#include "fftw_wisdom.h"
+#include "ext.h"
 
 #define CONV_FIR_SIZE (CONV_FFT_SIZE/2+1)	//must be <= FFT size. Make 1/2 +1 if want
 											//output to be in power of 2
@@ -25,8 +27,11 @@ public:
 	CFastFIR();
 	virtual ~CFastFIR();
 
+	void CreatePlans();
+
 	void SetupParameters( TYPEREAL FLoCut,TYPEREAL FHiCut,TYPEREAL Offset, TYPEREAL SampleRate);
-	int ProcessData(int rx_chan, int InLength, TYPECPX* InBuf, TYPECPX* OutBuf);
+	int ProcessData(int rx_chan, int InLength, TYPECPX* InBuf, TYPECPX* OutBuf,
+	    ext_receive_FFT_samps_t receive_FFT, ext_FFT_filtering_e filtering);
 
 	int FirPos() const { return m_InBufInPos - CONV_FIR_SIZE + 1; }
 private:
@@ -40,8 +45,8 @@ private:
 	int m_InBufInPos;
 	TYPEREAL m_pWindowTbl[CONV_FIR_SIZE];
 	TYPECPX m_pFFTOverlapBuf[CONV_FIR_SIZE];
-	TYPECPX m_pFilterCoef[CONV_FFT_SIZE];
-	TYPECPX m_pFFTBuf[CONV_FFT_SIZE];
+	TYPECPX m_pFilterCoef[CONV_FFT_SIZE] __attribute__ ((aligned (16)));
+	TYPECPX m_pFFTBuf[CONV_FFT_SIZE] __attribute__ ((aligned (16)));
 	TYPECPX m_pFFTBuf_pre[CONV_FFT_SIZE]; // pre-filtered FFT with CIC compensation
 	TYPEREAL m_CIC[CONV_FFT_SIZE]; // CIC compensation coefficients
 	MFFTW_PLAN m_FFT_CoefPlan;
@@ -130,5 +130,6 @@ typedef struct conn_st {
 #define AJAX_PHOTO			7
 #define AJAX_STATUS			8
 #define AJAX_USERS			9
+#define AJAX_LATENCY		10
 
 extern conn_t conns[];
@@ -31,6 +31,9 @@ Boston, MA  02110-1301, USA.
 #include "debug.h"
 #include "shmem.h"
 #include "data_pump.h"
+#include "iq_replay.h"
+#include "simd.h"
+#include "lat_hist.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -92,7 +95,19 @@ static void snd_service()
         evDPC(EC_TRIG3, EV_DPUMP, -1, "snd_svc", "CmdGetRX..");
     
         // CTRL_SND_INTR cleared as a side-effect of the CmdGetRX
-        spi_get3_noduplex(CmdGetRX, miso, rx_xfer_size, nrx_samps_rem, nrx_samps_loop);
+        if (iq_replay) {
+            u64_t ticks;
+            u2_t stored, current;
+            iq_replay_get(rxd->iq_t, &ticks, &stored, &current);
+            rxt->ticks[0] = ticks & 0xffff;
+            rxt->ticks[1] = (ticks >> 16) & 0xffff;
+            rxt->ticks[2] = (ticks >> 32) & 0xffff;
+            rxt->write_ctr_stored = stored;
+            rxt->write_ctr_current = current;
+            miso->status = 0;
+        } else {
+            spi_get3_noduplex(CmdGetRX, miso, rx_xfer_size, nrx_samps_rem, nrx_samps_loop);
+        }
         moved++;
         dpump.rx_adc_ovfl = miso->status & SPI_ST_ADC_OVFL;
         
@@ -135,10 +150,13 @@ static void snd_service()
                 ev_dump/1000.0));
         #endif
     
+        // a full ring (c2s_sound not keeping up) drops this transfer instead of overwriting unread data
+        rx_dpump_in_t *in[MAX_RX_CHANS];
         TYPECPX *i_samps[MAX_RX_CHANS];
         for (int ch=0; ch < rx_chans; ch++) {
             rx_dpump_t *rx = &rx_dpump[ch];
-            i_samps[ch] = rx->in_samps[rx->wr_pos];
+            in[ch] = rx_channels[ch].data_enabled? (rx_dpump_in_t *) spsc_ring_wr_ptr(&rx->in_ring) : NULL;
+            i_samps[ch] = in[ch]? in[ch]->samps : NULL;
         }
     
         rx_iq_t *iqp = (rx_iq_t*) &rxd->iq_t;
@@ -157,44 +175,32 @@ static void snd_service()
             debug_ticks++;
         #endif
                 
-        for (j=0; j < nrx_samps; j++) {
-    
-            for (int ch=0; ch < rx_chans; ch++) {
-                if (rx_channels[ch].data_enabled) {
-                    s4_t i, q;
-                    i = S24_8_16(iqp->i3, iqp->i);
-                    q = S24_8_16(iqp->q3, iqp->q);
-                    
-                    // NB: I/Q reversed to get correct sideband polarity; fixme: why?
-                    // [probably because mixer NCO polarity is wrong, i.e. cos/sin should really be cos/-sin]
-                    i_samps[ch]->re = q * rescale + DC_offset_I;
-                    i_samps[ch]->im = i * rescale + DC_offset_Q;
-                    i_samps[ch]++;
-                }
-                
-                iqp++;
-            }
+        // unpack only the enabled channels (enables sampled once per block above), straight into their ring slots
+        // NB: I/Q reversed to get correct sideband polarity; fixme: why?
+        // [probably because mixer NCO polarity is wrong, i.e. cos/sin should really be cos/-sin]
+        for (int ch=0; ch < rx_chans; ch++) {
+            if (i_samps[ch] != NULL)
+                simd_s24iq_to_ccf(nrx_samps, &iqp[ch], rx_chans, rescale, DC_offset_I, DC_offset_Q, (fftwf_complex *) i_samps[ch]);
         }
     
         for (int ch=0; ch < rx_chans; ch++) {
-            if (rx_channels[ch].data_enabled) {
+            if (in[ch] != NULL) {
                 rx_dpump_t *rx = &rx_dpump[ch];
 
-                rx->ticks[rx->wr_pos] = S16x4_S64(0, rxt->ticks[2], rxt->ticks[1], rxt->ticks[0]);
+                in[ch]->ticks = S16x4_S64(0, rxt->ticks[2], rxt->ticks[1], rxt->ticks[0]);
     
                 #ifdef SND_SEQ_CHECK
-                    rx->in_seq[rx->wr_pos] = snd_seq;
+                    in[ch]->seq = snd_seq;
                 #endif
                 
-                rx->wr_pos = (rx->wr_pos+1) & (N_DPBUF-1);
+                spsc_ring_wr_commit(&rx->in_ring);
                 
-                diff = (rx->wr_pos >= rx->rd_pos)? rx->wr_pos - rx->rd_pos : N_DPBUF - rx->rd_pos + rx->wr_pos;
+                diff = spsc_ring_count(&rx->in_ring);
                 dpump.in_hist[diff]++;
-
+            } else
+            if (rx_channels[ch].data_enabled) {
                 #ifdef DATA_PUMP_DEBUG
-                    if (rx->wr_pos == rx->rd_pos) {
-                        real_printf("#%d ", ch); fflush(stdout);
-                    }
+                    real_printf("#%d ", ch); fflush(stdout);
                 #endif
             }
         }
@@ -292,7 +298,9 @@ static void data_pump(void *param)
 		evDP(EC_EVENT, EV_DPUMP, -1, "data_pump", evprintf("WAKEUP: SPI CTRL_SND_INTR %d",
 			GPIO_READ_BIT(SND_INTR)));
 
+		u64_t t_svc = timer_us64();
 		snd_service();
+		lat_hist_add(&lat_stats.dpump, timer_us64() - t_svc);
 		
 		for (int ch=0; ch < rx_chans; ch++) {
 			rx_chan_t *rx = &rx_channels[ch];
@@ -333,6 +341,7 @@ void data_pump_start_stop()
 		itask_run = true;
 		ctrl_clr_set(CTRL_SND_INTR, 0);
 		spi_set(CmdSetRXNsamps, nrx_samps);
+		if (iq_replay) iq_replay_start();
 		//printf("#### START dpump\n");
 		last_run_us = 0;
 	}
@@ -358,11 +367,20 @@ void data_pump_init()
 	// does a single nrx_samps transfer fit in the SPI buf?
 	assert (rx_xfer_size <= SPIBUF_BMAX);	// in bytes
 	
-	// see rx_dpump_t.in_samps[][]
+	// see rx_dpump_t.in_ring
 	assert (FASTFIR_OUTBUF_SIZE > nrx_samps);
 	
+	for (int ch=0; ch < rx_chans; ch++) {
+	    rx_dpump_t *rx = &rx_dpump[ch];
+	    spsc_ring_init(&rx->in_ring, "rx_dpump", N_DPBUF, RX_DPUMP_IN_SIZE(nrx_samps));
+	    rx->real_samples = (TYPEMONO16 (*)[FASTFIR_OUTBUF_SIZE]) kiwi_malloc("rx_dpump", N_DPBUF * sizeof(rx->real_samples[0]));
+	    memset(rx->real_samples, 0, N_DPBUF * sizeof(rx->real_samples[0]));
+	}
+	
 	// rescale factor from hardware samples to what CuteSDR code is expecting
 	rescale = MPOW(2, -RXOUT_SCALE + CUTESDR_SCALE);
+	
+	if (iq_replay) iq_replay_init();
 
 	CreateTaskF(data_pump, 0, DATAPUMP_PRIORITY, CTF_POLL_INTR);
 }
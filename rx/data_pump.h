@@ -24,6 +24,7 @@ Boston, MA  02110-1301, USA.
 #include "spi.h"
 #include "cuteSDR.h"
 #include "ima_adpcm.h"
+#include "spsc_ring.h"
 
 //#define DATA_PUMP_DEBUG
 
@@ -38,23 +39,31 @@ typedef struct {
 
 #define N_DPBUF	32
 
+// element of rx_dpump_t.in_ring: one nrx_samps transfer for one channel
+typedef struct {
+    u64_t ticks;
+    #ifdef SND_SEQ_CHECK
+        u4_t seq;
+    #endif
+    TYPECPX samps[];    // nrx_samps
+} rx_dpump_in_t;
+
+#define RX_DPUMP_IN_SIZE(nsamps)    (sizeof(rx_dpump_in_t) + (nsamps) * sizeof(TYPECPX))
+
 typedef struct {
 	struct {
-		u4_t wr_pos, rd_pos;
-		// array size really nrx_samps but made pow2 FASTFIR_OUTBUF_SIZE for indexing efficiency
-		TYPECPX in_samps[N_DPBUF][FASTFIR_OUTBUF_SIZE];
-		u64_t ticks[N_DPBUF];
-		#ifdef SND_SEQ_CHECK
-		    u4_t in_seq[N_DPBUF];
-		#endif
+	    // data_pump -> c2s_sound, allocated for rx_chans only by data_pump_init() once nrx_samps is known
+	    spsc_ring_t in_ring;
 		
 		TYPECPX agc_samples[FASTFIR_OUTBUF_SIZE];
 
 		TYPEREAL demod_samples[FASTFIR_OUTBUF_SIZE];
 
+		// c2s_sound -> extensions, each reader keeps its own private rd_pos
+		// real_wr_pos is published with release semantics after the samples and seqnum are written
 		u4_t real_wr_pos, real_rd_pos;
 		u4_t real_seq, real_seqnum[N_DPBUF];
-		TYPEMONO16 real_samples[N_DPBUF][FASTFIR_OUTBUF_SIZE];
+		TYPEMONO16 (*real_samples)[FASTFIR_OUTBUF_SIZE];    // [N_DPBUF], allocated for rx_chans only
 	};
 	
 	struct {
@@ -104,6 +113,7 @@ typedef struct {
     u4_t in_hist[N_DPBUF];
     int rx_adc_ovfl;
     int audio_dropped;
+    u4_t edf_miss[MAX_RX_CHANS];    // c2s_sound didn't read a buffer before its EDF deadline
 } dpump_t;
 
 extern dpump_t dpump;
@@ -0,0 +1,156 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#include "types.h"
+#include "config.h"
+#include "kiwi.h"
+#include "misc.h"
+#include "timer.h"
+#include "coroutines.h"
+#include "data_pump.h"
+#include "iq_replay.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+char *iq_replay_file;
+
+#define IQ_SYNTH_AMPL   (0.0316 * (1 << (RXO_BITS-1)))      // -30 dBFS
+#define IQ_SYNTH_NOISE  0x3ff                               // about -78 dBFS
+
+static struct {
+    FILE *fp;
+    int n_iq;           // rx_iq_t per block (nrx_samps * rx_chans)
+    double period_us;   // one block of nrx_samps at snd_rate
+    u64_t start_us;
+    u4_t rd_blk;
+
+    double phase[MAX_RX_CHANS], phase_inc[MAX_RX_CHANS];
+    u4_t noise;
+} replay;
+
+static inline u4_t iq_replay_written()
+{
+    return (u4_t) ((timer_us64() - replay.start_us) / replay.period_us);
+}
+
+static inline s4_t iq_replay_noise()
+{
+    // xorshift32, cheap enough to run per sample
+    u4_t x = replay.noise;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    replay.noise = x;
+    return (s4_t) (x & IQ_SYNTH_NOISE) - (IQ_SYNTH_NOISE/2);
+}
+
+static void iq_replay_synth(rx_iq_t *iqp)
+{
+    for (int j = 0; j < nrx_samps; j++) {
+        for (int ch = 0; ch < rx_chans; ch++) {
+            double ph = replay.phase[ch];
+
+            // NB: data pump swaps I/Q, so generate the tone with that in mind
+            s4_t i = (s4_t) (IQ_SYNTH_AMPL * sin(ph)) + iq_replay_noise();
+            s4_t q = (s4_t) (IQ_SYNTH_AMPL * cos(ph)) + iq_replay_noise();
+            iqp->i3 = (i >> 16) & 0xff; iqp->i = i & 0xffff;
+            iqp->q3 = (q >> 16) & 0xff; iqp->q = q & 0xffff;
+            iqp++;
+
+            ph += replay.phase_inc[ch];
+            if (ph >= K_2PI) ph -= K_2PI;
+            replay.phase[ch] = ph;
+        }
+    }
+}
+
+static void iq_replay_read(rx_iq_t *iqp)
+{
+    int n = replay.n_iq;
+
+    while (n) {
+        int rd = fread(iqp, sizeof(rx_iq_t), n, replay.fp);
+        if (rd == 0) {
+            rewind(replay.fp);      // loop the recording
+            continue;
+        }
+        iqp += rd;
+        n -= rd;
+    }
+}
+
+void iq_replay_init()
+{
+    replay.n_iq = nrx_samps * rx_chans;
+    replay.period_us = (double) nrx_samps * 1e6 / snd_rate;
+    replay.noise = 0x1234567;
+
+    if (iq_replay == IQ_REPLAY_FILE) {
+        scallz("iq_replay fopen", (replay.fp = fopen(iq_replay_file, "r")));
+        fseek(replay.fp, 0, SEEK_END);
+        long size = ftell(replay.fp);
+        rewind(replay.fp);
+        if (size < (long) (replay.n_iq * sizeof(rx_iq_t))) {
+            lprintf("iq_replay: %s must contain at least one block of %d rx_iq_t (%d chans)\n",
+                iq_replay_file, replay.n_iq, rx_chans);
+            panic("iq_replay");
+        }
+        lprintf("iq_replay: file %s, %d blocks\n", iq_replay_file, (int) (size / (replay.n_iq * sizeof(rx_iq_t))));
+    } else {
+        for (int ch = 0; ch < rx_chans; ch++) {
+            double f_hz = 1000 + ch * 500;
+            replay.phase_inc[ch] = K_2PI * f_hz / snd_rate;
+        }
+        lprintf("iq_replay: synthetic tones 1000 + ch*500 Hz\n");
+    }
+
+    lprintf("iq_replay: virtual interrupt every %.3f msec\n", replay.period_us / 1e3);
+}
+
+void iq_replay_start()
+{
+    replay.start_us = timer_us64();
+    replay.rd_blk = 0;
+}
+
+bool iq_replay_intr()
+{
+    return itask_run && ((s4_t) (iq_replay_written() - replay.rd_blk) > 0);
+}
+
+// Fill a block the same way CmdGetRX would. The write counters reflect how many blocks
+// the "hardware" has produced so the data pump sees a backlog (or overrun) when it runs late.
+void iq_replay_get(rx_iq_t *iqp, u64_t *ticks, u2_t *write_ctr_stored, u2_t *write_ctr_current)
+{
+    u4_t rd = replay.rd_blk, wr = iq_replay_written();
+    if ((s4_t) (wr - rd) <= 0) wr = rd + 1;
+
+    if (replay.fp)
+        iq_replay_read(iqp);
+    else
+        iq_replay_synth(iqp);
+
+    *ticks = ((u64_t) rd * nrx_samps * rx_decim) & 0xffffffffffffULL;
+    *write_ctr_stored = rd;
+    *write_ctr_current = wr;
+
+    // hardware buffer would have wrapped: data pump will do a reset, so resync
+    if ((wr - rd) > (u4_t) (nrx_bufs-1))
+        replay.rd_blk = wr;
+    else
+        replay.rd_blk = rd + 1;
+}
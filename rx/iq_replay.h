@@ -0,0 +1,44 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#pragma once
+
+#include "types.h"
+#include "data_pump.h"
+
+// Hardware-free source for the data pump so the complete receive chain can be run
+// (and profiled) on a build machine without a cape.
+//
+// -iq_replay <file>    replay a recording of the CmdGetRX sample stream: raw rx_iq_t
+//                      triples, rx_chans interleaved per sample time exactly as they
+//                      appear in rxd->iq_t[], looped at EOF
+// -iq_synth            per-channel synthetic tone plus noise
+//
+// A virtual interrupt paced by timer_us() replaces SND_INTR and the virtual
+// buffer write counters mimic the FPGA so the data pump catch-up/reset logic
+// behaves as it does with hardware.
+
+#define IQ_REPLAY_NONE      0
+#define IQ_REPLAY_FILE      1
+#define IQ_REPLAY_SYNTH     2
+
+extern char *iq_replay_file;
+
+void iq_replay_init();
+void iq_replay_start();
+bool iq_replay_intr();
+void iq_replay_get(rx_iq_t *iqp, u64_t *ticks, u2_t *write_ctr_stored, u2_t *write_ctr_current);
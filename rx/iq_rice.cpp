@@ -0,0 +1,165 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#include "types.h"
+#include "iq_rice.h"
+#include "rice.h"
+
+#define IQ_RICE_ORDERS  3
+#define IQ_RICE_MAX_K   19
+
+static inline s4_t iq_rice_predict(int order, s4_t x1, s4_t x2)
+{
+    switch (order) {
+        case 0: return 0;
+        case 1: return x1;
+        default: return 2*x1 - x2;
+    }
+}
+
+static u1_t *iq_rice_encode_chan(const s2_t *x, int n, u1_t *out)
+{
+    // pick the predictor order with the smallest residual magnitude
+    u64_t sum[IQ_RICE_ORDERS] = {0};
+    s4_t x1 = 0, x2 = 0;
+    for (int i = 0; i < n; i++) {
+        s4_t s = x[i*2];
+        sum[0] += zigzag(s);
+        sum[1] += zigzag(s - x1);
+        sum[2] += zigzag(s - 2*x1 + x2);
+        x2 = x1; x1 = s;
+    }
+
+    int order = 0;
+    for (int o = 1; o < IQ_RICE_ORDERS; o++)
+        if (sum[o] < sum[order]) order = o;
+
+    // Rice parameter ~ log2(mean residual)
+    int k = 0;
+    while (k < IQ_RICE_MAX_K && ((u64_t) n << (k+1)) <= sum[order]) k++;
+
+    u4_t bits = 0;
+    x1 = x2 = 0;
+    for (int i = 0; i < n; i++) {
+        s4_t s = x[i*2];
+        u4_t q = zigzag(s - iq_rice_predict(order, x1, x2)) >> k;
+        bits += (q < IQ_RICE_ESC)? (q + 1 + k) : (IQ_RICE_ESC + IQ_RICE_ESC_BITS);
+        x2 = x1; x1 = s;
+    }
+
+    if (bits >= (u4_t) n * 16) {
+        *out++ = IQ_RICE_RAW << 5;
+        for (int i = 0; i < n; i++) {
+            s2_t s = x[i*2];
+            *out++ = (s >> 8) & 0xff;
+            *out++ = s & 0xff;
+        }
+        return out;
+    }
+
+    *out++ = (order << 5) | k;
+    bitw_t bw = { out, 0, 0 };
+    x1 = x2 = 0;
+    for (int i = 0; i < n; i++) {
+        s4_t s = x[i*2];
+        u4_t u = zigzag(s - iq_rice_predict(order, x1, x2));
+        u4_t q = u >> k;
+        if (q < IQ_RICE_ESC) {
+            bitw_put(&bw, ((1 << q) - 1) << 1, q + 1);      // unary: q ones then a zero
+            if (k) bitw_put(&bw, u, k);
+        } else {
+            bitw_put(&bw, (1 << IQ_RICE_ESC) - 1, IQ_RICE_ESC);
+            bitw_put(&bw, u, IQ_RICE_ESC_BITS);
+        }
+        x2 = x1; x1 = s;
+    }
+    bitw_flush(&bw);
+    return bw.p;
+}
+
+int iq_rice_encode(const s2_t *iq, int nsamps, u1_t *out)
+{
+    u1_t *op = out;
+    *op++ = (nsamps >> 8) & 0xff;
+    *op++ = nsamps & 0xff;
+    op = iq_rice_encode_chan(&iq[0], nsamps, op);
+    op = iq_rice_encode_chan(&iq[1], nsamps, op);
+    return op - out;
+}
+
+typedef struct {
+    const u1_t *p, *end;
+    u4_t acc;
+    int nbits;
+    bool err;
+} bitr_t;
+
+static inline u4_t bitr_get(bitr_t *br, int n)
+{
+    while (br->nbits < n) {
+        if (br->p >= br->end) { br->err = true; return 0; }
+        br->acc = (br->acc << 8) | *br->p++;
+        br->nbits += 8;
+    }
+    br->nbits -= n;
+    return (br->acc >> br->nbits) & ((1 << n) - 1);
+}
+
+static const u1_t *iq_rice_decode_chan(const u1_t *in, const u1_t *end, s2_t *x, int n)
+{
+    if (in >= end) return NULL;
+    int order = *in >> 5, k = *in & 0x1f;
+    in++;
+
+    if (order == IQ_RICE_RAW) {
+        if (end - in < n * 2) return NULL;
+        for (int i = 0; i < n; i++) {
+            x[i*2] = (s2_t) ((in[0] << 8) | in[1]);
+            in += 2;
+        }
+        return in;
+    }
+    if (order >= IQ_RICE_ORDERS || k > IQ_RICE_MAX_K) return NULL;
+
+    bitr_t br = { in, end, 0, 0, false };
+    s4_t x1 = 0, x2 = 0;
+    for (int i = 0; i < n; i++) {
+        u4_t q = 0, u;
+        while (q < IQ_RICE_ESC && bitr_get(&br, 1)) q++;
+        if (q < IQ_RICE_ESC)
+            u = (q << k) | (k? bitr_get(&br, k) : 0);
+        else
+            u = bitr_get(&br, IQ_RICE_ESC_BITS);
+        if (br.err) return NULL;
+        s4_t s = unzigzag(u) + iq_rice_predict(order, x1, x2);
+        x[i*2] = s;
+        x2 = x1; x1 = s;
+    }
+    return br.p;    // any remaining bits are the zero padding
+}
+
+int iq_rice_decode(const u1_t *in, int bytes, s2_t *iq, int max_nsamps)
+{
+    const u1_t *end = in + bytes;
+    if (bytes < 2) return -1;
+    int nsamps = (in[0] << 8) | in[1];
+    if (nsamps > max_nsamps) return -1;
+    in += 2;
+    if ((in = iq_rice_decode_chan(in, end, &iq[0], nsamps)) == NULL) return -1;
+    if ((in = iq_rice_decode_chan(in, end, &iq[1], nsamps)) == NULL) return -1;
+    return nsamps;
+}
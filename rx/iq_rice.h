@@ -0,0 +1,49 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#pragma once
+
+#include "types.h"
+
+// Lossless compression of the 16-bit IQ audio stream.
+// Requested by the client with "SET iq_comp=1" and signaled in snd_pkt_iq_t.h.comp
+// so the GPS timestamp header is sent unchanged.
+//
+// Every packet is self-contained (no state carried between packets):
+//  u2_t nsamps (big-endian) followed by the I channel then the Q channel, each as
+//  u1_t (order << 5) | k
+//      order 0..2: fixed polynomial predictor (FLAC style), residuals Rice coded with parameter k,
+//                  MSB first, zero-padded to a byte boundary
+//      order 3: no gain possible, nsamps raw big-endian s2_t
+//  A Rice quotient of IQ_RICE_ESC or more is sent as IQ_RICE_ESC one bits followed
+//  by the zigzagged residual in IQ_RICE_ESC_BITS bits.
+
+#define IQ_COMP_NONE        0
+#define IQ_COMP_RICE        1
+
+#define IQ_RICE_RAW         3
+#define IQ_RICE_ESC         24
+#define IQ_RICE_ESC_BITS    20
+
+// worst case: header + two raw channels
+#define IQ_RICE_MAX_BYTES(nsamps)   (sizeof(u2_t) + 2 * (1 + (nsamps) * sizeof(s2_t)))
+
+// iq[] is interleaved I/Q, returns the number of bytes written to out[]
+int iq_rice_encode(const s2_t *iq, int nsamps, u1_t *out);
+
+// returns the number of IQ samples written to iq[] or -1 if the input is malformed
+int iq_rice_decode(const u1_t *in, int bytes, s2_t *iq, int max_nsamps);
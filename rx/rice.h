@@ -0,0 +1,54 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#pragma once
+
+#include "types.h"
+
+// MSB first bit writer and residual mapping shared by the Rice coders (iq_rice.cpp, wf_delta.cpp)
+
+typedef struct {
+    u1_t *p;
+    u4_t acc;
+    int nbits;
+} bitw_t;
+
+// n <= 24
+static inline void bitw_put(bitw_t *bw, u4_t v, int n)
+{
+    bw->acc = (bw->acc << n) | (v & ((1 << n) - 1));
+    bw->nbits += n;
+    while (bw->nbits >= 8) {
+        bw->nbits -= 8;
+        *bw->p++ = (bw->acc >> bw->nbits) & 0xff;
+    }
+}
+
+static inline void bitw_flush(bitw_t *bw)
+{
+    if (bw->nbits) bitw_put(bw, 0, 8 - bw->nbits);
+}
+
+static inline u4_t zigzag(s4_t e)
+{
+    return (e < 0)? ((u4_t) (-e) << 1) - 1 : (u4_t) e << 1;
+}
+
+static inline s4_t unzigzag(u4_t u)
+{
+    return (u & 1)? -(s4_t) ((u + 1) >> 1) : (s4_t) (u >> 1);
+}
@@ -51,6 +51,15 @@ extern volatile u4_t audio_bytes[], waterfall_bytes[], waterfall_frames[], http_
 #define	WF_SPEED_FAST		WF_SPEED_MAX
 
 #define	WEB_SERVER_POLL_US	(1000000 / WF_SPEED_MAX / 2)
+#define	WEB_SERVER_IDLE_US	(50 * 1000)
+
+// hits: frames copied from another client with the same view, misses: frames computed,
+// bp_skipped: frames not produced because the client's queue was nearly full
+typedef struct {
+    u4_t hits, misses, bp_skipped;
+} wf_cache_stats_t;
+
+extern wf_cache_stats_t wf_cache_stats;
 
 
 void rx_server_init();
@@ -68,7 +77,7 @@ int rx_count_server_conns(conn_count_e type, conn_t *our_conn = NULL);
 typedef enum { WS_MODE_ALLOC, WS_MODE_LOOKUP, WS_MODE_CLOSE, WS_INTERNAL_CONN } websocket_mode_e;
 conn_t *rx_server_websocket(websocket_mode_e mode, struct mg_connection *mc);
 
-typedef enum { RX_CHAN_ENABLE, RX_CHAN_DISABLE, RX_DATA_ENABLE, RX_CHAN_FREE } rx_chan_action_e;
+typedef enum { RX_CHAN_ENABLE, RX_CHAN_DISABLE, RX_DATA_ENABLE, RX_DATA_DISABLE, RX_CHAN_FREE } rx_chan_action_e;
 void rx_enable(int chan, rx_chan_action_e action);
 
 typedef enum { RX_COUNT_ALL, RX_COUNT_NO_WF_FIRST } rx_free_count_e;
@@ -40,6 +40,7 @@ Boston, MA  02110-1301, USA.
 #ifndef CFG_GPS_ONLY
  #include "data_pump.h"
  #include "dx.h"
+ #include "wf_delta.h"
 #endif
 
 #include <string.h>
@@ -1058,7 +1059,9 @@ bool rx_common_cmd(const char *stream_name, conn_t *conn, char *cmd)
             sb = kstr_asprintf(sb, ",\"ad\":%d,\"au\":%d,\"ae\":%d,\"ar\":%d,\"an\":%d,\"an2\":%d,",
                 dpump.audio_dropped, underruns, seq_errors, dpump.resets, nrx_bufs, N_DPBUF);
             sb = kstr_cat(sb, kstr_list_int("\"ap\":[", "%u", "],", (int *) dpump.hist, nrx_bufs));
-            sb = kstr_cat(sb, kstr_list_int("\"ai\":[", "%u", "]", (int *) dpump.in_hist, N_DPBUF));
+            sb = kstr_cat(sb, kstr_list_int("\"ai\":[", "%u", "],", (int *) dpump.in_hist, N_DPBUF));
+            sb = kstr_cat(sb, kstr_list_int("\"am\":[", "%u", "],", (int *) dpump.edf_miss, rx_chans));
+            sb = kstr_asprintf(sb, "\"wc\":[%u,%u,%u]", wf_cache_stats.hits, wf_cache_stats.misses, wf_cache_stats.bp_skipped);
     #endif
 
             char utc_s[32], local_s[32];
@@ -1236,7 +1239,8 @@ bool rx_common_cmd(const char *stream_name, conn_t *conn, char *cmd)
         int wf_comp;
         n = sscanf(cmd, "SET wf_comp=%d", &wf_comp);
         if (n == 1) {
-            c2s_waterfall_compression(conn->rx_channel, wf_comp? true:false);
+            if (wf_comp < WF_COMP_NONE || wf_comp > WF_COMP_DELTA) wf_comp = WF_COMP_ADPCM;
+            c2s_waterfall_compression(conn->rx_channel, wf_comp);
             //printf("### SET wf_comp=%d\n", wf_comp);
             return true;
         }
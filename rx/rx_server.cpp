@@ -66,6 +66,7 @@ rx_stream_t rx_streams[] = {
 	{ AJAX_PHOTO,		"PIX" },
 	{ AJAX_STATUS,		"status" },
 	{ AJAX_USERS,		"users" },
+	{ AJAX_LATENCY,		"latency" },
 #endif
 	{ 0 }
 };
@@ -89,6 +90,7 @@ void rx_enable(int chan, rx_chan_action_e action)
 	case RX_CHAN_ENABLE: rx->chan_enabled = true; break;
 	case RX_CHAN_DISABLE: rx->chan_enabled = false; break;
 	case RX_DATA_ENABLE: rx->data_enabled = true; break;
+	case RX_DATA_DISABLE: rx->data_enabled = false; break;
 	case RX_CHAN_FREE: memset(rx, 0, sizeof(rx_chan_t)); break;
 	default: panic("rx_enable"); break;
 
@@ -686,7 +688,7 @@ conn_t *rx_server_websocket(websocket_mode_e mode, struct mg_connection *mc)
                 return NULL;
 			}
 			
-			if (st->type == STREAM_WATERFALL && rx >= wf_chans) {
+			if (st->type == STREAM_WATERFALL && rx >= wf_chans && wf_virt < 0) {
 				
 				// Kiwi UI handles no-WF condition differently -- don't send error
 				if (!isKiwi_UI) {
@@ -703,7 +705,7 @@ conn_t *rx_server_websocket(websocket_mode_e mode, struct mg_connection *mc)
 		} else {
             //printf("### %s cother=%p isKiwi_UI=%d isNo_WF=%d isWF_conn=%d\n",
             //    st->uri, cother, isKiwi_UI, isNo_WF, isWF_conn);
-			if (st->type == STREAM_WATERFALL && cother->rx_channel >= wf_chans) {
+			if (st->type == STREAM_WATERFALL && cother->rx_channel >= wf_chans && wf_virt < 0) {
 
 				// Kiwi UI handles no-WF condition differently -- don't send error
 				if (!isKiwi_UI) {
@@ -730,7 +732,7 @@ conn_t *rx_server_websocket(websocket_mode_e mode, struct mg_connection *mc)
     kiwi_strncpy(c->remote_ip, remote_ip, NET_ADDRSTRLEN);
 	c->remote_port = mc->remote_port;
 	c->tstamp = tstamp;
-	ndesc_init(&c->s2c, mc);
+	ndesc_init(&c->s2c, mc, (st->type == STREAM_SOUND)? ND_CLS_AUDIO : ((st->type == STREAM_WATERFALL)? ND_CLS_BULK : ND_CLS_CTRL));
 	ndesc_init(&c->c2s, mc);
 	c->ui = find_ui(mc->local_port);
 	assert(c->ui);
@@ -33,6 +33,7 @@ Boston, MA  02110-1301, USA.
 #include "net.h"
 #include "dx.h"
 #include "rx.h"
+#include "lat_hist.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -65,6 +66,7 @@ char *rx_server_ajax(struct mg_connection *mc)
 	if ((down || update_in_progress || backup_in_progress)
 		&& st->type != AJAX_VERSION
 		&& st->type != AJAX_STATUS
+		&& st->type != AJAX_LATENCY
 		&& st->type != AJAX_DISCOVERY
 		)
 			return NULL;
@@ -76,6 +78,7 @@ char *rx_server_ajax(struct mg_connection *mc)
 		&& st->type != AJAX_VERSION
 		&& st->type != AJAX_STATUS
 		&& st->type != AJAX_USERS
+		&& st->type != AJAX_LATENCY
 		&& st->type != AJAX_DISCOVERY
 		&& st->type != AJAX_PHOTO
 		) {
@@ -179,6 +182,13 @@ char *rx_server_ajax(struct mg_connection *mc)
 		return sb;		// NB: return here because sb is already a kstr_t (don't want to do kstr_wrap() below)
 		break;
 
+	// SECURITY:
+	//	Okay, only aggregate audio pipeline timing, nothing about users
+	//	Returns JSON, see lat_hist.h
+	case AJAX_LATENCY:
+		return lat_json();		// NB: return here because sb is already a kstr_t (don't want to do kstr_wrap() below)
+		break;
+
 	// SECURITY:
 	//	OKAY, used by sdr.hu, kiwisdr.com and Priyom Pavlova at the moment
 	//	Returns '\n' delimited keyword=value pairs
@@ -53,6 +53,9 @@ Boston, MA  02110-1301, USA.
 #include "rx_waterfall.h"
 #include "shmem.h"
 #include "wdsp.h"
+#include "worker.h"
+#include "simd.h"
+#include "lat_hist.h"
 
 #ifdef DRM
  #include "DRM.h"
@@ -84,6 +87,8 @@ struct gps_timestamp_t {
 
 gps_timestamp_t gps_ts[MAX_RX_CHANS];
 
+static s2_t snd_iq_s2[FASTFIR_OUTBUF_SIZE * NIQ];     // iq_comp input, only used between NextTask()s
+
 snd_t snd_inst[MAX_RX_CHANS];
 
 float g_genfreq, g_genampl, g_mixfreq;
@@ -113,6 +118,8 @@ static str_hashes_t snd_cmd_hashes[] = {
     { "SET unde", CMD_UNDERRUN },
     { "SET seq=", CMD_SEQ },
     { "SET lms_", CMD_LMS_AUTONOTCH },
+    { "SET shar", CMD_SHARED_LISTEN },
+    { "SET iq_c", CMD_IQ_COMP },
     { 0 }
 };
 
@@ -122,11 +129,15 @@ void c2s_sound_init()
 {
     str_hash_init("snd", &snd_cmd_hash, snd_cmd_hashes);
 
+	for (int i = 0; i < MAX_RX_CHANS; i++)
+		m_PassbandFIR[i].CreatePlans();
+
 	//evSnd(EC_DUMP, EV_SND, 10000, "rx task", "overrun");
 	
 	if (do_sdr) {
 		spi_set(CmdSetGen, 0, 0);
 		spi_set(CmdSetGenAttn, 0, 0);
+		worker_init();
 	}
 }
 
@@ -148,6 +159,312 @@ void c2s_sound_setup(void *param)
 	send_msg(conn, SM_SND_DEBUG, "MSG audio_init=%d audio_rate=%d sample_rate=%.6f", conn->isLocal, snd_rate, frate);
 }
 
+// The per-block DSP is split into jobs that can run on a worker thread (see worker.h)
+// while the task sleeps. State that persists between blocks lives in snd_dsp_t.
+typedef struct {
+    int rx_chan, mode;
+    conn_t *conn;
+    rx_dpump_t *rx;
+    int ns_in, ns_out;
+    TYPECPX *i_samps, *f_samps;
+    TYPEMONO16 *r_samps;
+    bool masked, do_de_emp, IQ_or_DRM_or_SAS;
+    int nb_algo, nr_algo;
+    int *nb_enable, *nr_enable;
+    float (*nb_param)[NOISE_PARAMS];
+    int noise_pulse_last;
+    ext_receive_FFT_samps_t receive_FFT;    // sampled once per block, NULL when the FIR runs on a worker
+    ext_FFT_filtering_e filtering;
+    double z1;
+    int sq_nc_open;
+    u4_t agc_us;
+} snd_dsp_t;
+
+//#define NB_STD_POST_FILTER
+
+static void snd_fir(void *param)
+{
+    snd_dsp_t *d = (snd_dsp_t *) param;
+    int rx_chan = d->rx_chan;
+
+    #ifdef NB_STD_POST_FILTER
+    #else
+        if (d->nb_enable[NB_BLANKER] && d->nb_algo == NB_STD)
+            m_NoiseProc[rx_chan][NB_SND].ProcessBlanker(d->ns_in, d->i_samps, d->i_samps);
+    #endif
+
+    d->ns_out = m_PassbandFIR[rx_chan].ProcessData(rx_chan, d->ns_in, d->i_samps, d->f_samps, d->receive_FFT, d->filtering);
+}
+
+// S-meter from CuteSDR
+// FIXME: Why is SND_MAX_VAL less than CUTESDR_MAX_VAL again?
+// And does this explain the need for SMETER_CALIBRATION?
+// Can't remember how this evolved..
+#define SND_MAX_VAL ((float) ((1 << (CUTESDR_SCALE-2)) - 1))
+#define SND_MAX_PWR (SND_MAX_VAL * SND_MAX_VAL)
+#define SND_MIN_PWR (1e-30f * SND_MAX_PWR)          // i.e. 1e-30 after normalization
+#define SND_10LOG10_2 3.01029995663981f
+static const float SND_MAX_PWR_dB = 10.0 * log10(SND_MAX_PWR);
+
+static void snd_demod(void *param)
+{
+    snd_dsp_t *d = (snd_dsp_t *) param;
+    int rx_chan = d->rx_chan, mode = d->mode, ns_out = d->ns_out, j;
+    conn_t *conn = d->conn;
+    rx_dpump_t *rx = d->rx;
+    TYPECPX *f_samps = d->f_samps;
+    TYPEMONO16 *r_samps = d->r_samps;
+    bool masked = d->masked, IQ_or_DRM_or_SAS = d->IQ_or_DRM_or_SAS;
+    int nb_algo = d->nb_algo, nr_algo = d->nr_algo;
+    int *nb_enable = d->nb_enable, *nr_enable = d->nr_enable;
+    float (*nb_param)[NOISE_PARAMS] = d->nb_param;
+    u64_t t0 = timer_us64();
+    d->agc_us = 0;
+
+    switch (mode) {
+    
+    case MODE_AM:
+    case MODE_AMN: {
+        // AM detector from CuteSDR
+        TYPECPX *a_samps = rx->agc_samples;
+        m_Agc[rx_chan].ProcessData(ns_out, f_samps, a_samps, masked);
+        d->agc_us = timer_us64() - t0;
+
+        TYPEREAL *d_samps = rx->demod_samples;
+
+        for (j=0; j<ns_out; j++) {
+            float pwr = a_samps->re*a_samps->re + a_samps->im*a_samps->im;
+            float mag = sqrt(pwr);
+            #define DC_ALPHA 0.99f
+            float z0 = mag + (d->z1 * DC_ALPHA);
+            *d_samps = z0-d->z1;
+            d->z1 = z0;
+            d_samps++;
+            a_samps++;
+        }
+        
+        // clean up residual noise left by detector
+        // the non-FFT FIR has no pipeline delay issues
+        d_samps = rx->demod_samples;
+        m_AM_FIR[rx_chan].ProcessFilter(ns_out, d_samps, r_samps);
+        break;
+    }
+    
+    case MODE_SAM:
+    case MODE_SAL:
+    case MODE_SAU:
+    case MODE_SAS: {
+        TYPECPX *a_samps = rx->agc_samples;
+        m_Agc[rx_chan].ProcessData(ns_out, f_samps, a_samps, masked);
+        d->agc_us = timer_us64() - t0;
+
+        // NB: MODE_SAS stereo output samples put back into a_samps
+        wdsp_SAM_demod(rx_chan, mode, ns_out, a_samps, r_samps);
+        break;
+    }
+    
+    case MODE_NBFM: {
+        TYPEREAL *d_samps = rx->demod_samples;
+        TYPECPX *a_samps = rx->agc_samples;
+        m_Agc[rx_chan].ProcessData(ns_out, f_samps, a_samps, masked);
+        d->agc_us = timer_us64() - t0;
+        int sq_nc_open;
+        
+        // FM demod from CSDR: https://github.com/simonyiszk/csdr
+        // also see: http://www.embedded.com/design/configurable-systems/4212086/DSP-Tricks--Frequency-demodulation-algorithms-
+        #define fmdemod_quadri_K 0.340447550238101026565118445432744920253753662109375
+        float i = a_samps->re, q = a_samps->im;
+        float iL = conn->last_sample.re, qL = conn->last_sample.im;
+        *d_samps = SND_MAX_VAL * fmdemod_quadri_K * (i*(q-qL) - q*(i-iL)) / (i*i + q*q);
+        conn->last_sample = a_samps[ns_out-1];
+        a_samps++; d_samps++;
+        
+        for (j=1; j < ns_out; j++) {
+            i = a_samps->re, q = a_samps->im;
+            iL = a_samps[-1].re, qL = a_samps[-1].im;
+            *d_samps = SND_MAX_VAL * fmdemod_quadri_K * (i*(q-qL) - q*(i-iL)) / (i*i + q*q);
+            a_samps++; d_samps++;
+        }
+        
+        d_samps = rx->demod_samples;
+
+        // use the noise squelch from CuteSDR
+        sq_nc_open = m_FmDemod[rx_chan].PerformNoiseSquelch(ns_out, d_samps, r_samps);
+        
+        d->sq_nc_open = sq_nc_open;     // squelch change message is sent by the task
+        break;
+    }
+    
+    case MODE_IQ:
+    case MODE_DRM:
+        break;
+    
+    case MODE_USB:
+    case MODE_USN:
+    case MODE_LSB:
+    case MODE_LSN:
+    case MODE_CW:
+    case MODE_CWN:
+        m_Agc[rx_chan].ProcessData(ns_out, f_samps, r_samps, masked);
+        d->agc_us = timer_us64() - t0;
+        break;
+
+    default:
+        panic("mode");
+    }
+
+    if (d->do_de_emp) {    // AM and NBFM modes
+        m_de_emp_Biquad[rx_chan].ProcessFilter(ns_out, r_samps, r_samps);
+    }
+    
+    if (nb_enable[NB_CLICK] == NB_POST_FILTER) {
+        u4_t now = timer_sec();
+        if (now != d->noise_pulse_last) {
+            d->noise_pulse_last = now;
+            TYPEMONO16 pulse = nb_param[NB_CLICK][NB_PULSE_GAIN] * (K_AMPMAX - 16);
+            for (int i=0; i < nb_param[NB_CLICK][NB_PULSE_SAMPLES]; i++) {
+                r_samps[i] = pulse;
+            }
+        }
+    }
+
+    // noise & autonotch processors that only operate on real samples (i.e. non-IQ)
+    if (!IQ_or_DRM_or_SAS) {
+        if (nb_enable[NB_BLANKER]) {
+            switch (nb_algo) {
+                #ifdef NB_STD_POST_FILTER
+                    case NB_STD: m_NoiseProc[rx_chan][NB_SND].ProcessBlanker(ns_out, r_samps, r_samps); break;
+                #endif
+                case NB_WILD: nb_Wild_process(rx_chan, ns_out, r_samps, r_samps); break;
+            }
+        }
+        
+        // ordered so denoiser can cleanup residual noise from autonotch
+        switch (nr_algo) {
+            case NR_WDSP:
+                if (nr_enable[NR_AUTONOTCH]) wdsp_ANR_filter(rx_chan, NR_AUTONOTCH, ns_out, r_samps, r_samps);
+                if (nr_enable[NR_DENOISE]) wdsp_ANR_filter(rx_chan, NR_DENOISE, ns_out, r_samps, r_samps);
+                break;
+
+            case NR_ORIG:
+                if (nr_enable[NR_AUTONOTCH]) m_LMS[rx_chan][NR_AUTONOTCH].ProcessFilter(ns_out, r_samps, r_samps);
+                if (nr_enable[NR_DENOISE]) m_LMS[rx_chan][NR_DENOISE].ProcessFilter(ns_out, r_samps, r_samps);
+                break;
+
+            case NR_SPECTRAL:
+                nr_spectral_process(rx_chan, ns_out, r_samps, r_samps);
+                break;
+        }
+    }
+}
+
+// Shared listen
+//
+// Listeners that opt-in ("SET shared_listen=1") and have tuned exactly like another opted-in
+// channel (same snd_tune_t) become followers: their data pump channel is turned off, their
+// DSP is skipped and the leader queues every packet to them as well. The packet payload is
+// refcounted (nbuf_ref_alloc) so it isn't copied per listener.
+// Channels with an extension attached always run their own DSP.
+
+// EDF deadline: the time the data pump will have filled our ring and overwrites the oldest unread buffer.
+// Unlike the fixed SND_PRIORITY this lets a channel with a nearly full ring run ahead of one that
+// has just caught up. The deadline stays valid while we sleep since the ring fills at a constant rate.
+static void snd_edf_update(int rx_chan, snd_t *snd, rx_dpump_t *rx)
+{
+    u64_t now_us = timer_us64();
+    if (snd->edf_deadline && now_us > snd->edf_deadline)
+        dpump.edf_miss[rx_chan]++;
+
+    u4_t fill = spsc_ring_count(&rx->in_ring);
+    u4_t buf_us = (u4_t) ((float) nrx_samps * 1e6 / snd_rate);
+    snd->edf_deadline = now_us + (N_DPBUF - 1 - fill) * buf_us;
+    TaskDeadlineEDF(snd->edf_deadline);
+}
+
+static void snd_shared_reset(snd_t *snd)
+{
+    snd->shared_listen = snd->tune_valid = false;
+    snd->shared_leader = -1;
+    snd->shared_followers = 0;
+}
+
+static bool snd_ext_active(int rx_chan)
+{
+    ext_users_t *eu = &ext_users[rx_chan];
+    return (eu->receive_iq != NULL || eu->receive_iq_tid != (tid_t) NULL || eu->receive_real != NULL ||
+        eu->receive_real_tid != (tid_t) NULL || eu->receive_FFT != NULL || eu->receive_S_meter != NULL);
+}
+
+static conn_t *snd_shared_conn(int rx_chan)
+{
+    rx_chan_t *rxc = &rx_channels[rx_chan];
+    conn_t *c = rxc->conn;
+    if (!rxc->busy) return NULL;
+    if (c == NULL || !c->valid || c->type != STREAM_SOUND || c->rx_channel != rx_chan || c->stop_data || c->internal_connection)
+        return NULL;
+    return c;
+}
+
+static int snd_shared_leader(int rx_chan)
+{
+    snd_t *snd = &snd_inst[rx_chan];
+    
+    for (int ch = 0; ch < rx_chans; ch++) {
+        snd_t *l = &snd_inst[ch];
+        if (ch == rx_chan || !l->shared_listen || !l->tune_valid || l->shared_leader != -1) continue;
+        if (memcmp(&l->tune, &snd->tune, sizeof(snd_tune_t)) != 0) continue;
+        conn_t *c = snd_shared_conn(ch);
+        if (c == NULL || !c->snd_cmd_recv_ok || snd_ext_active(ch)) continue;
+        return ch;
+    }
+    
+    return -1;
+}
+
+static u4_t snd_shared_followers(int rx_chan)
+{
+    snd_t *snd = &snd_inst[rx_chan];
+    u4_t followers = 0;
+    if (snd_ext_active(rx_chan)) return 0;
+    
+    for (int ch = 0; ch < rx_chans; ch++) {
+        snd_t *f = &snd_inst[ch];
+        if (ch == rx_chan || f->shared_leader != rx_chan) continue;
+        
+        // follower may have retuned but not yet noticed
+        if (memcmp(&f->tune, &snd->tune, sizeof(snd_tune_t)) != 0) continue;
+        if (snd_shared_conn(ch) == NULL) continue;
+        followers |= 1 << ch;
+    }
+    
+    return followers;
+}
+
+static void snd_shared_send(conn_t *conn, int rx_chan, char *pkt, int bytes, int aud_bytes)
+{
+    snd_t *snd = &snd_inst[rx_chan];
+    char *buf = nbuf_ref_alloc(pkt, bytes);
+    app_to_web_ref(conn, buf, bytes);
+    
+    for (int ch = 0; ch < rx_chans; ch++) {
+        if (!(snd->shared_followers & (1 << ch))) continue;
+        
+        // follower may have disconnected or retuned while this task slept since the mask was computed
+        snd_t *f = &snd_inst[ch];
+        conn_t *c = snd_shared_conn(ch);
+        if (c == NULL || f->shared_leader != rx_chan || memcmp(&f->tune, &snd->tune, sizeof(snd_tune_t)) != 0) {
+            snd->shared_followers &= ~(1 << ch);
+            continue;
+        }
+        app_to_web_ref(c, buf, bytes);
+        WF_SHMEM->wf_inst[ch].snd_seq = snd->seq;   // follower's waterfall syncs to the leader's sequence
+        audio_bytes[ch] += aud_bytes;
+        audio_bytes[rx_chans] += aud_bytes;
+    }
+    
+    nbuf_ref_release(buf);
+}
+
 void c2s_sound(void *param)
 {
 	conn_t *conn = (conn_t *) param;
@@ -165,20 +482,22 @@ void c2s_sound(void *param)
 	
 	double freq=-1, _freq, gen=-1, _gen, locut=0, _locut, hicut=0, _hicut, mix;
 	int mode=-1, _mode, genattn=0, _genattn, mute, test=0, de_emp=0;
-	double z1 = 0;
+	int squelch=0, squelch_max=0;
 
 	double frate = ext_update_get_sample_rateHz(rx_chan);      // FIXME: do this in loop to get incremental changes
 	//printf("### frate %f snd_rate %d\n", frate, snd_rate);
 	#define ATTACK_TIMECONST .01	// attack time in seconds
 	float sMeterAlpha = 1.0 - expf(-1.0/((float) frate * ATTACK_TIMECONST));
 	float sMeterAvg_dB = 0;
-	int compression = 1;
+	int compression = 1, iq_comp = IQ_COMP_NONE;
 	bool little_endian = false;
 	
     strncpy(snd->out_pkt_real.h.id, "SND", 3);
     strncpy(snd->out_pkt_iq.h.id,   "SND", 3);
 		
 	snd->seq = 0;
+	snd_shared_reset(snd);
+	snd->edf_deadline = 0;
 	
     #ifdef SND_SEQ_CHECK
         snd->snd_seq_ck_init = false;
@@ -211,11 +530,19 @@ void c2s_sound(void *param)
 	
 	memset(&rx->adpcm_snd, 0, sizeof(ima_adpcm_state_t));
 	
-	int noise_pulse_last = 0;
 	int nb_algo = NB_OFF, nr_algo = NR_OFF_;
     int nb_enable[NOISE_TYPES] = {0}, nr_enable[NOISE_TYPES] = {0};
 	float nb_param[NOISE_TYPES][NOISE_PARAMS], nr_param[NOISE_TYPES][NOISE_PARAMS];
 
+	snd_dsp_t dsp;
+	memset(&dsp, 0, sizeof(dsp));
+	dsp.rx_chan = rx_chan;
+	dsp.conn = conn;
+	dsp.rx = rx;
+	dsp.nb_enable = nb_enable;
+	dsp.nr_enable = nr_enable;
+	dsp.nb_param = nb_param;
+
 	gps_timestamp_t *gps_tsp = &gps_ts[rx_chan];
 	memset(gps_tsp, 0, sizeof(gps_timestamp_t));
 
@@ -520,7 +847,6 @@ void c2s_sound(void *param)
                 break;
 
             case CMD_SQUELCH: {
-                int squelch, squelch_max;
                 n = sscanf(cmd, "SET squelch=%d max=%d", &squelch, &squelch_max);
                 if (n == 2) {
                     did_cmd = true;
@@ -699,6 +1025,26 @@ void c2s_sound(void *param)
                     did_cmd = true;
                 break;
 
+            case CMD_IQ_COMP: {
+                int _iq_comp;
+                n = sscanf(cmd, "SET iq_comp=%d", &_iq_comp);
+                if (n == 1 && (_iq_comp == IQ_COMP_NONE || _iq_comp == IQ_COMP_RICE)) {
+                    did_cmd = true;
+                    iq_comp = _iq_comp;
+                }
+                break;
+            }
+
+            case CMD_SHARED_LISTEN: {
+                int shared;
+                n = sscanf(cmd, "SET shared_listen=%d", &shared);
+                if (n == 1) {
+                    did_cmd = true;
+                    snd->shared_listen = shared? true:false;
+                }
+                break;
+            }
+
             default:
                 // have to check for old API below
                 did_cmd = false;
@@ -745,6 +1091,7 @@ void c2s_sound(void *param)
 		
 		if (conn->stop_data) {
 			//clprintf(conn, "SND stop_data rx_server_remove()\n");
+			snd_shared_reset(snd);
 			rx_enable(rx_chan, RX_CHAN_FREE);
 			rx_server_remove(conn);
 			panic("shouldn't return");
@@ -777,6 +1124,7 @@ void c2s_sound(void *param)
 			}
 			
 			//clprintf(conn, "SND rx_server_remove()\n");
+			snd_shared_reset(snd);
 			rx_server_remove(conn);
 			panic("shouldn't return");
 		}
@@ -803,6 +1151,50 @@ void c2s_sound(void *param)
 			conn->snd_cmd_recv_ok = true;
 		}
 		
+		snd_tune_t tune;
+		memset(&tune, 0, sizeof(tune));
+		tune.freq = freq; tune.locut = locut; tune.hicut = hicut;
+		tune.mode = mode; tune.compression = compression; tune.iq_comp = iq_comp; tune.little_endian = little_endian;
+		tune.de_emp = de_emp; tune.test = test;
+		tune.agc = agc; tune.hang = hang; tune.thresh = thresh; tune.manGain = manGain;
+		tune.slope = slope; tune.decay = decay;
+		tune.squelch = squelch; tune.squelch_max = squelch_max;
+		tune.nb_algo = nb_algo; tune.nr_algo = nr_algo;
+		memcpy(tune.nb_enable, nb_enable, sizeof(nb_enable));
+		memcpy(tune.nr_enable, nr_enable, sizeof(nr_enable));
+		memcpy(tune.nb_param, nb_param, sizeof(nb_param));
+		memcpy(tune.nr_param, nr_param, sizeof(nr_param));
+		memcpy(&snd->tune, &tune, sizeof(tune));
+		snd->tune_valid = true;
+		
+		// shared listen: follow a channel that is already producing the identical stream
+		int leader = -1;
+		if (snd->shared_listen && snd->shared_followers == 0 && mode != MODE_DRM && !conn->internal_connection &&
+		    !snd_ext_active(rx_chan))
+		    leader = snd_shared_leader(rx_chan);
+		
+		if (leader != snd->shared_leader) {
+		    if (leader == -1) {
+		        // back to running our own DSP: discard stale samples and restart the client's decoder
+		        spsc_ring_rd_flush(&rx->in_ring);
+		        rx_enable(rx_chan, RX_DATA_ENABLE);
+		        memset(&rx->adpcm_snd, 0, sizeof(ima_adpcm_state_t));
+		        restart = true;
+		    } else {
+		        rx_enable(rx_chan, RX_DATA_DISABLE);
+		    }
+		    //cprintf(conn, "SND shared listen: following rx%d\n", leader);
+		    snd->shared_leader = leader;
+		}
+		
+		if (snd->shared_leader != -1) {
+		    // packets are sent by the leader's task
+		    snd->edf_deadline = 0;
+		    TaskDeadlineEDF(0);
+		    TaskSleepReasonMsec("shared listen", 100);
+		    continue;
+		}
+		
 		#define	SND_FLAG_LPF		    0x01
 		#define	SND_FLAG_ADC_OVFL	    0x02
 		#define	SND_FLAG_NEW_FREQ	    0x04
@@ -840,9 +1232,19 @@ void c2s_sound(void *param)
 		int ns_out;
 		int fir_pos;
 		TYPECPX *f_samps;
+		
+		// a new follower's client decoder starts from zero state: reset our ADPCM encoder to match
+		u4_t followers = snd->shared_listen? snd_shared_followers(rx_chan) : 0;
+		if ((followers & ~snd->shared_followers) && compression && !IQ_or_DRM_or_SAS) {
+		    memset(&rx->adpcm_snd, 0, sizeof(ima_adpcm_state_t));
+		    restart = true;
+		}
+		snd->shared_followers = followers;
 
+        u4_t enc_us = 0;
         do {
-			while (rx->wr_pos == rx->rd_pos) {
+		    rx_dpump_in_t *in;
+			while ((in = (rx_dpump_in_t *) spsc_ring_rd_ptr(&rx->in_ring)) == NULL) {
 				evSnd(EC_EVENT, EV_SND, -1, "rx_snd", "sleeping");
 
                 //#define MEAS_SND_LOOP
@@ -872,10 +1274,11 @@ void c2s_sound(void *param)
 			
         	TaskStat2(TSTAT_INCR|TSTAT_ZERO, 0, "aud");
 
-			TYPECPX *i_samps = rx->in_samps[rx->rd_pos];
+			TYPECPX *i_samps = in->samps;
+			lat_rx(rx_chan, LAT_QDEPTH, spsc_ring_count(&rx->in_ring));
 
 			// check 48-bit ticks counter timestamp in audio IQ stream
-			const u64_t ticks   = rx->ticks[rx->rd_pos];
+			const u64_t ticks   = in->ticks;
 			const u64_t dt      = time_diff48(ticks, clk.ticks);  // time difference to last GPS solution
 #if 0
 			static u64_t last_ticks[MAX_RX_CHANS] = {0};
@@ -898,18 +1301,17 @@ void c2s_sound(void *param)
 			gps_tsp->gpssec = fmod(gps_week_sec + clk.gps_secs + dt/clk.adc_clock_base - gps_delay + gps_delay2, gps_week_sec);
 
 		    #ifdef SND_SEQ_CHECK
-		        if (rx->in_seq[rx->rd_pos] != snd->snd_seq_ck) {
+		        if (in->seq != snd->snd_seq_ck) {
 		            if (!snd->snd_seq_ck_init) {
 		                snd->snd_seq_ck_init = true;
 		            } else {
-		                real_printf("rx%d: got %d expecting %d\n", rx_chan, rx->in_seq[rx->rd_pos], snd->snd_seq_ck);
+		                real_printf("rx%d: got %d expecting %d\n", rx_chan, in->seq, snd->snd_seq_ck);
 		            }
-		            snd->snd_seq_ck = rx->in_seq[rx->rd_pos];
+		            snd->snd_seq_ck = in->seq;
 		        }
 		        snd->snd_seq_ck++;
 		    #endif
 		    
-			rx->rd_pos = (rx->rd_pos+1) & (N_DPBUF-1);
 			
 			f_samps = &iq->iq_samples[iq->iq_wr_pos][0];
 			const int ns_in = nrx_samps;
@@ -922,8 +1324,8 @@ void c2s_sound(void *param)
 			
             if (nb_enable[NB_CLICK] == NB_PRE_FILTER) {
                 u4_t now = timer_sec();
-                if (now != noise_pulse_last) {
-                    noise_pulse_last = now;
+                if (now != dsp.noise_pulse_last) {
+                    dsp.noise_pulse_last = now;
                     TYPEREAL pulse = nb_param[NB_CLICK][NB_PULSE_GAIN] * (K_AMPMAX - 16);
                     for (int i=0; i < nb_param[NB_CLICK][NB_PULSE_SAMPLES]; i++) {
                         i_samps[i].re = pulse;
@@ -932,15 +1334,27 @@ void c2s_sound(void *param)
                 }
             }
 
-            //#define NB_STD_POST_FILTER
-            #ifdef NB_STD_POST_FILTER
-            #else
-                if (nb_enable[NB_BLANKER] && nb_algo == NB_STD)
-		            m_NoiseProc[rx_chan][NB_SND].ProcessBlanker(ns_in, i_samps, i_samps);
-		    #endif
-
-			ns_out  = m_PassbandFIR[rx_chan].ProcessData(rx_chan, ns_in, i_samps, f_samps);
+            dsp.ns_in = ns_in;
+            dsp.i_samps = i_samps;
+            dsp.f_samps = f_samps;
+            dsp.nb_algo = nb_algo;
+
+            // an extension FFT callback is called from inside the FIR so it must run on the task
+            // (sampled here so an extension registering while a worker job is queued isn't called from it)
+            dsp.receive_FFT = ext_users[rx_chan].receive_FFT;
+            dsp.filtering = ext_users[rx_chan].filtering;
+            u64_t t_fir = timer_us64();
+            if (dsp.receive_FFT == NULL)
+                worker_run("snd FIR", snd_fir, &dsp);
+            else
+                snd_fir(&dsp);
+            lat_rx(rx_chan, LAT_FIR, timer_us64() - t_fir);
+			ns_out  = dsp.ns_out;
 			fir_pos = m_PassbandFIR[rx_chan].FirPos();
+			
+			// i_samps no longer needed: the data pump can reuse the buffer
+			spsc_ring_rd_commit(&rx->in_ring);
+			snd_edf_update(rx_chan, snd, rx);
             // [this diagram was back when the audio buffer was 1/2 its current size and NRX_SAMPS = 84]
             //
 			// FIR has a pipeline delay:
@@ -986,7 +1400,7 @@ void c2s_sound(void *param)
             const double dt_to_pos_sol = gps_tsp->last_gpssec - clk.gps_secs;
             snd->out_pkt_iq.h.last_gps_solution = gps_tsp->init? ((clk.ticks == 0)? 255 : u1_t(std::min(254.0, dt_to_pos_sol))) : 0;
             if (!gps_tsp->init) gps_tsp->init = true;
-            snd->out_pkt_iq.h.dummy = 0;
+            snd->out_pkt_iq.h.comp = IQ_COMP_NONE;
             gps_tsp->last_gpssec = gps_tsp->gpssec;
     
             // Forward IQ samples if requested.
@@ -999,24 +1413,21 @@ void c2s_sound(void *param)
     
             // delay updating iq_wr_pos until after AGC applied below
             
-            TYPECPX *f_sa = f_samps;
-            for (j=0; j<ns_out; j++) {
-    
-                // S-meter from CuteSDR
-                // FIXME: Why is SND_MAX_VAL less than CUTESDR_MAX_VAL again?
-                // And does this explain the need for SMETER_CALIBRATION?
-                // Can't remember how this evolved..
-                #define SND_MAX_VAL ((float) ((1 << (CUTESDR_SCALE-2)) - 1))
-                #define SND_MAX_PWR (SND_MAX_VAL * SND_MAX_VAL)
-                float re = (float) f_sa->re, im = (float) f_sa->im;
-                float pwr = re*re + im*im;
-                float pwr_dB = 10.0 * log10f((pwr / SND_MAX_PWR) + 1e-30);
-                sMeterAvg_dB = (1.0 - sMeterAlpha)*sMeterAvg_dB + sMeterAlpha*pwr_dB;
-                f_sa++;
+            // S-meter from CuteSDR
+            // The per-sample EMA of the dB power is applied as one step per half block using the mean of
+            // the per-sample dB values. Same smoothing constant, but one log per half block instead of per sample.
+            int ns_half = ns_out/2;
+            for (j=0; j < 2; j++) {
+                int ns = j? (ns_out - ns_half) : ns_half;
+                if (ns == 0) continue;
+                TYPECPX *f_sa = f_samps + (j? ns_half : 0);
+                float mean_dB = SND_10LOG10_2 * simd_sum_log2_pwr(ns, (fftwf_complex *) f_sa, SND_MIN_PWR) / ns - SND_MAX_PWR_dB;
+                float decay = powf(1.0f - sMeterAlpha, ns);
+                sMeterAvg_dB = decay*sMeterAvg_dB + (1.0f - decay)*mean_dB;
             
                 // forward S-meter samples if requested
                 // S-meter value in audio packet is sent less often than if we send it from here
-                if (receive_S_meter != NULL && (j == 0 || j == ns_out/2))
+                if (receive_S_meter != NULL)
                     receive_S_meter(rx_chan, sMeterAvg_dB + S_meter_cal);
             }
             
@@ -1028,138 +1439,27 @@ void c2s_sound(void *param)
                 rx->real_seq++;
             }
             
-            switch (mode) {
-            
-            case MODE_AM:
-            case MODE_AMN: {
-                // AM detector from CuteSDR
-                TYPECPX *a_samps = rx->agc_samples;
-                m_Agc[rx_chan].ProcessData(ns_out, f_samps, a_samps, masked);
-    
-                TYPEREAL *d_samps = rx->demod_samples;
-    
-                for (j=0; j<ns_out; j++) {
-                    float pwr = a_samps->re*a_samps->re + a_samps->im*a_samps->im;
-                    float mag = sqrt(pwr);
-                    #define DC_ALPHA 0.99f
-                    float z0 = mag + (z1 * DC_ALPHA);
-                    *d_samps = z0-z1;
-                    z1 = z0;
-                    d_samps++;
-                    a_samps++;
-                }
-                
-                // clean up residual noise left by detector
-                // the non-FFT FIR has no pipeline delay issues
-                d_samps = rx->demod_samples;
-                m_AM_FIR[rx_chan].ProcessFilter(ns_out, d_samps, r_samps);
-                break;
+            dsp.mode = mode;
+            dsp.ns_out = ns_out;
+            dsp.f_samps = f_samps;
+            dsp.r_samps = r_samps;
+            dsp.masked = masked;
+            dsp.do_de_emp = do_de_emp;
+            dsp.IQ_or_DRM_or_SAS = IQ_or_DRM_or_SAS;
+            dsp.nb_algo = nb_algo;
+            dsp.nr_algo = nr_algo;
+            dsp.sq_nc_open = 0;
+            u64_t t_demod = timer_us64();
+            worker_run("snd demod", snd_demod, &dsp);
+            u64_t t_enc = timer_us64();
+            if (mode != MODE_IQ && mode != MODE_DRM) {
+                u4_t demod_us = t_enc - t_demod;
+                lat_rx(rx_chan, LAT_AGC, dsp.agc_us);
+                lat_rx(rx_chan, LAT_DEMOD, (demod_us > dsp.agc_us)? (demod_us - dsp.agc_us) : 0);
             }
-            
-            case MODE_SAM:
-            case MODE_SAL:
-            case MODE_SAU:
-            case MODE_SAS: {
-                TYPECPX *a_samps = rx->agc_samples;
-                m_Agc[rx_chan].ProcessData(ns_out, f_samps, a_samps, masked);
 
-                // NB: MODE_SAS stereo output samples put back into a_samps
-                wdsp_SAM_demod(rx_chan, mode, ns_out, a_samps, r_samps);
-                break;
-            }
-            
-            case MODE_NBFM: {
-                TYPEREAL *d_samps = rx->demod_samples;
-                TYPECPX *a_samps = rx->agc_samples;
-                m_Agc[rx_chan].ProcessData(ns_out, f_samps, a_samps, masked);
-                int sq_nc_open;
-                
-                // FM demod from CSDR: https://github.com/simonyiszk/csdr
-                // also see: http://www.embedded.com/design/configurable-systems/4212086/DSP-Tricks--Frequency-demodulation-algorithms-
-                #define fmdemod_quadri_K 0.340447550238101026565118445432744920253753662109375
-                float i = a_samps->re, q = a_samps->im;
-                float iL = conn->last_sample.re, qL = conn->last_sample.im;
-                *d_samps = SND_MAX_VAL * fmdemod_quadri_K * (i*(q-qL) - q*(i-iL)) / (i*i + q*q);
-                conn->last_sample = a_samps[ns_out-1];
-                a_samps++; d_samps++;
-                
-                for (j=1; j < ns_out; j++) {
-                    i = a_samps->re, q = a_samps->im;
-                    iL = a_samps[-1].re, qL = a_samps[-1].im;
-                    *d_samps = SND_MAX_VAL * fmdemod_quadri_K * (i*(q-qL) - q*(i-iL)) / (i*i + q*q);
-                    a_samps++; d_samps++;
-                }
-                
-                d_samps = rx->demod_samples;
-    
-                // use the noise squelch from CuteSDR
-                sq_nc_open = m_FmDemod[rx_chan].PerformNoiseSquelch(ns_out, d_samps, r_samps);
-                
-                if (sq_nc_open != 0) {
-                    send_msg(conn, SM_NO_DEBUG, "MSG squelch=%d", (sq_nc_open == 1)? 1:0);
-                }
-                break;
-            }
-            
-            case MODE_IQ:
-            case MODE_DRM:
-                break;
-            
-            case MODE_USB:
-            case MODE_USN:
-            case MODE_LSB:
-            case MODE_LSN:
-            case MODE_CW:
-            case MODE_CWN:
-                m_Agc[rx_chan].ProcessData(ns_out, f_samps, r_samps, masked);
-                break;
-    
-            default:
-                panic("mode");
-            }
-    
-            if (do_de_emp) {    // AM and NBFM modes
-                m_de_emp_Biquad[rx_chan].ProcessFilter(ns_out, r_samps, r_samps);
-            }
-            
-            if (nb_enable[NB_CLICK] == NB_POST_FILTER) {
-                u4_t now = timer_sec();
-                if (now != noise_pulse_last) {
-                    noise_pulse_last = now;
-                    TYPEMONO16 pulse = nb_param[NB_CLICK][NB_PULSE_GAIN] * (K_AMPMAX - 16);
-                    for (int i=0; i < nb_param[NB_CLICK][NB_PULSE_SAMPLES]; i++) {
-                        r_samps[i] = pulse;
-                    }
-                }
-            }
-
-            // noise & autonotch processors that only operate on real samples (i.e. non-IQ)
-            if (!IQ_or_DRM_or_SAS) {
-                if (nb_enable[NB_BLANKER]) {
-                    switch (nb_algo) {
-                        #ifdef NB_STD_POST_FILTER
-                            case NB_STD: m_NoiseProc[rx_chan][NB_SND].ProcessBlanker(ns_out, r_samps, r_samps); break;
-                        #endif
-                        case NB_WILD: nb_Wild_process(rx_chan, ns_out, r_samps, r_samps); break;
-                    }
-                }
-                
-                // ordered so denoiser can cleanup residual noise from autonotch
-                switch (nr_algo) {
-                    case NR_WDSP:
-                        if (nr_enable[NR_AUTONOTCH]) wdsp_ANR_filter(rx_chan, NR_AUTONOTCH, ns_out, r_samps, r_samps);
-                        if (nr_enable[NR_DENOISE]) wdsp_ANR_filter(rx_chan, NR_DENOISE, ns_out, r_samps, r_samps);
-                        break;
-
-                    case NR_ORIG:
-                        if (nr_enable[NR_AUTONOTCH]) m_LMS[rx_chan][NR_AUTONOTCH].ProcessFilter(ns_out, r_samps, r_samps);
-                        if (nr_enable[NR_DENOISE]) m_LMS[rx_chan][NR_DENOISE].ProcessFilter(ns_out, r_samps, r_samps);
-                        break;
-
-                    case NR_SPECTRAL:
-                        nr_spectral_process(rx_chan, ns_out, r_samps, r_samps);
-                        break;
-                }
+            if (dsp.sq_nc_open != 0) {
+                send_msg(conn, SM_NO_DEBUG, "MSG squelch=%d", (dsp.sq_nc_open == 1)? 1:0);
             }
             
             ////////////////////////////////
@@ -1172,7 +1472,11 @@ void c2s_sound(void *param)
                 || (mode == MODE_DRM && (drm->monitor || rx_chan >= DRM_MAX_RX))
             #endif
             ){
+                u64_t t_agc = timer_us64();
                 m_Agc[rx_chan].ProcessData(ns_out, f_samps, f_samps, masked);
+                u4_t agc_us = timer_us64() - t_agc;
+                lat_rx(rx_chan, LAT_AGC, agc_us);
+                t_enc += agc_us;
                 iq->iq_wr_pos = (iq->iq_wr_pos+1) & (N_DPBUF-1);    // after AGC above
 
                 #if 0
@@ -1231,7 +1535,7 @@ void c2s_sound(void *param)
     
             if (mode != MODE_DRM) {
                 iq->iq_wr_pos = (iq->iq_wr_pos+1) & (N_DPBUF-1);
-                rx->real_wr_pos = (rx->real_wr_pos+1) & (N_DPBUF-1);
+                __atomic_store_n(&rx->real_wr_pos, (rx->real_wr_pos+1) & (N_DPBUF-1), __ATOMIC_RELEASE);
     
                 // forward real samples if requested
                 if (receive_real != NULL)
@@ -1268,7 +1572,11 @@ void c2s_sound(void *param)
                 
                 else
                 if (mode == MODE_DRM) {
+                    u64_t t_agc = timer_us64();
                     m_Agc[rx_chan].ProcessData(ns_out, f_samps, f_samps, masked);
+                    u4_t agc_us = timer_us64() - t_agc;
+                    lat_rx(rx_chan, LAT_AGC, agc_us);
+                    t_enc += agc_us;
                     iq->iq_wr_pos = (iq->iq_wr_pos+1) & (N_DPBUF-1);    // after AGC above
 
                     drm_buf_t *drm_buf = &DRM_SHMEM->drm_buf[rx_chan];
@@ -1335,10 +1643,12 @@ void c2s_sound(void *param)
                     }
                 }
             #endif
-
+            
+            enc_us += timer_us64() - t_enc;
         } while (bc < 1024);    // multiple loops when compressing
 
         NextTask("s2c begin");
+        u64_t t_pkt = timer_us64();
                 
         // send s-meter data with each audio packet
         #define SMETER_BIAS 127.0
@@ -1379,7 +1689,8 @@ void c2s_sound(void *param)
         //{ real_printf("q%d ", snd->seq); fflush(stdout); }
 
         //printf("hdr %d S%d\n", sizeof(out_pkt.h), bc); fflush(stdout);
-        int aud_bytes;
+        int bytes, aud_bytes;
+        char *pkt;
         if (IQ_or_DRM_or_SAS) {
             // allow GPS timestamps to be seen by internal extensions
             // but selectively remove from external connections (see admin page security tab)
@@ -1388,14 +1699,38 @@ void c2s_sound(void *param)
                 snd->out_pkt_iq.h.gpssec = 0;
                 snd->out_pkt_iq.h.gpsnsec = 0;
             }
-            const int bytes = sizeof(snd->out_pkt_iq.h) + bc;
-            app_to_web(conn, (char*) &snd->out_pkt_iq, bytes);
+            pkt = (char*) &snd->out_pkt_iq;
+            bytes = sizeof(snd->out_pkt_iq.h) + bc;
+            
+            if (iq_comp != IQ_COMP_NONE) {
+                // samples are read back from the packet so IQ, SAS and DRM output are all covered
+                int nsamps = bc / (NIQ * sizeof(s2_t));
+                if (little_endian) {
+                    memcpy(snd_iq_s2, snd->out_pkt_iq.s2, bc);
+                } else {
+                    u1_t *bp = snd->out_pkt_iq.u1;
+                    for (j=0; j < nsamps * NIQ; j++, bp += 2)
+                        snd_iq_s2[j] = (s2_t) ((bp[0] << 8) | bp[1]);
+                }
+                snd->out_pkt_iq.h.comp = iq_comp;
+                memcpy(snd->out_pkt_iqc.h, &snd->out_pkt_iq.h, sizeof(snd->out_pkt_iq.h));
+                bc = iq_rice_encode(snd_iq_s2, nsamps, snd->out_pkt_iqc.u1);
+                pkt = (char*) &snd->out_pkt_iqc;
+                bytes = sizeof(snd->out_pkt_iqc.h) + bc;
+            }
             aud_bytes = sizeof(snd->out_pkt_iq.h.smeter) + bc;
         } else {
-            const int bytes = sizeof(snd->out_pkt_real.h) + bc;
-            app_to_web(conn, (char*) &snd->out_pkt_real, bytes);
+            pkt = (char*) &snd->out_pkt_real;
+            bytes = sizeof(snd->out_pkt_real.h) + bc;
             aud_bytes = sizeof(snd->out_pkt_real.h.smeter) + bc;
         }
+        
+        lat_rx(rx_chan, LAT_ENCODE, enc_us + (u4_t) (timer_us64() - t_pkt));
+        
+        if (snd->shared_followers)
+            snd_shared_send(conn, rx_chan, pkt, bytes, aud_bytes);
+        else
+            app_to_web(conn, pkt, bytes);
         audio_bytes[rx_chan] += aud_bytes;
         audio_bytes[rx_chans] += aud_bytes;     // [rx_chans] is the sum of all audio channels
 
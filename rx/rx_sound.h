@@ -22,6 +22,8 @@ Boston, MA  02110-1301, USA.
 #include "types.h"
 #include "kiwi.h"
 #include "cuteSDR.h"
+#include "rx_noise.h"
+#include "iq_rice.h"
 
 typedef struct {
 	struct {
@@ -43,7 +45,7 @@ typedef struct {
 		u1_t seq[4];            // waterfall syncs to this sequence number on the client-side
 		char smeter[2];
 		u1_t last_gps_solution; // time difference to last gps solution in seconds
-		u1_t dummy;
+		u1_t comp;              // IQ_COMP_* payload compression (only if client sent "SET iq_comp=")
 		u4_t gpssec;            // GPS time stamp (GPS seconds)
 		u4_t gpsnsec;           // GPS time stamp (fractional seconds in units of ns)
 	} __attribute__((packed)) h;
@@ -53,13 +55,40 @@ typedef struct {
 	};
 } __attribute__((packed)) snd_pkt_iq_t;
 
+// snd_pkt_iq_t with h.comp != IQ_COMP_NONE
+typedef struct {
+	u1_t h[sizeof(((snd_pkt_iq_t *) 0)->h)];
+	u1_t u1[IQ_RICE_MAX_BYTES(FASTFIR_OUTBUF_SIZE)];
+} __attribute__((packed)) snd_pkt_iqc_t;
+
+// everything that determines the contents of the audio stream sent to the client
+typedef struct {
+    double freq, locut, hicut;
+    int mode, compression, iq_comp, little_endian, de_emp, test;
+    int agc, hang, thresh, manGain, slope, decay;
+    int squelch, squelch_max;
+    int nb_algo, nr_algo;
+    int nb_enable[NOISE_TYPES], nr_enable[NOISE_TYPES];
+    float nb_param[NOISE_TYPES][NOISE_PARAMS], nr_param[NOISE_TYPES][NOISE_PARAMS];
+} snd_tune_t;
+
 typedef struct {
     snd_pkt_real_t out_pkt_real;
     snd_pkt_iq_t   out_pkt_iq;
+    snd_pkt_iqc_t  out_pkt_iqc;
 
     u4_t firewall[32];
 	u4_t seq;
 	float locut, hicut, norm_locut, norm_hicut;
+
+	// Shared listen (opt-in): a channel tuned identically to another one stops its own DSP
+	// and is sent the other channel's (leader's) packets instead.
+	bool shared_listen, tune_valid;
+	snd_tune_t tune;
+	int shared_leader;          // rx_chan being followed, -1 if running own DSP
+	u4_t shared_followers;      // bitmap of rx_chans following this one
+	
+	u64_t edf_deadline;         // when the data pump will overwrite our oldest unread rx_dpump_t buffer
 	
     #ifdef SND_SEQ_CHECK
         bool snd_seq_ck_init;
@@ -74,5 +103,5 @@ enum snd_cmd_key_e {
     CMD_AUDIO_START=1, CMD_TUNE, CMD_COMPRESSION, CMD_REINIT, CMD_LITTLE_ENDIAN,
     CMD_GEN_FREQ, CMD_GEN_ATTN, CMD_SET_AGC, CMD_SQUELCH, CMD_NB_ALGO, CMD_NR_ALGO, CMD_NB_TYPE,
     CMD_NR_TYPE, CMD_MUTE, CMD_DE_EMP, CMD_TEST, CMD_UAR, CMD_AR_OKAY, CMD_UNDERRUN, CMD_SEQ,
-    CMD_LMS_AUTONOTCH
+    CMD_LMS_AUTONOTCH, CMD_SHARED_LISTEN, CMD_IQ_COMP
 };
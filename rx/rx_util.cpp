@@ -222,6 +222,7 @@ void update_vars_from_config()
     cfg_default_int("tdoa_nchans", -1, &update_cfg);
     cfg_default_int("ext_api_nchans", -1, &update_cfg);
     cfg_default_bool("no_wf", false, &update_cfg);
+    cfg_default_bool("virt_wf", false, &update_cfg);
     cfg_default_bool("test_webserver_prio", false, &update_cfg);
     cfg_default_bool("test_deadline_update", false, &update_cfg);
     cfg_default_bool("disable_recent_changes", false, &update_cfg);
@@ -555,6 +556,22 @@ void webserver_collect_print_stats(int print)
 	}
 	current_nusers = nusers;
 
+	// per-connection send queue depth since the last report
+	if (print) {
+		for (c = conns; c < &conns[N_CONNS]; c++) {
+			if (!c->valid || c->internal_connection || !c->s2c.depth_hiwat) continue;
+			cprintf(c, "NBUF s2c %s depth hiwat %d/%d, %d dropped\n",
+				rx_streams[c->type].uri, c->s2c.depth_hiwat, ND_HIWAT, c->s2c.drops);
+			c->s2c.depth_hiwat = 0;
+		}
+
+		if (mg_tx_stats.calls)
+			lprintf("WEB tx %d syscalls/s, %d frames/syscall, %d bytes/syscall\n",
+				mg_tx_stats.calls / STATS_INTERVAL_SECS, mg_tx_stats.frames / mg_tx_stats.calls,
+				mg_tx_stats.bytes / mg_tx_stats.calls);
+	}
+	memset(&mg_tx_stats, 0, sizeof(mg_tx_stats));
+
 	// construct cpu stats response
 	#define NCPU 4
 	int usi[3][NCPU], del_usi[3][NCPU];
@@ -35,12 +35,14 @@ Boston, MA  02110-1301, USA.
 #include "ext_int.h"
 #include "rx_noise.h"
 #include "rx_waterfall.h"
+#include "simd.h"
 #include "noiseproc.h"
 #include "dx.h"
 #include "non_block.h"
 #include "shmem.h"
 #include "noise_blank.h"
 #include "str.h"
+#include "fftw_wisdom.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -50,6 +52,7 @@ Boston, MA  02110-1301, USA.
 #include <sched.h>
 #include <math.h>
 #include <fftw3.h>
+#include <sys/mman.h>
 
 //#define WF_INFO
 //#define TR_WF_CMDS
@@ -66,6 +69,20 @@ Boston, MA  02110-1301, USA.
 #define WF_NSPEEDS 5
 static const int wf_fps[] = { WF_SPEED_OFF, WF_SPEED_1FPS, WF_SPEED_SLOW, WF_SPEED_MED, WF_SPEED_FAST };
 
+// Backpressure from the client's s2c queue (which also carries the audio) slows the waterfall down
+// instead of computing frames nbuf_enqueue() would only drop.
+#define WF_BP_MAX_LEVEL     4                   // down to 1/16 of the requested frame rate
+#define WF_BP_HI            (ND_HIWAT/2)        // slow down one level per frame while above this depth
+#define WF_BP_LO            (ND_LOWAT/4)        // speed up one level per WF_BP_HOLD_MS while below
+#define WF_BP_SKIP          (ND_HIWAT - ND_HIWAT/8) // don't compute a frame at all above this
+#define WF_BP_HOLD_MS       2000
+
+// frame period after any backpressure slowdown
+static int wf_frame_ms(wf_inst_t *wf)
+{
+    return (1000 / wf_fps[wf->speed]) << wf->bp_level;
+}
+
 #ifdef WF_SHMEM_DISABLE
     static wf_shmem_t wf_shmem;
     wf_shmem_t *wf_shmem_p = &wf_shmem;
@@ -78,6 +95,9 @@ static const int wf_fps[] = { WF_SPEED_OFF, WF_SPEED_1FPS, WF_SPEED_SLOW, WF_SPE
     #define WFSleepReasonMsec(r, t) TaskSleepReasonMsec(r, t)
     #define WFSleepReasonUsec(r, t) TaskSleepReasonUsec(r, t)
     #define WFNextTask(r) NextTask(r)
+
+    // a pipelined reply is collected by whatever SPI transfer comes next in this process
+    #define WF_SPI_PIPELINED
 #else
     // WF_IPC_SAMPLE_WF
     #define WFSleepReasonMsec(r, t) kiwi_msleep(t)
@@ -105,11 +125,18 @@ static str_hashes_t wf_cmd_hashes[] = {
     { "SET wf_sp", CMD_SET_WF_SPEED },
     { "SET send_", CMD_SEND_DB },
     { "SET ext_b", CMD_EXT_BLUR },
+    { "SET wf_hi", CMD_WF_HISTORY },
+    { "SET wf_av", CMD_WF_AVG },
     { 0 }
 };
 
 static str_hash_t wf_cmd_hash;
 
+wf_cache_stats_t wf_cache_stats;
+
+static wf_hist_t *wf_hist[MAX_RX_CHANS];
+static void wf_hist_send(wf_inst_t *wf, int secs);
+
 void c2s_waterfall_init()
 {
 	int i;
@@ -121,9 +148,17 @@ void c2s_waterfall_init()
 	// and cause the data pump to overrun
 	for (i=0; i < MAX_WF_CHANS; i++) {
 	    fft_t *fft = &WF_SHMEM->fft_inst[i];
-		fft->hw_dft_plan = fftwf_plan_dft_1d(WF_C_NSAMPS, fft->hw_c_samps, fft->hw_fft, FFTW_FORWARD, FFTW_ESTIMATE);
+		fft->hw_dft_plan = fftw_wisdom_plan_dft_1d(WF_C_NSAMPS, fft->hw_c_samps, fft->hw_fft, FFTW_FORWARD, FFTW_ESTIMATE);
 	}
 
+    #if !defined(WF_SHMEM_DISABLE) && !defined(WF_IPC_SAMPLE_WF)
+        // for compute_frames(), batch_plan[n] does fft_inst[ch .. ch+n-1]
+        fft_t *fft = &WF_SHMEM->fft_inst[0];
+        int dist = sizeof(fft_t) / sizeof(fftwf_complex);
+        for (i=2; i <= MAX_WF_CHANS; i++)
+            WF_SHMEM->batch_plan[i] = fftw_wisdom_plan_many_dft(WF_C_NSAMPS, i, fft->hw_c_samps, fft->hw_fft, dist, FFTW_FORWARD, FFTW_ESTIMATE);
+    #endif
+
 	float adc_scale_decim = powf(2, -16);		// gives +/- 0.5 float samples
 	//float adc_scale_decim = powf(2, -15);		// gives +/- 1.0 float samples
 
@@ -164,6 +199,11 @@ void c2s_waterfall_init()
     }
     
 	WF_SHMEM->n_chunks = (int) ceilf((float) WF_C_NSAMPS / NWF_SAMPS);
+
+    if (wf_virt >= 0) {
+        void wf_virt_task(void *param);
+        CreateTaskF(wf_virt_task, 0, WF_PRIORITY, CTF_STACK_MED);
+    }
 	
 	assert(WF_C_NSAMPS == WF_C_NFFT);
 	assert(WF_C_NSAMPS <= 8192);	// hardware sample buffer length limitation
@@ -174,15 +214,17 @@ void c2s_waterfall_init()
         void sample_wf(int rx_chan);
         shmem_ipc_setup("kiwi.waterfall", SIG_IPC_WF, sample_wf);
     #else
-        void compute_frame(int rx_chan);
-        shmem_ipc_setup("kiwi.waterfall", SIG_IPC_WF, compute_frame);
+        void compute_frames(int mask);
+        shmem_ipc_setup("kiwi.waterfall", SIG_IPC_WF, compute_frames, true);
     #endif
 #endif
 }
 
-void c2s_waterfall_compression(int rx_chan, bool compression)
+void c2s_waterfall_compression(int rx_chan, int compression)
 {
-	WF_SHMEM->wf_inst[rx_chan].compression = compression;
+	wf_inst_t *wf = &WF_SHMEM->wf_inst[rx_chan];
+	wf->compression = compression;
+	wf->delta_rows = 0;     // start with a key row
 }
 
 #define	CMD_ZOOM	0x01
@@ -202,11 +244,71 @@ void c2s_waterfall_setup(void *param)
 
     // If not wanting a wf (!conn->isWF_conn) send wf_chans=0 to force audio FFT to be used.
     // But need to send actual value via wf_chans_real for use elsewhere.
+    // With virtual waterfalls every channel has a waterfall.
+    int wf_chans_ui = (wf_virt >= 0)? rx_chans : wf_chans;
 	send_msg(conn, SM_WF_DEBUG, "MSG wf_fft_size=1024 wf_fps=%d wf_fps_max=%d zoom_max=%d rx_chans=%d wf_chans=%d wf_chans_real=%d wf_setup",
-		WF_SPEED_FAST, WF_SPEED_MAX, MAX_ZOOM, rx_chans, conn->isWF_conn? wf_chans:0, wf_chans);
+		WF_SPEED_FAST, WF_SPEED_MAX, MAX_ZOOM, rx_chans, conn->isWF_conn? wf_chans_ui:0, wf_chans);
 	if (do_gps && !do_sdr) send_msg(conn, SM_WF_DEBUG, "MSG gps");
 }
 
+// CIC decimation for a zoom level, also returns the zoom used for sample timing
+static u2_t wf_decim(int zoom, int *zm1_p)
+{
+    #define CIC1_DECIM 0x0001
+    #define CIC2_DECIM 0x0100
+    u2_t decim, r1, r2;
+#ifdef USE_WF_NEW
+    // currently 11-levels of zoom: z0-z10, MAX_ZOOM == 10
+    // z0-10: R = 2,4,8,16,32,64,128,256,512,1024,2048 for MAX_ZOOM == 10
+    r1 = zoom + 1;
+    r2 = 1;		// R2 = 1
+    decim = ?;
+#else
+    // NB: because we only use half of the FFT with CIC can zoom one level less
+    int zm1 = (WF_USING_HALF_CIC == 2)? (zoom? (zoom-1) : 0) : zoom;
+    *zm1_p = zm1;
+
+    #ifdef USE_WF_1CIC
+
+        // currently 15-levels of zoom: z0-z14, MAX_ZOOM == 14
+        if (zm1 == 0) {
+            // z0-1: R = 1,1
+            r1 = 0;
+        } else {
+            // z2-14: R = 2,4,8,16,32,64,128,256,512,1k,2k,4k,8k for MAX_ZOOM = 14
+            r1 = zm1;
+        }
+    
+        // hardware limitation
+        assert(r1 >= 0 && r1 <= 15);
+        assert(WF_1CIC_MAXD <= 32768);
+        decim = CIC1_DECIM << r1;
+    #else
+        // currently 15-levels of zoom: z0-z14, MAX_ZOOM == 14
+        if (zm1 == 0) {
+            // z0-1: R = 1 (R1 = R2 = 1)
+            r1 = r2 = 0;
+        } else
+        if (zm1 <= WF_2CIC_POW2) {
+            // z2-8: R = 2,4,8,16,32,64,128 (R1 = 1; R2 = 2,4,8,16,32,64,128)
+            r1 = 0;
+            r2 = zm1;
+        } else {
+            // z9-14: R = 128,256,512,1k,2k,4k (R1 = 2,4,8,16,32,64; R2 = 128)
+            r1 = zm1 - WF_2CIC_POW2;
+            r2 = WF_2CIC_POW2;
+        }
+    
+        // hardware limitation
+        assert(r1 >= 0 && r1 <= 7);
+        assert(r2 >= 0 && r2 <= 7);
+        assert(WF_2CIC_MAXD <= 127);
+        decim = (CIC2_DECIM << r2) | (CIC1_DECIM << r1);
+    #endif
+#endif
+    return decim;
+}
+
 void c2s_waterfall(void *param)
 {
 	conn_t *conn = (conn_t *) param;
@@ -232,12 +334,14 @@ void c2s_waterfall(void *param)
 	memset(wf, 0, sizeof(wf_inst_t));
 	wf->conn = conn;
 	wf->rx_chan = rx_chan;
-	wf->compression = true;
-	wf->isWF = (rx_chan < wf_chans && conn->isWF_conn);
-	wf->isFFT = !wf->isWF;
+	wf->compression = WF_COMP_ADPCM;
+	wf->isWF = (rx_chan < wf_chans && rx_chan != wf_virt && conn->isWF_conn);
+	wf->isVirt = (!wf->isWF && wf_virt >= 0 && conn->isWF_conn);
+	wf->isFFT = !wf->isWF && !wf->isVirt;
     wf->mark = timer_ms();
     wf->prev_start = wf->prev_zoom = -1;
     wf->snd = &snd_inst[rx_chan];
+    wf->cache_src = -1;
 
     wf->check_overlapped_sampling = true;
     int n_chunks = WF_SHMEM->n_chunks;
@@ -328,57 +432,8 @@ void c2s_waterfall(void *param)
                     if (zoom != _zoom) {
                         zoom = _zoom;
                     
-                        #define CIC1_DECIM 0x0001
-                        #define CIC2_DECIM 0x0100
-                        u2_t decim, r1, r2;
-    #ifdef USE_WF_NEW
-                        // currently 11-levels of zoom: z0-z10, MAX_ZOOM == 10
-                        // z0-10: R = 2,4,8,16,32,64,128,256,512,1024,2048 for MAX_ZOOM == 10
-                        r1 = zoom + 1;
-                        r2 = 1;		// R2 = 1
-                        decim = ?;
-    #else
-                        // NB: because we only use half of the FFT with CIC can zoom one level less
-                        int zm1 = (WF_USING_HALF_CIC == 2)? (zoom? (zoom-1) : 0) : zoom;
-
-                        #ifdef USE_WF_1CIC
-                    
-                            // currently 15-levels of zoom: z0-z14, MAX_ZOOM == 14
-                            if (zm1 == 0) {
-                                // z0-1: R = 1,1
-                                r1 = 0;
-                            } else {
-                                // z2-14: R = 2,4,8,16,32,64,128,256,512,1k,2k,4k,8k for MAX_ZOOM = 14
-                                r1 = zm1;
-                            }
-                        
-                            // hardware limitation
-                            assert(r1 >= 0 && r1 <= 15);
-                            assert(WF_1CIC_MAXD <= 32768);
-                            decim = CIC1_DECIM << r1;
-                        #else
-                            // currently 15-levels of zoom: z0-z14, MAX_ZOOM == 14
-                            if (zm1 == 0) {
-                                // z0-1: R = 1 (R1 = R2 = 1)
-                                r1 = r2 = 0;
-                            } else
-                            if (zm1 <= WF_2CIC_POW2) {
-                                // z2-8: R = 2,4,8,16,32,64,128 (R1 = 1; R2 = 2,4,8,16,32,64,128)
-                                r1 = 0;
-                                r2 = zm1;
-                            } else {
-                                // z9-14: R = 128,256,512,1k,2k,4k (R1 = 2,4,8,16,32,64; R2 = 128)
-                                r1 = zm1 - WF_2CIC_POW2;
-                                r2 = WF_2CIC_POW2;
-                            }
-                        
-                            // hardware limitation
-                            assert(r1 >= 0 && r1 <= 7);
-                            assert(r2 >= 0 && r2 <= 7);
-                            assert(WF_2CIC_MAXD <= 127);
-                            decim = (CIC2_DECIM << r2) | (CIC1_DECIM << r1);
-                        #endif
-    #endif
+                        int zm1;
+                        u2_t decim = wf_decim(zoom, &zm1);
                         samp_wait_us =  WF_C_NSAMPS * (1 << zm1) / conn->adc_clock_corrected * 1000000.0;
                         wf->chunk_wait_us = (int) ceilf(samp_wait_us / n_chunks);
                         wf->samp_wait_ms = (int) ceilf(samp_wait_us / 1000);
@@ -525,8 +580,10 @@ void c2s_waterfall(void *param)
                     did_cmd = true;
                     //printf("W/F wf_speed=%d\n", _speed);
                     if (_speed == -1) _speed = WF_NSPEEDS-1;
-                    if (_speed >= 0 && _speed < WF_NSPEEDS)
+                    if (_speed >= 0 && _speed < WF_NSPEEDS) {
                         wf->speed = _speed;
+                        wf->bp_level = 0;
+                    }
                     send_msg(conn, SM_NO_DEBUG, "MSG wf_fps=%d", wf_fps[wf->speed]);
                     cmd_recv |= CMD_SPEED;
                 }
@@ -548,6 +605,26 @@ void c2s_waterfall(void *param)
                     did_cmd = true;
                 }
                 break;
+
+            case CMD_WF_HISTORY:
+                int secs;
+                i = sscanf(cmd, "SET wf_history=%d", &secs);
+                if (i == 1) {
+                    did_cmd = true;
+                    wf_hist_send(wf, MIN(secs, WF_HIST_SECS));
+                }
+                break;
+
+            case CMD_WF_AVG:
+                int avg;
+                i = sscanf(cmd, "SET wf_avg=%d", &avg);
+                if (i == 1) {
+                    did_cmd = true;
+                    if (avg < WF_AVG_OFF || avg > WF_AVG_MIN) avg = WF_AVG_OFF;
+                    wf->avg_mode = avg;
+                    wf->avg_n = 0;
+                }
+                break;
             
             default:
                 cprintf(conn, "#### W/F key=%d DEFAULT CASE <%s>\n", key, cmd);
@@ -625,7 +702,7 @@ void c2s_waterfall(void *param)
 		}
 
         // FIXME: until we figure out if no WF cmds are needed when no wf is present just occasionally wake up and check
-		if (rx_chan >= wf_num) {
+		if (rx_chan >= wf_num && !wf->isVirt) {
 			TaskSleepMsec(500);
 			continue;
 		}
@@ -731,21 +808,26 @@ void c2s_waterfall(void *param)
 		if (new_scale_mask) {
 			// FIXME: Is this right? Why is this so strange?
 			float fft_scale;
-			float maxmag = zoom? wf->fft_used : wf->fft_used/2;
+			
+			// virtual waterfall lines come from the zoom 0 source FFT
+			int fft_zoom = wf->isVirt? 0 : zoom;
+			int fft_used = wf->isVirt? WF_VIRT_BINS : wf->fft_used;
+			float maxmag = fft_zoom? fft_used : fft_used/2;
 			//jks
 			//fft_scale = 20.0 / (maxmag * maxmag);
 			//wf->fft_offset = 0;
 			
 			// makes GEN attn 0 dB = 0 dBm
 			fft_scale = 5.0 / (maxmag * maxmag);
-			wf->fft_offset = zoom? -0.08 : -0.8;
+			wf->fft_offset = fft_zoom? -0.08 : -0.8;
 			
 			// fixes GEN z0/z1+ levels, but breaks regular z0/z1+ noise floor continuity -- why?
 			//float maxmag = zoom? wf->fft_used : wf->fft_used/4;
 			//fft_scale = (zoom? 2.0 : 5.0) / (maxmag * maxmag);
 			
 			// apply masked frequencies
-			if (dx.masked_len != 0 && !(conn->other != NULL && conn->other->tlimit_exempt_by_pwd)) {
+			wf->masked = (dx.masked_len != 0 && !(conn->other != NULL && conn->other->tlimit_exempt_by_pwd));
+			if (wf->masked) {
                 for (i=0; i < wf->plot_width_clamped; i++) {
                     float scale = fft_scale;
                     int f = roundf((wf->start + (i << (MAX_ZOOM - zoom))) * HZperStart);
@@ -765,6 +847,20 @@ void c2s_waterfall(void *param)
 
 		    new_scale_mask = false;
 		}
+		
+		bool wf_backpressure(wf_inst_t *wf);
+		if (wf_backpressure(wf))
+		    continue;
+		
+		bool wf_cache_frame(wf_inst_t *wf);
+		if (wf_cache_frame(wf))
+		    continue;
+		
+		if (wf->isVirt) {
+		    void wf_virt_frame(wf_inst_t *wf, float HZperStart);
+		    wf_virt_frame(wf, HZperStart);
+		    continue;
+		}
 
         void sample_wf(int rx_chan);
         #ifdef WF_SHMEM_DISABLE
@@ -779,13 +875,159 @@ void c2s_waterfall(void *param)
 	}
 }
 
-void sample_wf(int rx_chan)
+static void wf_hist_add(wf_inst_t *wf)
 {
-	wf_inst_t *wf = &WF_SHMEM->wf_inst[rx_chan];
-    int k;
-    fft_t *fft = &WF_SHMEM->fft_inst[rx_chan];
-    u64_t now, deadline;
+    int rx_chan = wf->rx_chan;
+    wf_pkt_t *out = &wf->out;
+    wf_hist_t *h = wf_hist[rx_chan];
+    u4_t now = timer_ms();
+
+    if (h == NULL) {
+        // only the pages actually written use memory
+        h = (wf_hist_t *) mmap((caddr_t) 0, sizeof(wf_hist_t), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if (h == MAP_FAILED) {
+            lprintf("WF%d history mmap failed\n", rx_chan);
+            return;
+        }
+        wf_hist[rx_chan] = h;
+    }
+
+    if (h->wr && now - h->last_ms < 1000 / WF_HIST_FPS) return;
+    h->last_ms = now;
+
+    wf_hist_row_t *r = &h->row[h->wr % WF_HIST_ROWS];
+    r->ms = now;
+    r->start = out->x_bin_server;
+    r->zoom = out->flags_x_zoom_server & 0xffff;
+    r->masked = wf->masked;
+    r->masked_seq = dx.masked_seq;
+
+    // delta rows can't be decoded out of sequence, keep them uncompressed
+    if (out->flags_x_zoom_server & WF_FLAGS_DELTA) {
+        r->bytes = WF_OUT_HDR + WF_WIDTH;
+        memcpy(&r->pkt, out, WF_OUT_HDR);
+        r->pkt.flags_x_zoom_server &= ~WF_FLAGS_DELTA;
+        memcpy(r->pkt.un.buf, wf->row, WF_WIDTH);
+    } else {
+        r->bytes = WF_OUT_HDR + wf->out_bytes;
+        memcpy(&r->pkt, out, r->bytes);
+    }
+    h->wr++;
+}
+
+// Send the history rows of the last secs seconds, oldest first, in as few messages as possible.
+// Each message is a wf_pkt_t header with WF_FLAGS_HISTORY and seq = number of rows, followed by
+// the rows, each preceded by its length (u2_t, little-endian). The rows are as originally sent
+// except seq, which is the age of the row in msec.
+// The ring outlives the connections on the channel, so a client that must not see the masked
+// frequencies only gets rows computed with the current mask applied.
+static void wf_hist_send(wf_inst_t *wf, int secs)
+{
+    conn_t *conn = wf->conn;
+    wf_hist_t *h = wf_hist[wf->rx_chan];
+    u4_t now = timer_ms();
+    u4_t wr = h? h->wr : 0;
+    u4_t i = wr - MIN(wr, WF_HIST_ROWS);
+    int sent = 0;
+    secs = MAX(secs, 0);    // client-supplied
+
+    while (i < wr && now - h->row[i % WF_HIST_ROWS].ms > (u4_t) secs * 1000) i++;
+
+    char *buf = (char *) kiwi_malloc("wf_hist_send", WF_HIST_CHUNK);
+    wf_pkt_t *out = (wf_pkt_t *) buf;
+    memset(out, 0, WF_OUT_HDR);
+    strncpy(out->id4, "W/F ", 4);
+    out->flags_x_zoom_server = WF_FLAGS_HISTORY;
+
+    do {
+        int len = WF_OUT_HDR, rows = 0;
+
+        for (; i < wr; i++) {
+            wf_hist_row_t *r = &h->row[i % WF_HIST_ROWS];
+            if (wf->masked && (!r->masked || r->masked_seq != dx.masked_seq)) continue;
+            if (len + (int) sizeof(u2_t) + r->bytes > WF_HIST_CHUNK) break;
+            buf[len] = r->bytes & 0xff;
+            buf[len+1] = r->bytes >> 8;
+            len += sizeof(u2_t);
+            memcpy(buf + len, &r->pkt, r->bytes);
+            ((wf_pkt_t *) (buf + len))->seq = now - r->ms;
+            len += r->bytes;
+            rows++;
+        }
+
+        out->seq = rows;
+        app_to_web(conn, buf, len);
+        sent += rows;
+
+        // the burst shouldn't push the audio out of the s2c queue
+        while (i < wr && !conn->stop_data && nbuf_queued(&conn->s2c) >= WF_BP_HI)
+            TaskSleepReasonMsec("wf history", 50);
+    } while (i < wr && !conn->stop_data);
+
+    #ifdef WF_INFO
+        if (!bg) printf("WF%d history %d secs: %d rows\n", wf->rx_chan, secs, sent);
+    #endif
+    kiwi_free("wf_hist_send", buf);
+}
+
+static void wf_send_frame(wf_inst_t *wf)
+{
+    int rx_chan = wf->rx_chan;
+
+    #ifndef WF_IPC_SAMPLE_WF
+        if (wf->aper == AUTO && wf->done_autoscale > wf->sent_autoscale) {
+            wf->sent_autoscale++;
+
+            if (wf->last_noise != wf->noise || wf->last_signal != wf->signal) {
+                #ifdef WF_INFO
+                printf("### SENT d/s=%d/%d algo=%d %d:%d\n",
+                    wf->done_autoscale, wf->sent_autoscale, wf->aper_algo, wf->noise, wf->signal);
+                #endif
+                send_msg(wf->conn, false, "MSG maxdb=%d", wf->signal);
+                send_msg(wf->conn, false, "MSG mindb=%d", wf->noise);
+                wf->last_noise = wf->noise;
+                wf->last_signal = wf->signal;
+            } else {
+                #ifdef WF_INFO
+                printf("### SAME algo=%d %d:%d\n", wf->aper_algo, wf->noise, wf->signal);
+                #endif
+            }
+
+            if (wf->aper_algo != OFF)
+                wf->need_autoscale++;   // go again
+        }
+    #endif
     
+    wf_pkt_t *out = &wf->out;
+    app_to_web(wf->conn, (char*) out, WF_OUT_HDR + wf->out_bytes);
+    wf_hist_add(wf);
+    waterfall_bytes[rx_chan] += wf->out_bytes;
+    waterfall_bytes[rx_chans] += wf->out_bytes; // [rx_chans] is the sum of all waterfalls
+    waterfall_frames[rx_chan]++;
+    waterfall_frames[rx_chans]++;       // [rx_chans] is the sum of all waterfalls
+}
+
+// window the samples of one chunk into hw_c_samps[sn..], returns the number used
+static int wf_window_chunk(wf_inst_t *wf, SPI_MISO *miso, int sn)
+{
+    fft_t *fft = &WF_SHMEM->fft_inst[wf->rx_chan];
+    iq_t *iqp = (iq_t*) &(miso->word[0]);
+    int n = MIN(NWF_SAMPS, WF_C_NSAMPS - sn);
+
+    #ifdef SIMD_S16IQ_WINDOW
+        simd_s16iq_window_cf(n, iqp, &WF_SHMEM->window_function[sn], &fft->hw_c_samps[sn]);
+    #else
+        // no vector kernel for this target: the compiler vectorizes the plain loop better than a call
+        float *window = &WF_SHMEM->window_function[sn];
+        fftwf_complex *out = &fft->hw_c_samps[sn];
+        iq_t *ip = iqp;
+
+        for (int k=0; k < n; k++, ip++) {
+            out[k][I] = ((float) (s4_t) (s2_t) ip->i) * window[k];
+            out[k][Q] = ((float) (s4_t) (s2_t) ip->q) * window[k];
+        }
+    #endif
+
     #ifdef SHOW_MAX_MIN_IQ
         static void *IQi_state;
         static void *IQf_state;
@@ -795,12 +1037,28 @@ void sample_wf(int rx_chan)
             if (IQf_state != NULL) free(IQf_state);
             IQf_state = NULL;
         }
+        for (int k=0; k < n; k++, iqp++) {
+            print_max_min_stream_i(&IQi_state, P_MAX_MIN_DEMAND, "IQi", k, 2, (s4_t) (s2_t) iqp->i, (s4_t) (s2_t) iqp->q);
+            print_max_min_stream_f(&IQf_state, P_MAX_MIN_DEMAND, "IQf", k, 2, (double) fft->hw_c_samps[sn+k][I], (double) fft->hw_c_samps[sn+k][Q]);
+        }
     #endif
 
+    return n;
+}
+
+// inst is the rx_chan except for the virtual waterfall source (WF_VIRT_SRC)
+void sample_wf(int inst)
+{
+	wf_inst_t *wf = &WF_SHMEM->wf_inst[inst];
+	int rx_chan = wf->rx_chan;
+    fft_t *fft = &WF_SHMEM->fft_inst[rx_chan];
+    u64_t now, deadline;
+
     // create waterfall
     
     assert(wf_fps[wf->speed] != 0);
-    int desired = 1000 / wf_fps[wf->speed];
+    int desired = wf_frame_ms(wf);
+    u4_t pass_start = timer_ms();
 
     // desired frame rate greater than what full sampling can deliver, so start overlapped sampling
     if (wf->check_overlapped_sampling) {
@@ -846,63 +1104,58 @@ void sample_wf(int rx_chan)
         first_cmd = CmdGetWFSamples;
     }
 
-    SPI_MISO *miso = &SPI_SHMEM->wf_miso[rx_chan];
-    s4_t ii, qq;
-    iq_t *iqp;
-
+    SPI_MISO *miso;
     int chunk, sn;
     int n_chunks = WF_SHMEM->n_chunks;
+    int reads = MAX(n_chunks-1, 1), last = reads-1;
 
     for (chunk=0, sn=0; sn < WF_C_NSAMPS; chunk++) {
         assert(chunk < n_chunks);
 
-        if (wf->overlapped_sampling) {
-            evWF(EC_TRIG1, EV_WF, -1, "WF", "CmdGetWFContSamps");
-        } else {
-            // wait until current chunk is available in WF sample buffer
-            now = timer_us64();
-            if (now < deadline) {
-                u4_t diff = deadline - now;
-                if (diff) {
-                    evWF(EC_EVENT, EV_WF, -1, "WF", "TaskSleep wait chunk buffer");
-                    WFSleepReasonUsec("wait chunk", diff);
-                    evWF(EC_EVENT, EV_WF, -1, "WF", "TaskSleep wait chunk buffer done");
+        if (chunk < reads) {
+            if (wf->overlapped_sampling) {
+                evWF(EC_TRIG1, EV_WF, -1, "WF", "CmdGetWFContSamps");
+            } else {
+                // wait until current chunk is available in WF sample buffer
+                now = timer_us64();
+                if (now < deadline) {
+                    u4_t diff = deadline - now;
+                    if (diff) {
+                        evWF(EC_EVENT, EV_WF, -1, "WF", "TaskSleep wait chunk buffer");
+                        WFSleepReasonUsec("wait chunk", diff);
+                        evWF(EC_EVENT, EV_WF, -1, "WF", "TaskSleep wait chunk buffer done");
+                    }
                 }
+                deadline += wf->chunk_wait_us;
             }
-            deadline += wf->chunk_wait_us;
-        }
-    
-        if (chunk == 0) {
-            spi_get_noduplex(first_cmd, miso, NWF_SAMPS * sizeof(iq_t), rx_chan);
-        } else
-        if (chunk < n_chunks-1) {
-            spi_get_noduplex(CmdGetWFSamples, miso, NWF_SAMPS * sizeof(iq_t), rx_chan);
+        
+            SPI_CMD cmd = chunk? CmdGetWFSamples : first_cmd;
+            miso = &SPI_SHMEM->wf_miso[rx_chan][chunk & 1];
+
+            #ifdef WF_SPI_PIPELINED
+                // The reply to a pipelined request arrives with the next SPI transfer, i.e. our next request
+                // (or another task's meanwhile). So convert the previous chunk after each request instead of
+                // flushing for every reply. Only the last request flushes to get its own reply.
+                if (chunk < last)
+                    spi_get_pipelined(cmd, miso, NWF_SAMPS * sizeof(iq_t), rx_chan);
+                else
+                    spi_get_noduplex(cmd, miso, NWF_SAMPS * sizeof(iq_t), rx_chan);
+
+                if (chunk)
+                    sn += wf_window_chunk(wf, &SPI_SHMEM->wf_miso[rx_chan][(chunk-1) & 1], sn);
+                if (chunk < last) continue;
+            #else
+                spi_get_noduplex(cmd, miso, NWF_SAMPS * sizeof(iq_t), rx_chan);
+            #endif
+        } else {
+            // as before pipelining: chunks past the last read reuse its buffer
+            miso = &SPI_SHMEM->wf_miso[rx_chan][last & 1];
         }
 
         evWFC(EC_EVENT, EV_WF, -1, "WF", evprintf("%s SAMPLING chunk %d",
             wf->overlapped_sampling? "OVERLAPPED":"NON-OVERLAPPED", chunk));
         
-        iqp = (iq_t*) &(miso->word[0]);
-	    float *window = WF_SHMEM->window_function;
-        
-        for (k=0; k<NWF_SAMPS; k++) {
-            if (sn >= WF_C_NSAMPS) break;
-            ii = (s4_t) (s2_t) iqp->i;
-            qq = (s4_t) (s2_t) iqp->q;
-            iqp++;
-
-            float fi = ((float) ii) * window[sn];
-            float fq = ((float) qq) * window[sn];
-            
-            #ifdef SHOW_MAX_MIN_IQ
-                print_max_min_stream_i(&IQi_state, "IQi", k, 2, ii, qq);
-                print_max_min_stream_f(&IQf_state, "IQf", k, 2, (double) fi, (double) fq);
-            #endif
-            
-            fft->hw_c_samps[sn][I] = fi;
-            fft->hw_c_samps[sn][Q] = fq;
-            sn++;
-        }
+        sn += wf_window_chunk(wf, miso, sn);
     }
 
     #ifndef EV_MEAS_WF
@@ -942,47 +1195,46 @@ void sample_wf(int rx_chan)
     //if (wf->flush_wf_pipe) {
     //	wf->flush_wf_pipe--;
     //} else {
-        void compute_frame(int rx_chan);
+        // Averaging: sample every avg_ms and only send the row after the last spectrum that fits
+        // in the frame interval. Otherwise every spectrum is sent.
+        int avg_ms = 0;
+        wf->avg_emit = true;
+        if (wf->avg_mode != WF_AVG_OFF && !wf->isVirtSrc) {
+            avg_ms = MAX(wf->samp_wait_ms, WF_AVG_MS);
+            wf->avg_emit = ((int) (timer_ms() - wf->mark) + avg_ms >= desired);
+        }
+
+        void compute_frame(int inst);
+        wf->computing = true;       // keep wf_cache_frame() from copying a partial frame
         #ifdef WF_SHMEM_DISABLE
-            compute_frame(rx_chan);
+            compute_frame(inst);
         #else
             #ifdef WF_IPC_SAMPLE_WF
-                compute_frame(rx_chan);
+                compute_frame(inst);
             #else
-                shmem_ipc_invoke(SIG_IPC_WF, rx_chan);      // invoke compute_frame()
+                shmem_ipc_invoke(SIG_IPC_WF, inst);      // invoke compute_frame()
             #endif
         #endif
 
-        #ifndef WF_IPC_SAMPLE_WF
-            if (wf->aper == AUTO && wf->done_autoscale > wf->sent_autoscale) {
-                wf->sent_autoscale++;
+        wf->computing = false;
 
-                if (wf->last_noise != wf->noise || wf->last_signal != wf->signal) {
-                    #ifdef WF_INFO
-                    printf("### SENT d/s=%d/%d algo=%d %d:%d\n",
-                        wf->done_autoscale, wf->sent_autoscale, wf->aper_algo, wf->noise, wf->signal);
-                    #endif
-                    send_msg(wf->conn, false, "MSG maxdb=%d", wf->signal);
-                    send_msg(wf->conn, false, "MSG mindb=%d", wf->noise);
-                    wf->last_noise = wf->noise;
-                    wf->last_signal = wf->signal;
-                } else {
-                    #ifdef WF_INFO
-                    printf("### SAME algo=%d %d:%d\n", wf->aper_algo, wf->noise, wf->signal);
-                    #endif
-                }
+        if (!wf->avg_emit) {
+            int delay = avg_ms - (int) (timer_ms() - pass_start);
+            if (delay > 0)
+                WFSleepReasonMsec("wait avg", delay);
+            else
+                WFNextTask("avg");
+            return;
+        }
 
-                if (wf->aper_algo != OFF)
-                    wf->need_autoscale++;   // go again
-            }
-        #endif
-        
-        wf_pkt_t *out = &wf->out;
-        app_to_web(wf->conn, (char*) out, WF_OUT_HDR + wf->out_bytes);
-        waterfall_bytes[rx_chan] += wf->out_bytes;
-        waterfall_bytes[rx_chans] += wf->out_bytes; // [rx_chans] is the sum of all waterfalls
-        waterfall_frames[rx_chan]++;
-        waterfall_frames[rx_chans]++;       // [rx_chans] is the sum of all waterfalls
+        wf->frames++;
+        wf->frame_ms = timer_ms();
+
+        // the virtual waterfall source only publishes its spectrum (see compute_frame())
+        if (!wf->isVirtSrc) {
+            wf_send_frame(wf);
+            wf_cache_stats.misses++;
+        }
         evWF(EC_EVENT, EV_WF, -1, "WF", "compute_frame: done");
     
         #if 0
@@ -1019,13 +1271,13 @@ static float dB_wire_to_dBm(int db_value)
 
 static void aperture_auto(wf_inst_t *wf, u1_t *bp)
 {
-    int i, rx_chan = wf->rx_chan;
+    int i;
     if (wf->need_autoscale <= wf->done_autoscale) return;
     bool single_shot = (wf->aper_algo == OFF);
 
     // FIXME: for audio FFT needs to be further limited to just passband
     int start = 0, stop = APER_PWR_LEN, len = APER_PWR_LEN;
-    if (rx_chan >= wf_chans) start = 256, stop = 768, len = stop - start;       // audioFFT
+    if (wf->isFFT) start = 256, stop = 768, len = stop - start;       // audioFFT
     
     if (wf->avg_clear) {
         for (i = start; i < stop; i++)
@@ -1100,34 +1352,117 @@ static void aperture_auto(wf_inst_t *wf, u1_t *bp)
 
     #ifdef WF_INFO
     printf("### APER_AUTO n/d=%d/%d rx%d algo=%d max_count=%d dBm=%d:%d\n",
-        wf->need_autoscale, wf->done_autoscale, rx_chan, wf->aper_algo, max_count, min_dBm, max_dBm);
+        wf->need_autoscale, wf->done_autoscale, wf->rx_chan, wf->aper_algo, max_count, min_dBm, max_dBm);
     #endif
     if (max_dBm < -80) max_dBm = -80;
     wf->signal = max_dBm;   // headroom applied on js side
     wf->noise = min_dBm;
 }
 
-void compute_frame(int rx_chan)
+// header, autoscale and compression common to hardware and virtual waterfall frames
+static void compute_frame_out(wf_inst_t *wf, u1_t *buf_p)
 {
-	wf_inst_t *wf = &WF_SHMEM->wf_inst[rx_chan];
+	wf_pkt_t *out = &wf->out;
+
+	if (wf->flush_wf_pipe) {
+		out->x_bin_server = (wf->prev_start == -1)? wf->start : wf->prev_start;
+		out->flags_x_zoom_server = (wf->prev_zoom == -1)? wf->zoom : wf->prev_zoom;
+		wf->flush_wf_pipe--;
+		if (wf->flush_wf_pipe == 0) {
+			//jksd
+			printf("PIPE start P%d/C%d zoom P%d/C%d\n", wf->prev_start, wf->start, wf->prev_zoom, wf->zoom);
+			wf->prev_start = wf->start;
+			wf->prev_zoom = wf->zoom;
+		}
+	} else {
+		out->x_bin_server = wf->start;
+		out->flags_x_zoom_server = wf->zoom;
+	}
+	
+	evWF(EC_EVENT, EV_WF, -1, "WF", "compute_frame: fill out buf");
+	
+	// for wf_cache_frame() clients doing their own autoscale
+	memcpy(wf->row, buf_p, WF_WIDTH);
+
+    if (wf->aper == AUTO)
+        aperture_auto(wf, buf_p);
+
+	ima_adpcm_state_t adpcm_wf;
+	
+	if (wf->compression == WF_COMP_DELTA) {
+		bool key = ((wf->delta_rows++ % WF_DELTA_KEY_ROWS) == 0);
+		wf->out_bytes = wf_delta_encode(wf->row, wf->delta_prev, WF_WIDTH, wf->delta_seq++, key, out->un.buf);
+		out->flags_x_zoom_server |= WF_FLAGS_DELTA;
+	} else
+	if (wf->compression) {
+		memset(out->un.adpcm_pad, out->un.buf2[0], sizeof(out->un.adpcm_pad));
+		memset(&adpcm_wf, 0, sizeof(ima_adpcm_state_t));
+		encode_ima_adpcm_u8_e8(out->un.buf, out->un.buf, ADPCM_PAD + WF_WIDTH, &adpcm_wf);
+		wf->out_bytes = (ADPCM_PAD + WF_WIDTH) * sizeof(u1_t) / 2;
+		out->flags_x_zoom_server |= WF_FLAGS_COMPRESSION;
+	} else {
+		wf->out_bytes = WF_WIDTH * sizeof(u1_t);
+	}
+
+	// sync this waterfall line to audio packet currently going out
+	out->seq = wf->snd_seq;
+	//if (out->seq != wf->snd->seq)
+	//{ real_printf("%d ", wf->snd->seq - out->seq); fflush(stdout); }
+	//{ real_printf("ws%d,%d ", out->seq, wf->snd->seq); fflush(stdout); }
+}
+
+// Combine this spectrum with the others of the frame interval according to avg_mode.
+// Returns true with the result in pwr_out[] if the row is to be sent now.
+static bool wf_avg_frame(wf_inst_t *wf, float *pwr_out, int n)
+{
+    int i;
+    float *acc = wf->avg_acc;
+
+    if (wf->avg_n == 0) {
+        memcpy(acc, pwr_out, n * sizeof(float));
+    } else {
+        switch (wf->avg_mode) {
+            case WF_AVG_MEAN: for (i=0; i < n; i++) acc[i] += pwr_out[i]; break;
+            case WF_AVG_PEAK: for (i=0; i < n; i++) acc[i] = fmaxf(acc[i], pwr_out[i]); break;
+            case WF_AVG_MIN:  for (i=0; i < n; i++) acc[i] = fminf(acc[i], pwr_out[i]); break;
+        }
+    }
+    wf->avg_n++;
+    if (!wf->avg_emit) return false;
+
+    if (wf->avg_mode == WF_AVG_MEAN) {
+        float scale = 1.0f / wf->avg_n;
+        for (i=0; i < n; i++) pwr_out[i] = acc[i] * scale;
+    } else {
+        memcpy(pwr_out, acc, n * sizeof(float));
+    }
+    wf->avg_n = 0;
+    return true;
+}
+
+// everything after the FFT
+static void compute_frame_row(int inst)
+{
+	wf_inst_t *wf = &WF_SHMEM->wf_inst[inst];
 	int i;
 	wf_pkt_t *out = &wf->out;
 	u1_t comp_in_buf[WF_WIDTH];
 	float pwr[MAX_FFT_USED];
-    fft_t *fft = &WF_SHMEM->fft_inst[rx_chan];
-		
-    //TaskStat2(TSTAT_INCR|TSTAT_ZERO, 0, "frm");
-
-	//NextTask("FFT1");
-	evWF(EC_EVENT, EV_WF, -1, "WF", "compute_frame: FFT start");
-	fftwf_execute(fft->hw_dft_plan);
-	evWF(EC_EVENT, EV_WF, -1, "WF", "compute_frame: FFT done");
-	//NextTask("FFT2");
+    fft_t *fft = &WF_SHMEM->fft_inst[wf->rx_chan];
 
 	u1_t *buf_p = wf->compression? out->un.buf2 : out->un.buf;
 	u1_t *bp = buf_p;
 			
-	if (!wf->fft_used_limit) wf->fft_used_limit = wf->fft_used;
+	// after a new map find how many FFT bins are actually plotted
+	if (!wf->fft_used_limit) {
+		if (wf->fft_used >= wf->plot_width) {
+		    for (i=0; i < wf->fft_used && wf->fft2wf_map[i] < WF_WIDTH; i++)
+		        ;
+		    wf->fft_used_limit = i;
+		} else {
+		    wf->fft_used_limit = wf->fft_used;
+		}
+	}
 
 	// zero-out the DC component in bin zero/one (around -90 dBFS)
 	// otherwise when scrolling w/f it will move but then not continue at the new location
@@ -1152,14 +1487,17 @@ void compute_frame(int rx_chan)
         }
 	#endif
 	
-	for (i=2; i < wf->fft_used_limit; i++) {
-		float re = fft->hw_fft[i][I], im = fft->hw_fft[i][Q];
-		pwr[i] = re*re + im*im;
-
-		#ifdef SHOW_MAX_MIN_PWR
-            //print_max_min_stream_f(&FFT_state, "FFT", i, 2, (double) re, (double) im);
-            //print_max_min_stream_f(&pwr_state, "pwr", i, 1, (double) pwr[i]);
-		#endif
+	simd_pwr_cf(wf->fft_used_limit - 2, &fft->hw_fft[2], &pwr[2]);
+	
+	if (wf->isVirtSrc) {
+	    // Double buffered because the virtual clients read from another process.
+	    // The source can't produce two lines while a client copies one out.
+	    wf_virt_t *v = &WF_SHMEM->virt;
+	    u4_t seq = v->seq + 1;
+	    memcpy(v->pwr[seq & 1], pwr, wf->fft_used_limit * sizeof(float));
+	    __sync_synchronize();
+	    v->seq = seq;
+	    return;
 	}
 		
 	// fixme proper power-law scaling..
@@ -1186,105 +1524,54 @@ void compute_frame(int rx_chan)
 	    float pix_per_dB = 255.0 / range_dB;
 	#endif
 
-	int bin=0, _bin=-1, bin2pwr[WF_WIDTH];
-	float p, dB, pwr_out_sum[WF_WIDTH], pwr_out_peak[WF_WIDTH];
-
-    //#define WF_CMA
-    #ifndef WF_CMA
-	    memset(pwr_out_peak, 0, sizeof(pwr_out_peak));
-	#endif
+	float pwr_out_peak[WF_WIDTH];
+	int npx;
+	if (wf->new_map) wf->avg_n = 0;     // averaging across a zoom/pan makes no sense
 
 	if (wf->fft_used >= wf->plot_width) {
 		// >= FFT than plot
-		
-		int avgs=0;
-		for (i=0; i<wf->fft_used_limit; i++) {
-			p = pwr[i];
-			bin = wf->fft2wf_map[i];
-			if (bin >= WF_WIDTH) {
-				if (wf->new_map) {
-				
-					#ifdef WF_INFO
-					if (!bg) printf(">= FFT: Z%d WF_C_NSAMPS %d i %d fft_used %d plot_width %d pix_per_dB %.3f range %.0f:%.0f\n",
-						wf->zoom, WF_C_NSAMPS, i, wf->fft_used, wf->plot_width, pix_per_dB, max_dB, min_dB);
-					#endif
-					wf->new_map = FALSE;
-				}
-				wf->fft_used_limit = i;		// we now know what the limit is
-				break;
-			}
-			
-			if (bin == _bin) {
-				#ifdef WF_CMA
-					pwr_out_cma[bin] = (pwr_out_cma[bin] * avgs) + p;
-					avgs++;
-					pwr_out_cma[bin] /= avgs;
-				#else
-					if (p > pwr_out_peak[bin]) pwr_out_peak[bin] = p;
-					pwr_out_sum[bin] += p;
-				#endif
-			} else {
-				#ifdef WF_CMA
-					avgs = 1;
-				#endif
-				pwr_out_peak[bin] = p;
-				pwr_out_sum[bin] = p;
-				_bin = bin;
-			}
+		if (wf->new_map) {
+			#ifdef WF_INFO
+			if (!bg) printf(">= FFT: Z%d WF_C_NSAMPS %d fft_used %d/%d plot_width %d pix_per_dB %.3f range %.0f:%.0f\n",
+				wf->zoom, WF_C_NSAMPS, wf->fft_used_limit, wf->fft_used, wf->plot_width, pix_per_dB, max_dB, min_dB);
+			#endif
+			wf->new_map = FALSE;
 		}
 
-		#ifdef SHOW_MAX_MIN_DB
-            float dBs_f[WF_WIDTH];
-            int dBs[WF_WIDTH];
-		#endif
+	    memset(pwr_out_peak, 0, sizeof(pwr_out_peak));
+		simd_peak_bin(wf->fft_used_limit, pwr, wf->fft2wf_map, pwr_out_peak);
+		npx = WF_WIDTH;
+	} else {
+		// < FFT than plot
+		if (wf->new_map) {
+			//printf("< FFT: Z%d WF_C_NSAMPS %d fft_used %d plot_width_clamped %d pix_per_dB %.3f range %.0f:%.0f\n",
+			//	wf->zoom, WF_C_NSAMPS, wf->fft_used, wf->plot_width_clamped, pix_per_dB, max_dB, min_dB);
+			wf->new_map = FALSE;
+		}
 
-		for (i=0; i<WF_WIDTH; i++) {
-			p = pwr_out_peak[i];
-			//p = pwr_out_sum[i];
-
-			dB = 10.0 * log10f(p * wf->fft_scale[i] + 1e-30F) + wf->fft_offset;
-            #if 0
-                //jks
-                if (i == 506) printf("Z%d ", wf->zoom);
-                if (i >= 507 && i <= 515) {
-                    float peak_dB = 10.0 * log10f(pwr_out_peak[i] * wf->fft_scale[i] + 1e-30F) + wf->fft_offset;
-                    printf("%d:%.1f|%.1f ", i, dB, peak_dB);
-                }
-                if (i == 516) printf("\n");
-            #endif
+		for (i=0; i<wf->plot_width_clamped; i++)
+			pwr_out_peak[i] = pwr[wf->wf2fft_map[i]];
+		npx = wf->plot_width_clamped;
+	}
 
-			#ifdef SHOW_MAX_MIN_DB
-			    dBs_f[i] = dB;
-			#endif
-			#ifdef SHOW_MAX_MIN_PWR
-			    print_max_min_stream_f(&dB_state, "dB", i, 1, (double) dB);
-			#endif
+	if (wf->avg_mode != WF_AVG_OFF && !wf_avg_frame(wf, pwr_out_peak, npx))
+	    return;
 
-			// We map 0..-200 dBm to (u1_t) 255..55
-			// If we map it the reverse way, (u1_t) 0..255 => 0..-255 dBm (which is more natural), then the
-			// noise in the bottom bits due to the ADPCM compression will effect the high-order dBm bits
-			// which is bad.
-			if (dB > 0) dB = 0;
-			if (dB < -200.0) dB = -200.0;
-			dB--;
-			*bp++ = (u1_t) (int) dB;
-
-			#ifdef SHOW_MAX_MIN_DB
-			    dBs[i] = *(bp-1);
-			#endif
+    // We map 0..-200 dBm to (u1_t) 255..55
+    // If we map it the reverse way, (u1_t) 0..255 => 0..-255 dBm (which is more natural), then the
+    // noise in the bottom bits due to the ADPCM compression will effect the high-order dBm bits
+    // which is bad.
+    simd_pwr_to_wf_u8(npx, pwr_out_peak, wf->fft_scale, wf->fft_offset, bp);
+
+	#if defined(SHOW_MAX_MIN_DB) || defined(SHOW_MAX_MIN_PWR)
+        int dBs[WF_WIDTH];
+        for (i=0; i<WF_WIDTH; i++) {
+            dBs[i] = bp[i];
 			#ifdef SHOW_MAX_MIN_PWR
-			    print_max_min_stream_i(&buf_state, "buf", i, 1, (int) *(bp-1));
+			    print_max_min_stream_i(&buf_state, "buf", i, 1, dBs[i]);
 			#endif
-		}
-
-		#ifdef SHOW_MAX_MIN_DB
-            //jks
-            printf("Z%d dB_f: ", wf->zoom);
-            for (i=505; i<514; i++) {
-                printf("%d:%.3f ", i, dBs_f[i]);
-            }
-            printf("\n");
-            print_max_min_f("dB_f", dBs_f, WF_WIDTH);
+        }
+	    #ifdef SHOW_MAX_MIN_DB
             printf("Z%d dB: ", wf->zoom);
             for (i=505; i<514; i++) {
                 printf("%d:%d ", i, dBs[i]);
@@ -1292,62 +1579,288 @@ void compute_frame(int rx_chan)
             printf("\n");
             print_max_min_i("dB", dBs, WF_WIDTH);
 		#endif
-	} else {
-		// < FFT than plot
-		if (wf->new_map) {
-			//printf("< FFT: Z%d WF_C_NSAMPS %d fft_used %d plot_width_clamped %d pix_per_dB %.3f range %.0f:%.0f\n",
-			//	wf->zoom, WF_C_NSAMPS, wf->fft_used, wf->plot_width_clamped, pix_per_dB, max_dB, min_dB);
-			wf->new_map = FALSE;
-		}
-
-		for (i=0; i<wf->plot_width_clamped; i++) {
-			p = pwr[wf->wf2fft_map[i]];
-			
-			dB = 10.0 * log10f(p * wf->fft_scale[i] + 1e-30F) + wf->fft_offset;
-			if (dB > 0) dB = 0;
-			if (dB < -200.0) dB = -200.0;
-			dB--;
-			*bp++ = (u1_t) (int) dB;
-		}
-	}
+	#endif
 	
-	if (wf->flush_wf_pipe) {
-		out->x_bin_server = (wf->prev_start == -1)? wf->start : wf->prev_start;
-		out->flags_x_zoom_server = (wf->prev_zoom == -1)? wf->zoom : wf->prev_zoom;
-		wf->flush_wf_pipe--;
-		if (wf->flush_wf_pipe == 0) {
-			//jksd
-			printf("PIPE start P%d/C%d zoom P%d/C%d\n", wf->prev_start, wf->start, wf->prev_zoom, wf->zoom);
-			wf->prev_start = wf->start;
-			wf->prev_zoom = wf->zoom;
-		}
-	} else {
-		out->x_bin_server = wf->start;
-		out->flags_x_zoom_server = wf->zoom;
+	compute_frame_out(wf, buf_p);
+}
+
+void compute_frame(int inst)
+{
+    fft_t *fft = &WF_SHMEM->fft_inst[WF_SHMEM->wf_inst[inst].rx_chan];
+
+    //TaskStat2(TSTAT_INCR|TSTAT_ZERO, 0, "frm");
+
+	//NextTask("FFT1");
+	evWF(EC_EVENT, EV_WF, -1, "WF", "compute_frame: FFT start");
+	fftwf_execute(fft->hw_dft_plan);
+	evWF(EC_EVENT, EV_WF, -1, "WF", "compute_frame: FFT done");
+	//NextTask("FFT2");
+
+    compute_frame_row(inst);
+}
+
+// Batched version of compute_frame() run by the waterfall offload process with a bitmask of all the
+// instances whose frames were sampled meanwhile. The FFTs are done back-to-back first, each run of
+// consecutive fft_inst[] with one plan_many (fft_inst[] are the same distance apart), then the rows.
+void compute_frames(int mask)
+{
+    int inst, ch, n;
+    u4_t fft_mask = 0;
+
+    for (inst = 0; inst <= WF_VIRT_SRC; inst++)
+        if (mask & (1 << inst)) fft_mask |= 1 << WF_SHMEM->wf_inst[inst].rx_chan;
+
+    for (ch = 0; ch < MAX_WF_CHANS; ch += n) {
+        for (n = 0; ch+n < MAX_WF_CHANS && (fft_mask & (1 << (ch+n))); n++)
+            ;
+        if (n == 0) { n = 1; continue; }
+        fft_t *fft = &WF_SHMEM->fft_inst[ch];
+        if (n == 1)
+            fftwf_execute(fft->hw_dft_plan);
+        else
+            fftwf_execute_dft(WF_SHMEM->batch_plan[n], fft->hw_c_samps, fft->hw_fft);
+    }
+    
+    for (inst = 0; inst <= WF_VIRT_SRC; inst++)
+        if (mask & (1 << inst)) compute_frame_row(inst);
+}
+
+// Virtual waterfall client: crop and resample the latest full-span source line for this zoom/start.
+void wf_virt_frame(wf_inst_t *wf, float HZperStart)
+{
+    wf_virt_t *v = &WF_SHMEM->virt;
+    int i, b, rx_chan = wf->rx_chan;
+    
+    v->speed[rx_chan] = wf->speed;
+    v->req_ms[rx_chan] = timer_ms();
+
+    // return to c2s_waterfall() after any sleep so cmds are processed meanwhile
+    int delay = wf_frame_ms(wf) - (timer_ms() - wf->mark);
+    if (delay > 0) {
+        TaskSleepReasonMsec("wait frame", delay);
+        return;
+    }
+    
+    u4_t seq = v->seq;
+    if (seq == wf->virt_seq || v->nbins == 0) {
+        TaskSleepReasonMsec("wait virt", 10);
+        return;
+    }
+    wf->virt_seq = seq;
+    __sync_synchronize();
+
+    float *pwr = v->pwr[seq & 1];
+    int nbins = v->nbins;
+    if (nbins < 2) return;      // interpolation below needs at least two source bins
+    float bins_per_start = HZperStart / v->hz_per_bin;
+    float bins_per_px = (float) (1 << (MAX_ZOOM - wf->zoom)) * bins_per_start;
+    float x = wf->start * bins_per_start;
+
+	wf_pkt_t *out = &wf->out;
+	u1_t *buf_p = wf->compression? out->un.buf2 : out->un.buf;
+    float pwr_out[WF_WIDTH];
+
+    for (i=0; i < WF_WIDTH; i++, x += bins_per_px) {
+        float p;
+        int b0 = (int) x, b1 = (int) (x + bins_per_px);
+
+        if (b1 > b0) {
+            // one or more source bins per pixel: peak as the hardware waterfall does
+            if (b1 > nbins) b1 = nbins;
+            for (p = 0, b = b0; b < b1; b++)
+                if (pwr[b] > p) p = pwr[b];
+        } else {
+            // zoomed in past the source resolution: interpolate at the pixel center
+            float xc = x + bins_per_px/2;
+            b = (int) xc;
+            float frac = xc - b;
+            if (b >= nbins-1) b = nbins-2, frac = 1;
+            p = pwr[b] + (pwr[b+1] - pwr[b]) * frac;
+        }
+
+        pwr_out[i] = p;
+    }
+
+    simd_pwr_to_wf_u8(WF_WIDTH, pwr_out, wf->fft_scale, wf->fft_offset, buf_p);
+
+    compute_frame_out(wf, buf_p);
+    wf->frames++;
+    wf->frame_ms = timer_ms();
+    wf_send_frame(wf);
+    wf_cache_stats.misses++;
+    wf->mark = timer_ms();
+}
+
+static bool wf_cacheable(wf_inst_t *wf)
+{
+    return !wf->nb_enable[NB_CLICK] && !(wf->nb_enable[NB_BLANKER] && wf->nb_enable[NB_WF]) && !wf->flush_wf_pipe;
+}
+
+// Adjust the frame rate to the depth of the client's s2c queue. Returns true if no frame should be
+// computed this time around because the queue is nearly full.
+bool wf_backpressure(wf_inst_t *wf)
+{
+    conn_t *conn = wf->conn;
+    int depth = nbuf_queued(&conn->s2c);
+    u4_t now = timer_ms();
+    int level = wf->bp_level;
+
+    if (depth >= WF_BP_HI) {
+        if (level < WF_BP_MAX_LEVEL && now - wf->bp_ms >= (u4_t) wf_frame_ms(wf))
+            level++;
+    } else
+    if (depth <= WF_BP_LO) {
+        if (level > 0 && now - wf->bp_ms >= WF_BP_HOLD_MS)
+            level--;
+    }
+    
+    if (level != wf->bp_level) {
+        #ifdef WF_INFO
+            if (!bg) printf("WF%d backpressure depth=%d level %d => %d\n", wf->rx_chan, depth, wf->bp_level, level);
+        #endif
+        wf->bp_level = level;
+        wf->bp_ms = now;
+        wf->check_overlapped_sampling = true;
+        send_msg(conn, SM_NO_DEBUG, "MSG wf_fps_eff=%.2f", (float) wf_fps[wf->speed] / (1 << level));
+    }
+    
+    if (depth >= WF_BP_SKIP) {
+        wf_cache_stats.bp_skipped++;
+        TaskSleepReasonMsec("wf backpressure", wf_frame_ms(wf));
+        wf->mark = timer_ms();
+        return true;
+    }
+    
+    return false;
+}
+
+// Frame cache: clients with the same view (zoom, start, speed, masking, compression, averaging, hardware or virtual)
+// produce identical frames, so only the lowest numbered one computes them and the others send a copy.
+// Returns false if this client must compute its own frame.
+bool wf_cache_frame(wf_inst_t *wf)
+{
+    int ch;
+    wf_inst_t *src = NULL;
+    
+    if (!wf_cacheable(wf)) return false;
+    u4_t now = timer_ms();
+
+    // a source must have produced a frame within the last frame time, so if it goes away or
+    // changes view the next client in line takes over
+    for (ch = 0; ch < wf->rx_chan; ch++) {
+        wf_inst_t *w = &WF_SHMEM->wf_inst[ch];
+        if (w->conn == NULL || w->frames == 0 || w->computing || now - w->frame_ms > (u4_t) wf_frame_ms(w)) continue;
+        if (!wf_cacheable(w)) continue;
+        if (w->zoom != wf->zoom || w->start != wf->start || w->speed != wf->speed || w->masked != wf->masked ||
+            w->compression != wf->compression || w->avg_mode != wf->avg_mode || w->isVirt != wf->isVirt) continue;
+        src = w;
+        break;
+    }
+    
+    if (src == NULL) {
+        if (wf->cache_src != -1) {
+            wf->cache_src = -1;
+            wf->check_overlapped_sampling = true;   // hardware wf hasn't been sampled for a while
+        }
+        return false;
+    }
+    
+    // return to c2s_waterfall() after any sleep so cmds are processed meanwhile
+    int delay = wf_frame_ms(wf) - (now - wf->mark);
+    if (delay > 0) {
+        TaskSleepReasonMsec("wait frame", delay);
+        return true;
+    }
+    if (src->rx_chan == wf->cache_src && src->frames == wf->cache_frames) {
+        TaskSleepReasonMsec("wait cache", 10);
+        return true;
+    }
+    wf->cache_src = src->rx_chan;
+    wf->cache_frames = src->frames;
+    
+	wf_pkt_t *out = &wf->out;
+	out->x_bin_server = src->out.x_bin_server;
+	out->flags_x_zoom_server = src->out.flags_x_zoom_server;
+	memcpy(&out->un, &src->out.un, src->out_bytes);
+	wf->out_bytes = src->out_bytes;
+	out->seq = wf->snd_seq;
+	memcpy(wf->row, src->row, WF_WIDTH);
+	if (wf->compression == WF_COMP_DELTA) {
+	    // so the delta chain continues if this client has to compute its own frames again
+	    memcpy(wf->delta_prev, src->delta_prev, WF_WIDTH);
+	    wf->delta_seq = src->delta_seq;
+	    wf->delta_rows = src->delta_rows;
 	}
-	
-	evWF(EC_EVENT, EV_WF, -1, "WF", "compute_frame: fill out buf");
 
     if (wf->aper == AUTO)
-        aperture_auto(wf, buf_p);
+        aperture_auto(wf, wf->row);
+    wf_send_frame(wf);
+    wf_cache_stats.hits++;
+    wf->mark = timer_ms();
+    return true;
+}
 
-	ima_adpcm_state_t adpcm_wf;
-	
-	if (wf->compression) {
-		memset(out->un.adpcm_pad, out->un.buf2[0], sizeof(out->un.adpcm_pad));
-		memset(&adpcm_wf, 0, sizeof(ima_adpcm_state_t));
-		encode_ima_adpcm_u8_e8(out->un.buf, out->un.buf, ADPCM_PAD + WF_WIDTH, &adpcm_wf);
-		wf->out_bytes = (ADPCM_PAD + WF_WIDTH) * sizeof(u1_t) / 2;
-		out->flags_x_zoom_server |= WF_FLAGS_COMPRESSION;
-	} else {
-		wf->out_bytes = WF_WIDTH * sizeof(u1_t);
-	}
+// Runs hardware waterfall channel wf_virt at zoom 0 while there are virtual clients.
+void wf_virt_task(void *param)
+{
+    int rx_chan = wf_virt;
+	wf_inst_t *wf = &WF_SHMEM->wf_inst[WF_VIRT_SRC];
+    wf_virt_t *v = &WF_SHMEM->virt;
+    int ch, zm1;
 
-	// sync this waterfall line to audio packet currently going out
-	out->seq = wf->snd_seq;
-	//if (out->seq != wf->snd->seq)
-	//{ real_printf("%d ", wf->snd->seq - out->seq); fflush(stdout); }
-	//{ real_printf("ws%d,%d ", out->seq, wf->snd->seq); fflush(stdout); }
+	memset(wf, 0, sizeof(wf_inst_t));
+	wf->rx_chan = rx_chan;
+	wf->isWF = wf->isVirtSrc = true;
+    wf->snd = &snd_inst[rx_chan];
+    wf->prev_start = wf->prev_zoom = -1;
+    wf->fft_used = WF_VIRT_BINS;
+    wf->mark = timer_ms();
+
+    // full span: zoom 0, start 0 (i.e. zero NCO offset)
+    spi_set(CmdSetWFDecim, rx_chan, wf_decim(0, &zm1));
+    spi_set(CmdSetWFFreq, rx_chan, 0);
+    lprintf("WF%d: virtual waterfall source\n", rx_chan);
+
+    while (TRUE) {
+        // run at the fastest speed any client has recently asked for
+        u4_t now = timer_ms();
+        int speed = WF_SPEED_OFF;
+        for (ch = 0; ch < rx_chans; ch++) {
+            if (now - v->req_ms[ch] < WF_VIRT_IDLE_MS && v->speed[ch] > speed)
+                speed = v->speed[ch];
+        }
+        
+        if (speed == WF_SPEED_OFF) {
+            wf->speed = WF_SPEED_OFF;
+            TaskSleepReasonMsec("virt idle", 250);
+            continue;
+        }
+        
+        if (wf->speed != speed) {
+            wf->speed = speed;
+            wf->check_overlapped_sampling = true;
+        }
+        
+        // follow ADC clock corrections
+        double adc_clock = clk.adc_clock_base;
+        float samp_wait_us = WF_C_NSAMPS * (1 << zm1) / adc_clock * 1000000.0;
+        wf->chunk_wait_us = (int) ceilf(samp_wait_us / WF_SHMEM->n_chunks);
+        wf->samp_wait_ms = (int) ceilf(samp_wait_us / 1000);
+        v->hz_per_bin = adc_clock / 2 / WF_VIRT_BINS;
+        v->nbins = MIN(WF_VIRT_BINS, (int) ceil(ui_srate / v->hz_per_bin));
+        wf->fft_used_limit = v->nbins;
+
+        void sample_wf(int inst);
+        #ifdef WF_SHMEM_DISABLE
+            sample_wf(WF_VIRT_SRC);
+        #else
+            #ifdef WF_IPC_SAMPLE_WF
+                shmem_ipc_invoke(SIG_IPC_WF, WF_VIRT_SRC);      // invoke sample_wf()
+            #else
+                sample_wf(WF_VIRT_SRC);
+            #endif
+        #endif
+    }
 }
 
 void c2s_waterfall_shutdown(void *param)
@@ -38,6 +38,7 @@ Boston, MA  02110-1301, USA.
 #include "rx_sound.h"
 #include "dx.h"
 #include "non_block.h"
+#include "wf_delta.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -66,14 +67,16 @@ Boston, MA  02110-1301, USA.
 
 struct fft_t {
 	fftwf_plan hw_dft_plan;
-	fftwf_complex hw_c_samps[sizeof(fftwf_complex) * (WF_C_NSAMPS)];
-	fftwf_complex hw_fft[sizeof(fftwf_complex) * (WF_C_NFFT)];
+	fftwf_complex hw_c_samps[sizeof(fftwf_complex) * (WF_C_NSAMPS)] __attribute__ ((aligned (16)));   // SIMD aligned for the FFTW wisdom
+	fftwf_complex hw_fft[sizeof(fftwf_complex) * (WF_C_NFFT)] __attribute__ ((aligned (16)));
 };
 
 struct wf_pkt_t {
 	char id4[4];
 	u4_t x_bin_server;
 	#define WF_FLAGS_COMPRESSION    0x00010000
+	#define WF_FLAGS_HISTORY        0x00020000      // see wf_hist_send()
+	#define WF_FLAGS_DELTA          0x00040000      // see wf_delta.h
 	u4_t flags_x_zoom_server;
 	u4_t seq;
 	union {
@@ -86,6 +89,37 @@ struct wf_pkt_t {
 	} un;
 } __attribute__((packed));
 
+// Per-channel history of the rows sent, so a client can be given the last few minutes in one burst.
+// Memory mapped on first use. Only WF_HIST_FPS rows per second are kept whatever the frame rate.
+#define WF_HIST_SECS    (30*60)
+#define WF_HIST_FPS     2
+#define WF_HIST_ROWS    (WF_HIST_SECS * WF_HIST_FPS)
+#define WF_HIST_CHUNK   (48*1024)       // max bytes per history message
+
+typedef struct {
+    u4_t ms;                // timer_ms() when sent
+    u4_t start;
+    u2_t zoom;
+    u2_t bytes;             // of pkt, i.e. as sent
+    bool masked;            // computed with the masked frequencies blanked
+    int masked_seq;         // dx.masked_seq when computed
+    wf_pkt_t pkt;
+} wf_hist_row_t;
+
+typedef struct {
+    u4_t wr;                // rows written, next is row[wr % WF_HIST_ROWS]
+    u4_t last_ms;
+    wf_hist_row_t row[WF_HIST_ROWS];
+} wf_hist_t;
+
+// Frame averaging at slow speeds: spectra are sampled every WF_AVG_MS (or as fast as the hardware
+// fills the sample buffer) over the whole frame interval and combined before the dB conversion.
+#define WF_AVG_OFF      0
+#define WF_AVG_MEAN     1
+#define WF_AVG_PEAK     2
+#define WF_AVG_MIN      3
+#define WF_AVG_MS       (1000/16)
+
 enum aper_t { MAN=0, AUTO };
 enum aper_algo_t { IIR=0, MMA, EMA, OFF };
 
@@ -99,8 +133,32 @@ struct wf_inst_t {
 	u2_t wf2fft_map[WF_WIDTH];							// map is 1:1 with plot
 	int start, prev_start, zoom, prev_zoom;
 	int mark, speed, fft_used_limit;
-	bool new_map, new_map2, compression, isWF, isFFT;
+	bool new_map, new_map2, isWF, isFFT, isVirt, isVirtSrc;
+	int compression;                // WF_COMP_*
 	int flush_wf_pipe;
+	u4_t virt_seq;
+	
+	// frame cache (see wf_cache_frame())
+	bool masked, computing;
+	u1_t row[WF_WIDTH];             // uncompressed row of the last computed frame
+	u4_t frames, frame_ms;          // computed frames, time of the last one
+	int cache_src;                  // instance the last frame was copied from, -1 if computed
+	u4_t cache_frames;
+
+	// WF_COMP_DELTA state, copied along with a cached frame
+	u1_t delta_prev[WF_WIDTH];      // row as the client reconstructs it
+	u1_t delta_seq;
+	u4_t delta_rows;
+
+	// averaging (see wf_avg_frame())
+	int avg_mode;                   // WF_AVG_*
+	int avg_n;                      // spectra in avg_acc[]
+	bool avg_emit;                  // last spectrum of this frame interval, send the row
+	float avg_acc[WF_WIDTH];
+
+	// backpressure (see wf_backpressure())
+	int bp_level;                   // frame period is multiplied by 1 << bp_level
+	u4_t bp_ms;                     // time of the last level change
 
 	// NB: matches rx_noise.h which is not included here to prevent re-compile cascade
     #define NOISE_TYPES 4
@@ -126,9 +184,32 @@ struct wf_inst_t {
     int last_noise, last_signal;
 };
 
+// Virtual waterfalls (cfg.virt_wf):
+// The last hardware waterfall channel (wf_virt) is not given to a user. Instead it runs a full-span
+// zoom 0 FFT whenever there are virtual clients. Every waterfall connection without its own hardware
+// channel then gets lines cropped and resampled from this shared spectrum for its own zoom/start.
+// The source FFT has WF_C_NFFT/2 bins over the ADC span so zooms beyond z2 are interpolated.
+
+#define WF_VIRT_SRC     MAX_RX_CHANS        // wf_inst[] index of the source instance
+#define WF_VIRT_BINS    (WF_C_NFFT / WF_USING_HALF_FFT)
+#define WF_VIRT_IDLE_MS 2000                // source stops when no client has asked for this long
+
+struct wf_virt_t {
+    u4_t seq;                               // pwr[seq & 1] is the latest complete line
+    int nbins;                              // number of valid bins (up to ui_srate)
+    float hz_per_bin;
+    float pwr[2][WF_VIRT_BINS];
+
+    // per-client requests, the source runs at the fastest speed asked for
+    int speed[MAX_RX_CHANS];
+    u4_t req_ms[MAX_RX_CHANS];
+};
+
 struct wf_shmem_t {
-    wf_inst_t wf_inst[MAX_RX_CHANS];        // NB: MAX_RX_CHANS even though there may be fewer MAX_WF_CHANS
+    wf_inst_t wf_inst[MAX_RX_CHANS + 1];    // NB: MAX_RX_CHANS even though there may be fewer MAX_WF_CHANS, +1 for WF_VIRT_SRC
+    wf_virt_t virt;
     fft_t fft_inst[MAX_WF_CHANS];           // NB: MAX_WF_CHANS not MAX_RX_CHANS
+    fftwf_plan batch_plan[MAX_WF_CHANS+1];  // see compute_frames()
     float window_function[WF_C_NSAMPS];
     int n_chunks;
 };     
@@ -149,5 +230,5 @@ struct wf_shmem_t {
 
 enum wf_cmd_key_e {
     CMD_SET_ZOOM=1, CMD_SET_MAX_MIN_DB, CMD_SET_CMAP, CMD_SET_APER, CMD_SET_BAND,
-    CMD_SET_SCALE, CMD_SET_WF_SPEED, CMD_SEND_DB, CMD_EXT_BLUR
+    CMD_SET_SCALE, CMD_SET_WF_SPEED, CMD_SEND_DB, CMD_EXT_BLUR, CMD_WF_HISTORY, CMD_WF_AVG
 };
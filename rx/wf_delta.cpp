@@ -0,0 +1,105 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#include "types.h"
+#include "wf_delta.h"
+#include "rice.h"
+
+#include <string.h>
+
+#define WF_DELTA_PREDS  3
+#define WF_DELTA_MAX_K  8
+
+static inline int wf_delta_predict(int pred, int left, int up, int upleft)
+{
+    switch (pred) {
+        case WF_DELTA_LEFT: return left;
+        case WF_DELTA_UP: return up;
+        default: {
+            int mx = MAX(left, up), mn = MIN(left, up);
+            if (upleft >= mx) return mn;
+            if (upleft <= mn) return mx;
+            return left + up - upleft;
+        }
+    }
+}
+
+// round to the nearest multiple of q, ties toward zero so a constant +/-q/2 error doesn't oscillate
+static inline int wf_delta_quant(int e)
+{
+    return (e >= 0)? (e + (WF_DELTA_Q-1)/2) / WF_DELTA_Q : -((-e + (WF_DELTA_Q-1)/2) / WF_DELTA_Q);
+}
+
+int wf_delta_encode(const u1_t *row, u1_t *prev, int n, u1_t seq, bool key, u1_t *out)
+{
+    int i, pred, k;
+
+    // pick the predictor with the smallest residual magnitude (open loop estimate)
+    u4_t sum[WF_DELTA_PREDS] = {0};
+    int left = 0, upleft = 0;
+    for (i = 0; i < n; i++) {
+        int x = row[i], up = prev[i];
+        for (pred = 0; pred < WF_DELTA_PREDS; pred++)
+            sum[pred] += zigzag(wf_delta_quant(x - wf_delta_predict(pred, left, up, upleft)));
+        upleft = up; left = x;
+    }
+
+    pred = WF_DELTA_LEFT;
+    if (!key) {
+        for (i = 1; i < WF_DELTA_PREDS; i++)
+            if (sum[i] < sum[pred]) pred = i;
+    }
+
+    k = 0;
+    while (k < WF_DELTA_MAX_K && ((u4_t) n << (k+1)) <= sum[pred]) k++;
+
+    out[0] = seq;
+    out[1] = (pred << 5) | k;
+    out[2] = WF_DELTA_Q;
+    bitw_t bw = { &out[WF_DELTA_HDR], 0, 0 };
+    u1_t *end = &out[WF_DELTA_HDR + n];
+
+    // closed loop: predict from and update prev[] with what the decoder will reconstruct
+    left = upleft = 0;
+    for (i = 0; i < n && bw.p < end; i++) {
+        int up = prev[i];
+        int p = wf_delta_predict(pred, left, up, upleft);
+        int qe = wf_delta_quant(row[i] - p);
+        int r = p + qe * WF_DELTA_Q;
+        prev[i] = (r < 0)? 0 : ((r > 255)? 255 : r);
+
+        u4_t u = zigzag(qe), q = u >> k;
+        if (q < WF_DELTA_ESC) {
+            bitw_put(&bw, ((1 << q) - 1) << 1, q + 1);      // unary: q ones then a zero
+            if (k) bitw_put(&bw, u, k);
+        } else {
+            bitw_put(&bw, (1 << WF_DELTA_ESC) - 1, WF_DELTA_ESC);
+            bitw_put(&bw, u, WF_DELTA_ESC_BITS);
+        }
+        upleft = up; left = prev[i];
+    }
+    bitw_flush(&bw);
+
+    if (bw.p < end)
+        return bw.p - out;
+
+    // no gain: send the row as is
+    out[1] = WF_DELTA_RAW << 5;
+    memcpy(&out[WF_DELTA_HDR], row, n);
+    memcpy(prev, row, n);
+    return WF_DELTA_HDR + n;
+}
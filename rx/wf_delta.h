@@ -0,0 +1,56 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#pragma once
+
+#include "types.h"
+
+// Waterfall row compression predicting each pixel from the previous row and/or its left neighbor.
+// Requested by the client with "SET wf_comp=2" (WF_COMP_DELTA) and signaled by WF_FLAGS_DELTA.
+//
+//  u1_t seq                    incremented every row
+//  u1_t (pred << 5) | k
+//  u1_t q                      quantizer step, reconstruction error is at most q/2 (1 dB)
+//      pred 0..2: left, up (previous row), LOCO-I median of left/up/up-left
+//                 quantized residuals zigzagged and Rice coded with parameter k as in iq_rice.h,
+//                 MSB first, zero-padded to a byte boundary
+//      pred 3: no gain possible, the row follows as is
+//
+// Both sides predict from the reconstructed previous row, so the decoder can only use a
+// pred 1 or 2 row if it decoded the row with seq-1. Every WF_DELTA_KEY_ROWS rows only pred 0
+// or 3 is used so a client recovers from a dropped packet or joining mid-stream.
+
+#define WF_COMP_NONE        0
+#define WF_COMP_ADPCM       1
+#define WF_COMP_DELTA       2
+
+#define WF_DELTA_LEFT       0
+#define WF_DELTA_UP         1
+#define WF_DELTA_MED        2
+#define WF_DELTA_RAW        3
+
+#define WF_DELTA_Q          3
+#define WF_DELTA_ESC        16
+#define WF_DELTA_ESC_BITS   9
+#define WF_DELTA_KEY_ROWS   32
+
+#define WF_DELTA_HDR        3
+#define WF_DELTA_SLOP       4       // out[] must have room for this many bytes past WF_DELTA_HDR + n
+
+// Encodes row[n] into out[], returns the number of bytes.
+// prev[n] is the previous reconstructed row and is updated to this one.
+int wf_delta_encode(const u1_t *row, u1_t *prev, int n, u1_t seq, bool key, u1_t *out);
@@ -31,6 +31,8 @@
 #include "peri.h"
 #include "spi.h"
 #include "shmem.h"
+#include "iq_replay.h"
+#include "timer_heap.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -181,7 +183,8 @@ struct TASK {
 	u4_t saved_priority;
 
 	TASK *interrupted_task;
-	s64_t deadline;
+	timer_node_t timer;     // timer.deadline > 0 when in task_timers
+	u64_t edf_deadline;
 	u4_t *wakeup_test;
 	u4_t run, cmds;
 	#define N_REASON 64
@@ -214,6 +217,8 @@ static int max_task;
 static TASK Tasks[MAX_TASKS], *cur_task, *last_task_run, *busy_helper_task, *itask;
 static ctx_t ctx[MAX_TASKS]; 
 static TaskQ_t TaskQ[NUM_PRIORITY];
+static timer_heap_t task_timers;
+static timer_node_t *task_timers_node[MAX_TASKS];
 static u64_t last_dump;
 static u4_t idle_us;
 static u4_t task_all_hist[N_HIST];
@@ -389,7 +394,7 @@ void TaskDump(u4_t flags)
 	ct->flags |= CTF_NO_CHARGE;     // don't charge the current task with the time to print all this
 
 	lfprintf(printf_type, "\n");
-	lfprintf(printf_type, "TASKS: used %d/%d, spi_retry %d, spi_delay %d\n", tused, MAX_TASKS, spi.retry, spi_delay);
+	lfprintf(printf_type, "TASKS: used %d/%d, timers %d, spi_retry %d, spi_delay %d\n", tused, MAX_TASKS, task_timers.n, spi.retry, spi_delay);
 
 	if (flags & TDUMP_LOG)
 	//lfprintf(printf_type, "Tttt Pd# cccccccc xxx.xxx xxxxx.xxx xxx.x%% xxxxxxx xxxxx xxxxx xxx xxxxx xxx xxxx.xxxu xxx%%t cN\n");
@@ -408,8 +413,8 @@ void TaskDump(u4_t flags)
 
 		float deadline=0;
 		char dunit = ' ';
-		if (t->deadline > 0) {
-			deadline = (t->deadline > now_us)? (float) (t->deadline - now_us) : 9999999;
+		if (t->timer.deadline > 0) {
+			deadline = (t->timer.deadline > now_us)? (float) (t->timer.deadline - now_us) : 9999999;
 			deadline /= 1e3;    // mmm.uuu msec
 			dunit = 'm';
 			if (deadline >= 10000) {
@@ -574,6 +579,7 @@ static void task_init(TASK *t, int id, funcP_t funcP, void *param, const char *n
 	t->minrun_start_us = timer_us64();
 	t->valid = TRUE;
 	t->tll.t = t;
+	t->timer.param = t;
 	
     #ifdef LOCK_CHECK_HANG
         t->lock_marker = ' ';
@@ -760,6 +766,8 @@ void TaskInit()
 	kiwi_server_pid = getpid();
 	printf("TASK MAX_TASKS %d, stack memory %.1f MB, stack size %d k so(u64_t)\n", MAX_TASKS, ((float) sizeof(task_stacks))/M, STACK_SIZE_U64_T/K);
 
+	timer_heap_init(&task_timers, task_timers_node, MAX_TASKS);
+
 	t = Tasks;
 	cur_task = t;
 
@@ -864,7 +872,9 @@ void TaskPollForInterrupt(ipoll_from_e from)
 		return;
 	}
 
-	if (GPIO_READ_BIT(SND_INTR) && itask->sleeping) {
+	bool intr = iq_replay? iq_replay_intr() : GPIO_READ_BIT(SND_INTR);
+
+	if (intr && itask->sleeping) {
 		evNT(EC_TRIG1, EV_NEXTTASK, -1, "PollIntr", evprintf("CALLED_FROM_%s TO INTERRUPT TASK <===========================",
 			poll_from[from]));
 
@@ -900,6 +910,7 @@ void TaskRemove(int id)
 {
     TASK *t = Tasks + id;
     TdeQ(t);
+    timer_heap_cancel(&task_timers, &t->timer);
     t->stopped = TRUE;
 	run[t->id].r = 0;
     t->valid = FALSE;
@@ -1090,6 +1101,16 @@ void _NextTask(const char *where, u4_t param, u_int64_t pc)
             }
         #endif
     
+        // wakeup all tasks whose sleep deadline has expired, earliest first
+        timer_node_t *tn;
+        while ((tn = timer_heap_expired(&task_timers, now_us)) != NULL) {
+            TASK *tp = (TASK *) tn->param;
+            evNT(EC_EVENT, EV_NEXTTASK, -1, "NextTask", evprintf("deadline expired %s, Qrunnable %d", task_s(tp), tp->tq->runnable));
+            tp->wakeup_test = NULL;
+            RUNNABLE_YES(tp);
+            tp->wake_param = TO_VOID_PARAM(tp->last_run_time);      // return how long task ran last time
+        }
+    
    		 // search task queues
 		for (p = HIGHEST_PRIORITY; p >= LOWEST_PRIORITY; p--) {
 			head = &TaskQ[p];
@@ -1104,6 +1125,7 @@ void _NextTask(const char *where, u4_t param, u_int64_t pc)
 			#else
 				int t_runnable = 0;
 				TaskLL_t *tll;
+				TASK *edf_t = NULL;
 				
                 #ifdef LOCK_TEST_HANG
                     if (lock_test_hang && p == DATAPUMP_PRIORITY) {
@@ -1127,30 +1149,25 @@ void _NextTask(const char *where, u4_t param, u_int64_t pc)
 				        if (lock_panic) lprintf("P%d: %s %s\n", p, task_s(tp), tp->stopped? "STOP":"RUN");
                     #endif
 					
-                    bool wake = false;
-                    
-                    if (tp->deadline > 0) {
-                        if (tp->deadline < now_us) {
-                            evNT(EC_EVENT, EV_NEXTTASK, -1, "NextTask", evprintf("deadline expired %s, Qrunnable %d", task_s(tp), tp->tq->runnable));
-                            tp->deadline = 0;
-                            wake = true;
-                        }
-                    } else
+                    // expired deadlines were handled above via task_timers
                     if (tp->wakeup_test != NULL) {
                         if (*tp->wakeup_test != 0) {
                             evNT(EC_EVENT, EV_NEXTTASK, -1, "NextTask", evprintf("wakeup_test completed %s, Qrunnable %d", task_s(tp), tp->tq->runnable));
                             tp->wakeup_test = NULL;
-                            wake = true;
+                            timer_heap_cancel(&task_timers, &tp->timer);
+                            RUNNABLE_YES(tp);
+                            tp->wake_param = TO_VOID_PARAM(tp->last_run_time);      // return how long task ran last time
                         }
                     }
                     
-                    if (wake) {
-                        RUNNABLE_YES(tp);
-                        tp->wake_param = TO_VOID_PARAM(tp->last_run_time);      // return how long task ran last time
-                    }
-                    
-					if (!tp->stopped)
+					if (!tp->stopped) {
 						t_runnable++;
+						
+						if (tp->edf_deadline && !tp->long_run && !(tp == ct && no_run_same) &&
+						    !(LINUX_CHILD_PROCESS() && !(tp->flags & CTF_FORK_CHILD)) &&
+						    (edf_t == NULL || tp->edf_deadline < edf_t->edf_deadline))
+						    edf_t = tp;
+					}
 					
 					#ifdef LOCK_CHECK_HANG
                         if (lock_panic && tp == busy_helper_task)
@@ -1173,6 +1190,17 @@ void _NextTask(const char *where, u4_t param, u_int64_t pc)
 			}
 			
 			t = NULL;
+			
+			#ifndef USE_RUNNABLE
+                #ifdef LOCK_CHECK_HANG
+                    if (lock_panic) edf_t = NULL;
+                #endif
+                if (edf_t) {
+                    t = edf_t;
+                    break;
+                }
+			#endif
+			
 			if (t_runnable) {
 				// at this point the p/head queue should have at least one runnable task
 				TaskLL_t *wrap = (head->last_run && head->last_run->next)? head->last_run->next : head->tll.next;
@@ -1287,7 +1315,7 @@ void _NextTask(const char *where, u4_t param, u_int64_t pc)
         #endif
     } while (p < LOWEST_PRIORITY);		// if no eligible tasks keep looking
     
-	if (!need_hardware || update_in_progress || sd_copy_in_progress || LINUX_CHILD_PROCESS()) {
+	if ((!need_hardware && !iq_replay) || update_in_progress || sd_copy_in_progress || LINUX_CHILD_PROCESS()) {
 		kiwi_usleep(100000);		// pause so we don't hog the machine
 	}
 
@@ -1374,15 +1402,17 @@ static void taskSleepSetup(TASK *t, const char *reason, int usec, u4_t *wakeup_t
 	// usec == 0 means sleep until someone does TaskWakeup() on us
 	// usec > 0 is microseconds time in future (added to current time)
 	
+	// wakeup_test != NULL also wakes up when *wakeup_test != 0 (before the deadline if usec > 0)
+	
 	if (usec > 0) {
-    	t->deadline = timer_us64() + usec;
-        t->wakeup_test = NULL;
-    	sprintf(t->reason, "(%.3f msec) ", (float) usec/1000.0);
+    	timer_heap_set(&task_timers, &t->timer, timer_us64() + usec);
+        t->wakeup_test = wakeup_test;
+    	sprintf(t->reason, "(%.3f msec%s) ", (float) usec/1000.0, wakeup_test? " or test" : "");
 		evNT(EC_EVENT, EV_NEXTTASK, -1, "TaskSleep", evprintf("sleeping usec %d %s Qrunnable %d", usec, task_ls(t), t->tq->runnable));
 	} else {
 	    assert(usec == 0);
         t->wakeup_test = wakeup_test;
-		t->deadline = 0;
+		timer_heap_cancel(&task_timers, &t->timer);
 		if (wakeup_test != NULL) {
             sprintf(t->reason, "(test %p) ", wakeup_test);
             evNT(EC_EVENT, EV_NEXTTASK, -1, "TaskSleep", evprintf("sleeping test %p %s Qrunnable %d", wakeup_test, task_ls(t), t->tq->runnable));
@@ -1417,7 +1447,8 @@ void *_TaskSleep(const char *reason, int usec, u4_t *wakeup_test)
     
 	evNT(EC_EVENT, EV_NEXTTASK, -1, "TaskSleep", evprintf("woke %s Qrunnable %d", task_ls(t), t->tq->runnable));
 
-    t->deadline = 0;
+    timer_heap_cancel(&task_timers, &t->timer);
+    t->wakeup_test = NULL;      // if woken some other way
     t->stopped = FALSE;
 	run[t->id].r = 1;
     t->sleeping = FALSE;
@@ -1452,16 +1483,16 @@ void TaskWakeup(int id, u4_t flags, void *wake_param)
     
     if (!t->valid) return;
 
-    if ((flags & TWF_CANCEL_DEADLINE) == 0 && t->deadline > 0) {
+    if ((flags & TWF_CANCEL_DEADLINE) == 0 && t->timer.deadline > 0) {
         // FIXME: remove at some point
         // This is a hack for the benefit of "-rx 0" measurements where we don't want the
         // TaskSleepMsec(1000) in the audio task to cause a task switch while sleeping
         // because it's being woken up all the time.
-        evNT(EC_EVENT, EV_NEXTTASK, -1, "TaskWakeup", evprintf("%s still deadline of %08x|%08x", task_ls(t), PRINTF_U64_ARG(t->deadline)));
+        evNT(EC_EVENT, EV_NEXTTASK, -1, "TaskWakeup", evprintf("%s still deadline of %08x|%08x", task_ls(t), PRINTF_U64_ARG(t->timer.deadline)));
         return;		// don't interrupt a task sleeping on a time interval
     }
 
-    t->deadline = 0;	// cancel any outstanding deadline
+    timer_heap_cancel(&task_timers, &t->timer);	// cancel any outstanding deadline
 
 	if (!t->sleeping) {
 		assert(!t->stopped || (t->stopped && t->lock.wait));
@@ -1552,6 +1583,11 @@ void TaskSetUserParam(void *param)
     cur_task->user_param = param;
 }
 
+void TaskDeadlineEDF(u64_t deadline_us)
+{
+    cur_task->edf_deadline = deadline_us;
+}
+
 
 // Locks: critical section "first come, first served"
 //
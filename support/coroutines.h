@@ -100,6 +100,7 @@ int _CreateTask(funcP_t entry, const char *name, void *param, int priority, u4_t
 
 // usec == 0 means sleep until someone does TaskWakeup() on us
 // usec > 0 is microseconds time in future (added to current time)
+// wakeup_test != NULL also wakes up as soon as *wakeup_test != 0
 void *_TaskSleep(const char *reason, int usec, u4_t *wakeup_test=NULL);
 #define TaskSleep()                 _TaskSleep("TaskSleep", 0)
 #define TaskSleepUsec(us)           _TaskSleep("TaskSleep", us)
@@ -110,6 +111,7 @@ void *_TaskSleep(const char *reason, int usec, u4_t *wakeup_test=NULL);
 #define TaskSleepReasonMsec(r, ms)  _TaskSleep(r, MSEC_TO_USEC(ms))
 #define TaskSleepReasonSec(r, s)    _TaskSleep(r, SEC_TO_USEC(s))
 #define TaskSleepWakeupTest(r, wu)  _TaskSleep(r, 0, wu)
+#define TaskSleepWakeupTestUsec(r, us, wu)  _TaskSleep(r, us, wu)
 
 void TaskSleepID(int id, int usec);
 
@@ -129,7 +131,7 @@ typedef enum {
 
 extern bool itask_run;
 void TaskPollForInterrupt(ipoll_from_e from);
-#define TaskFastIntr(s)			if (GPIO_READ_BIT(SND_INTR)) TaskPollForInterrupt(CALLED_FROM_FASTINTR);
+#define TaskFastIntr(s)			if (iq_replay || GPIO_READ_BIT(SND_INTR)) TaskPollForInterrupt(CALLED_FROM_FASTINTR);
 
 void TaskRemove(int id);
 void TaskMinRun(u4_t minrun_us);
@@ -146,6 +148,11 @@ u4_t TaskID();
 void *TaskGetUserParam();
 void TaskSetUserParam(void *param);
 
+// Earliest-deadline-first: among the runnable tasks of a priority that have set a deadline
+// the one with the earliest runs first, ahead of any round robin tasks of that priority.
+// deadline_us == 0 returns the current task to round robin.
+void TaskDeadlineEDF(u64_t deadline_us);
+
 // don't collide with PRINTF_FLAGS
 #define	TDUMP_PRINTF    0x00ff
 #define	TDUMP_REG       0x0000
@@ -0,0 +1,151 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#include "types.h"
+#include "config.h"
+#include "kiwi.h"
+#include "misc.h"
+#include "timer.h"
+#include "fftw_wisdom.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define FFTW_BENCH_ITER     200
+
+static struct {
+    bool init;
+    unsigned rigor;
+    const char *rigor_s;
+} wisdom;
+
+void fftw_wisdom_init()
+{
+    struct stat st;
+    bool patient = (stat(DIR_CFG "/opt.fftw_patient", &st) == 0);
+    wisdom.rigor = patient? FFTW_PATIENT : FFTW_MEASURE;
+    wisdom.rigor_s = patient? "PATIENT" : "MEASURE";
+
+    if (fftwf_import_wisdom_from_filename(FFTW_WISDOM_FILE))
+        lprintf("FFTW: wisdom imported from %s\n", FFTW_WISDOM_FILE);
+    else
+        lprintf("FFTW: no wisdom in %s, FFTs will be %s planned on first use\n", FFTW_WISDOM_FILE, wisdom.rigor_s);
+
+    wisdom.init = true;
+}
+
+static float fftw_wisdom_exec_us(fftwf_plan plan)
+{
+    u64_t start = timer_us64();
+    for (int i = 0; i < FFTW_BENCH_ITER; i++)
+        fftwf_execute(plan);
+    return (float) (timer_us64() - start) / FFTW_BENCH_ITER;
+}
+
+static fftwf_plan fftw_wisdom_plan(int n, int howmany, fftwf_complex *in, fftwf_complex *out, int dist, int sign, unsigned flags)
+{
+    if (howmany == 1)
+        return fftwf_plan_dft_1d(n, in, out, sign, flags);
+    return fftwf_plan_many_dft(1, &n, howmany, in, NULL, 1, dist, out, NULL, 1, dist, sign, flags);
+}
+
+// plan on scratch buffers with the same layout (in-place/out-of-place, batch distance) as the caller
+static void fftw_wisdom_measure(int n, int howmany, int dist, ptrdiff_t out_off, bool in_place, int sign)
+{
+    int i;
+    fftwf_complex *in, *out, *out_alloc = NULL;
+    const char *layout = in_place? "in-place" : "out-of-place";
+    const char *dir = (sign == FFTW_FORWARD)? "fwd" : "rev";
+    char what[32];
+    if (howmany == 1)
+        snprintf(what, sizeof(what), "%d", n);
+    else
+        snprintf(what, sizeof(what), "%dx%d", howmany, n);
+
+    if (howmany == 1) {
+        in = (fftwf_complex *) fftwf_malloc(sizeof(fftwf_complex) * n);
+        out = in_place? in : (out_alloc = (fftwf_complex *) fftwf_malloc(sizeof(fftwf_complex) * n));
+    } else {
+        // out[] stays at the same offset from in[] within each dist
+        int len = (howmany-1) * dist + out_off + n;
+        in = (fftwf_complex *) fftwf_malloc(sizeof(fftwf_complex) * len);
+        memset(in, 0, sizeof(fftwf_complex) * len);
+        out = in + out_off;
+    }
+
+    // already have wisdom for aligned buffers (caller's aren't aligned)
+    fftwf_plan plan = fftw_wisdom_plan(n, howmany, in, out, dist, sign, wisdom.rigor | FFTW_WISDOM_ONLY);
+    if (plan) {
+        fftwf_destroy_plan(plan);
+    } else {
+        lprintf("FFTW: %s planning %s %s %s..\n", wisdom.rigor_s, what, dir, layout);
+        u4_t plan_ms = timer_ms();
+        plan = fftw_wisdom_plan(n, howmany, in, out, dist, sign, wisdom.rigor);
+        plan_ms = timer_ms() - plan_ms;
+        fftwf_plan est = fftw_wisdom_plan(n, howmany, in, out, dist, sign, FFTW_ESTIMATE);
+
+        for (i = 0; i < n; i++) {
+            in[i][0] = (float) ((i * 7) % 13) / 13.0f;
+            in[i][1] = (float) ((i * 5) % 11) / 11.0f;
+        }
+        float est_us = fftw_wisdom_exec_us(est);
+        float rigor_us = fftw_wisdom_exec_us(plan);
+        lprintf("FFTW: %s %s %s: ESTIMATE %.1f us, %s %.1f us (x%.2f), planned in %d ms\n",
+            what, dir, layout, est_us, wisdom.rigor_s, rigor_us, est_us / rigor_us, plan_ms);
+
+        fftwf_destroy_plan(est);
+        fftwf_destroy_plan(plan);
+
+        if (!fftwf_export_wisdom_to_filename(FFTW_WISDOM_FILE))
+            lprintf("FFTW: couldn't save wisdom to %s\n", FFTW_WISDOM_FILE);
+    }
+
+    if (out_alloc) fftwf_free(out_alloc);
+    fftwf_free(in);
+}
+
+static fftwf_plan fftw_wisdom_plan_rigor(int n, int howmany, fftwf_complex *in, fftwf_complex *out, int dist, int sign, unsigned flags)
+{
+    fftwf_plan plan;
+
+    if (!wisdom.init)
+        return fftw_wisdom_plan(n, howmany, in, out, dist, sign, flags);
+
+    // FFTW_WISDOM_ONLY never overwrites in[] and out[]
+    if ((plan = fftw_wisdom_plan(n, howmany, in, out, dist, sign, wisdom.rigor | FFTW_WISDOM_ONLY)) != NULL)
+        return plan;
+
+    fftw_wisdom_measure(n, howmany, dist, out - in, in == out, sign);
+
+    if ((plan = fftw_wisdom_plan(n, howmany, in, out, dist, sign, wisdom.rigor | FFTW_WISDOM_ONLY)) != NULL)
+        return plan;
+
+    lprintf("FFTW: no wisdom for %dx%d at %p/%p (alignment?), using fallback flags\n", howmany, n, in, out);
+    return fftw_wisdom_plan(n, howmany, in, out, dist, sign, flags);
+}
+
+fftwf_plan fftw_wisdom_plan_dft_1d(int n, fftwf_complex *in, fftwf_complex *out, int sign, unsigned flags)
+{
+    return fftw_wisdom_plan_rigor(n, 1, in, out, 0, sign, flags);
+}
+
+fftwf_plan fftw_wisdom_plan_many_dft(int n, int howmany, fftwf_complex *in, fftwf_complex *out, int dist, int sign, unsigned flags)
+{
+    assert(out >= in && out - in < dist);
+    return fftw_wisdom_plan_rigor(n, howmany, in, out, dist, sign, flags);
+}
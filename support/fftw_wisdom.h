@@ -0,0 +1,52 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#pragma once
+
+#include "types.h"
+
+#include <fftw3.h>
+
+// The hot FFTs (waterfall, passband FIR, GPS search, WSPR) are planned with FFTW_MEASURE the first
+// time each size is used on a platform and the wisdom saved to FFTW_WISDOM_FILE. After that the
+// measured plans are made from the imported wisdom and cost no planning time.
+// Each first-time plan logs ESTIMATE versus MEASURE execution time.
+//
+// touch DIR_CFG/opt.fftw_patient to plan with FFTW_PATIENT instead (takes much longer),
+// delete FFTW_WISDOM_FILE to plan again.
+
+#if defined(CPU_AM5729)
+    #define FFTW_WISDOM_CPU "am5729"
+#elif defined(CPU_AM3359)
+    #define FFTW_WISDOM_CPU "am3359"
+#else
+    #define FFTW_WISDOM_CPU "other"
+#endif
+
+#define FFTW_WISDOM_FILE    DIR_CFG "/fftwf.wisdom." FFTW_WISDOM_CPU
+
+void fftw_wisdom_init();
+
+// Drop-in replacement for fftwf_plan_dft_1d().
+// Measuring is done on scratch buffers so in[] and out[] are never overwritten.
+// flags are only used if there is no wisdom for in[] and out[] (e.g. they aren't SIMD aligned)
+// or before fftw_wisdom_init().
+fftwf_plan fftw_wisdom_plan_dft_1d(int n, fftwf_complex *in, fftwf_complex *out, int sign, unsigned flags);
+
+// Same for a batch of howmany n-point FFTs, the k-th from in[k*dist..] to out[k*dist..].
+// out[] must be in[] or follow it within dist, e.g. both members of an array of structs.
+fftwf_plan fftw_wisdom_plan_many_dft(int n, int howmany, fftwf_complex *in, fftwf_complex *out, int dist, int sign, unsigned flags);
@@ -0,0 +1,95 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#include "types.h"
+#include "config.h"
+#include "kiwi.h"
+#include "timer.h"
+#include "str.h"
+#include "lat_hist.h"
+#include "worker.h"
+
+#include <string.h>
+
+lat_stats_t lat_stats;
+
+static const char *lat_rx_s[LAT_RX_N] = { "qdepth", "fir", "agc", "demod", "encode", "s2c" };
+
+// lowest value that goes in bucket idx
+static u4_t lat_bucket_lo(int idx)
+{
+    if (idx < LAT_SUB) return idx;
+    int e = (idx >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    return (u4_t) (LAT_SUB + (idx & (LAT_SUB - 1))) << (e - LAT_SUB_BITS);
+}
+
+u4_t lat_hist_percentile(lat_hist_t *h, float pct)
+{
+    if (h->n == 0) return 0;
+    u4_t target = (u4_t) ((float) h->n * pct / 100.0f);
+    u4_t cnt = 0;
+    for (int i = 0; i < LAT_NBUCKETS; i++) {
+        cnt += h->b[i];
+        if (cnt > target) return MIN(lat_bucket_lo(i), h->max);
+    }
+    return h->max;
+}
+
+void lat_reset()
+{
+    memset(&lat_stats, 0, sizeof(lat_stats));
+    memset(worker_stats.jobs, 0, sizeof(worker_stats.jobs));
+    worker_stats.inline_jobs = 0;
+}
+
+// {"n":, "avg":, "p50":, "p90":, "p99":, "max":, "b":[[lo, count], ...]} with only the non-empty buckets
+static kstr_t *lat_hist_json(kstr_t *sb, lat_hist_t *h)
+{
+    sb = kstr_asprintf(sb, "{\"n\":%u,\"avg\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u,\"b\":[",
+        h->n, h->n? (u4_t) (h->sum / h->n) : 0,
+        lat_hist_percentile(h, 50), lat_hist_percentile(h, 90), lat_hist_percentile(h, 99), h->max);
+    
+    bool first = true;
+    for (int i = 0; i < LAT_NBUCKETS; i++) {
+        if (h->b[i] == 0) continue;
+        sb = kstr_asprintf(sb, "%s[%u,%u]", first? "" : ",", lat_bucket_lo(i), h->b[i]);
+        first = false;
+    }
+    return kstr_cat(sb, "]}");
+}
+
+kstr_t *lat_json()
+{
+    kstr_t *sb = kstr_asprintf(NULL, "{\"uptime\":%u,\"units\":\"usec\",\"dpump\":", timer_sec());
+    sb = lat_hist_json(sb, &lat_stats.dpump);
+    sb = kstr_cat(sb, ",\"rx\":[");
+    
+    for (int ch = 0; ch < rx_chans; ch++) {
+        sb = kstr_asprintf(sb, "%s{\"ch\":%d", ch? "," : "", ch);
+        for (int s = 0; s < LAT_RX_N; s++) {
+            sb = kstr_asprintf(sb, ",\"%s\":", lat_rx_s[s]);
+            sb = lat_hist_json(sb, &lat_stats.rx[ch][s]);
+        }
+        sb = kstr_cat(sb, "}");
+    }
+    
+    // DSP jobs run by each worker thread, and those run inline on the task when there are no workers
+    sb = kstr_asprintf(sb, "],\"workers\":{\"n\":%d,\"inline\":%u,\"jobs\":[", worker_stats.nworkers, worker_stats.inline_jobs);
+    for (int i = 0; i < worker_stats.nworkers; i++)
+        sb = kstr_asprintf(sb, "%s%u", i? "," : "", worker_stats.jobs[i]);
+    return kstr_cat(sb, "]}}\n");
+}
@@ -0,0 +1,82 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#pragma once
+
+#include "types.h"
+#include "config.h"
+#include "str.h"
+
+// Always-on latency histograms for the audio pipeline, returned as JSON by the "/latency" AJAX request
+// together with the worker thread job counts (worker_stats).
+// HDR style: each power-of-2 octave is split into LAT_SUB linear buckets, so a recorded value
+// is known to within 1/LAT_SUB (12.5%) over the whole range at the cost of one clz per sample.
+
+#define LAT_SUB_BITS    3
+#define LAT_SUB         (1 << LAT_SUB_BITS)
+#define LAT_MAX_EXP     26      // ~67 sec, larger values go in the last bucket
+#define LAT_NBUCKETS    (((LAT_MAX_EXP - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + LAT_SUB)
+
+typedef struct {
+    u4_t n, max;
+    u64_t sum;
+    u4_t b[LAT_NBUCKETS];
+} lat_hist_t;
+
+// per-channel stages (usec except where noted)
+typedef enum {
+    LAT_QDEPTH,     // rx_dpump_t.in_ring depth seen by c2s_sound (buffers)
+    LAT_FIR,        // NB pre-filter and passband FIR
+    LAT_AGC,
+    LAT_DEMOD,      // demodulator and post-AGC processing (NR etc.)
+    LAT_ENCODE,     // packet formatting, compression
+    LAT_S2C,        // time in conn_t.s2c queue until written to the websocket
+    LAT_RX_N
+} lat_rx_e;
+
+typedef struct {
+    lat_hist_t dpump;       // data pump snd_service() time
+    lat_hist_t rx[MAX_RX_CHANS][LAT_RX_N];
+} lat_stats_t;
+
+extern lat_stats_t lat_stats;
+
+static inline int lat_bucket(u4_t v)
+{
+    if (v < LAT_SUB) return v;
+    int e = 31 - __builtin_clz(v);
+    int idx = ((e - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + ((v >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+    return (idx < LAT_NBUCKETS)? idx : (LAT_NBUCKETS - 1);
+}
+
+static inline void lat_hist_add(lat_hist_t *h, u4_t v)
+{
+    h->n++;
+    h->sum += v;
+    if (v > h->max) h->max = v;
+    h->b[lat_bucket(v)]++;
+}
+
+static inline void lat_rx(int rx_chan, lat_rx_e stage, u4_t v)
+{
+    if (rx_chan >= 0 && rx_chan < MAX_RX_CHANS)
+        lat_hist_add(&lat_stats.rx[rx_chan][stage], v);
+}
+
+u4_t lat_hist_percentile(lat_hist_t *h, float pct);
+void lat_reset();
+kstr_t *lat_json();
@@ -110,6 +110,48 @@ static void shmem_child_sig_handler(int signo)
     assert(sigismember(&oldmask, ipc->child_sig) == 0); \
 }
 
+// Clear request before done so the child, scanning request > done, never sees the slot as pending again.
+static void shmem_ipc_clear(shmem_ipc_t *ipc, int which)
+{
+    ipc->request[which] = 0;
+    __sync_synchronize();
+    ipc->done[which] = 0;
+}
+
+static u4_t shmem_ipc_pending(shmem_ipc_t *ipc)
+{
+    u4_t mask = 0;
+    for (int i=0; i <= ipc->which_hiwat; i++)
+        if (ipc->request[i] > ipc->done[i]) mask |= 1 << i;
+    return mask;
+}
+
+// Keep calling func() with everything pending, including requests made meanwhile, until there
+// is nothing left. While busy is set shmem_ipc_invoke() doesn't signal, so check again after
+// clearing it for a request that was made just before.
+static void shmem_child_batch(shmem_ipc_t *ipc)
+{
+    while (1) {
+        ipc->busy = 1;
+        __sync_synchronize();
+        u4_t mask = shmem_ipc_pending(ipc);
+
+        if (mask == 0) {
+            ipc->busy = 0;
+            __sync_synchronize();
+            if (shmem_ipc_pending(ipc) == 0) return;
+            continue;
+        }
+
+        ipc->request_func[0]++;
+        ipc->func(mask);
+        ipc->request_func[1]++;
+        __sync_synchronize();       // results visible before done
+        for (int i=0; i <= ipc->which_hiwat; i++)
+            if (mask & (1 << i)) ipc->done[i] = 1;
+    }
+}
+
 static void shmem_child_task(void *param)
 {
     shmem_ipc_t *ipc = (shmem_ipc_t *) FROM_VOID_PARAM(param);
@@ -140,6 +182,9 @@ static void shmem_child_task(void *param)
         }
 
         //SIG_CHECK(ipc->child_sig, 1);
+        if (ipc->batch)
+            shmem_child_batch(ipc);
+        else
         for (int i=0; i <= ipc->which_hiwat; i++) {
             if (ipc->request[i] > ipc->done[i]) {
                 //real_printf("CHILD shmem_child_sig_handler func(%d)..\n", i);
@@ -183,7 +228,9 @@ void shmem_ipc_invoke(int signal, int which, int wait)
     ipc->request_tx++;
     ipc->request[which] = 1;
 
-    kill(ipc->child_pid, ipc->child_sig);
+    __sync_synchronize();
+    if (!ipc->batch || !ipc->busy)
+        kill(ipc->child_pid, ipc->child_sig);
     if (wait == NO_WAIT) return;
 
     // NB: race between signaling child above and having it finish and issuing wakeup before we sleep below.
@@ -206,7 +253,7 @@ void shmem_ipc_invoke(int signal, int which, int wait)
     }
 
     //real_printf("PARENT ..shmem_ipc_invoke\n");
-    ipc->request[which] = ipc->done[which] = 0;
+    shmem_ipc_clear(ipc, which);
 }
 
 int shmem_ipc_poll(int signal, int poll_msec, int which)
@@ -215,11 +262,11 @@ int shmem_ipc_poll(int signal, int poll_msec, int which)
     assert(which < N_SHMEM_WHICH);
     TaskSleepReasonMsec("shmem_ipc_poll", poll_msec);
     int done = ipc->done[which];
-    if (done) ipc->done[which] = ipc->request[which] = 0;
+    if (done) shmem_ipc_clear(ipc, which);
     return done;
 }
 
-void shmem_ipc_setup(const char *pname, int signal, funcPI_t func)
+void shmem_ipc_setup(const char *pname, int signal, funcPI_t func, bool batch)
 {
     assert(!TaskIsChild());
     shmem_ipc_t *ipc = &shmem->ipc[SIG2IPC(signal)];
@@ -227,6 +274,7 @@ void shmem_ipc_setup(const char *pname, int signal, funcPI_t func)
     kiwi_strncpy(ipc->pname, pname, N_SHMEM_PNAME);
     ipc->tid = TaskID();
     ipc->func = func;
+    ipc->batch = batch;
     ipc->child_sig = signal;
     ipc->parent_pid = getpid();
     ipc->child_pid = child_task(ipc->pname, shmem_child_task, NO_WAIT, TO_VOID_PARAM(ipc));
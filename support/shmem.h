@@ -89,6 +89,8 @@ typedef struct {
     #define N_SHMEM_WHICH 32
     u4_t request[N_SHMEM_WHICH], done[N_SHMEM_WHICH];
     u4_t request_tx, request_rx, request_func[2];
+    bool batch;                 // func called once with a bitmask of all the pending which
+    volatile int busy;          // batch child is running requests, needn't be signaled
 } shmem_ipc_t;
 
 typedef struct {
@@ -143,4 +145,4 @@ void shmem_init();
 void sig_arm(int signal, funcPI_t handler, int flags=0);
 void shmem_ipc_invoke(int signal, int which=0, int wait=1);
 int shmem_ipc_poll(int signal, int poll_msec, int which=0);
-void shmem_ipc_setup(const char *pname, int signal, funcPI_t func);
+void shmem_ipc_setup(const char *pname, int signal, funcPI_t func, bool batch=false);
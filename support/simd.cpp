@@ -1,9 +1,13 @@
 // -*- C++ -*-
 
 #include <complex>
+#include <string.h>
+#include <math.h>
 
 #ifdef __ARM_NEON
 #include <arm_neon.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
 #endif
 
 #include "simd.h"
@@ -138,3 +142,295 @@ void simd_bit2float(int len, const int8_t* cv, float* fv)
         *fv++ = float(2*(*cv>0) - 1);
     }
 }
+
+// packed 24-bit IQ (u2_t i, q; u1_t q3, i3) -> complex float
+// re = q*scale + dc_re, im = i*scale + dc_im (NB: I/Q swapped as in data_pump.cpp:snd_service())
+typedef struct {
+    uint16_t i, q;
+    uint8_t q3, i3;
+} __attribute__((packed)) s24iq_t;
+
+void simd_s24iq_to_ccf(int len, const void* in, int stride, float scale, float dc_re, float dc_im, fftwf_complex* out)
+{
+    const uint8_t* pi = static_cast<const uint8_t*>(in);
+    float*         po = reinterpret_cast<float*>(out);
+
+    // Two samples per step, each gathered with an 8-byte load from the interleaved rx_chans layout.
+    // A load reads 2 bytes past its sample, which are still inside the transfer for every sample of
+    // a channel but its last, so that one is always left to the scalar loop.
+    const size_t step = 6*size_t(stride);
+    int counter=0;
+#ifdef __ARM_NEON
+    const uint8x8_t     tbl     = { 0xff,2,3,4, 0xff,0,1,5 };    // [q, i] << 8, out-of-range index gives 0
+    const float32x4_t   vdc     = { dc_re, dc_im, dc_re, dc_im };
+    for (; counter+2<len; counter+=2) {
+        __builtin_prefetch(pi+4*step);
+        int32x2_t s0 = vreinterpret_s32_u8(vtbl1_u8(vld1_u8(pi), tbl));
+        int32x2_t s1 = vreinterpret_s32_u8(vtbl1_u8(vld1_u8(pi+step), tbl));
+        int32x4_t v  = vshrq_n_s32(vcombine_s32(s0, s1), 8);
+        vst1q_f32(po, vmlaq_n_f32(vdc, vcvtq_f32_s32(v), scale));
+        pi+=2*step, po+=4;
+    }
+#elif defined(__SSSE3__)
+    const __m128i shuf   = _mm_setr_epi8(-1,2,3,4, -1,0,1,5, -1,10,11,12, -1,8,9,13);   // [q0, i0, q1, i1] << 8
+    const __m128  vscale = _mm_set1_ps(scale);
+    const __m128  vdc    = _mm_setr_ps(dc_re, dc_im, dc_re, dc_im);
+    for (; counter+2<len; counter+=2) {
+        __builtin_prefetch(pi+4*step);
+        __m128i u = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)pi), _mm_loadl_epi64((const __m128i*)(pi+step)));
+        __m128i v = _mm_srai_epi32(_mm_shuffle_epi8(u, shuf), 8);
+        _mm_storeu_ps(po, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), vscale), vdc));
+        pi+=2*step, po+=4;
+    }
+#endif
+
+    // same as the original per-sample loop in data_pump.cpp
+    const s24iq_t* ps = reinterpret_cast<const s24iq_t*>(pi);
+    for (; counter<len; ++counter) {
+        int32_t i = int32_t((uint32_t(ps->i3) << 24) | (uint32_t(ps->i) << 8)) >> 8;
+        int32_t q = int32_t((uint32_t(ps->q3) << 24) | (uint32_t(ps->q) << 8)) >> 8;
+        po[0] = q*scale + dc_re;
+        po[1] = i*scale + dc_im;
+        ps+=stride, po+=2;
+    }
+}
+
+// 16-bit IQ (u2_t i, q) -> windowed complex float
+void simd_s16iq_window_cf(int len, const void* in, const float* window, fftwf_complex* out)
+{
+    const int16_t* pi = static_cast<const int16_t*>(in);
+    float*         po = reinterpret_cast<float*>(out);
+
+    int counter=0;
+#ifdef __ARM_NEON
+    float32x4x2_t w;
+    for (counter=0; counter<len/4; ++counter) {
+        __builtin_prefetch(pi+128);
+        int16x4x2_t u = vld2_s16(pi);                       // [i, q]
+        float32x4_t win = vld1q_f32(window);
+        w.val[0] = vmulq_f32(vcvtq_f32_s32(vmovl_s16(u.val[0])), win);
+        w.val[1] = vmulq_f32(vcvtq_f32_s32(vmovl_s16(u.val[1])), win);
+        vst2q_f32((float32_t*)po, w);
+        pi+=8, window+=4, po+=8;
+    }
+    counter *= 4;
+#elif defined(__SSSE3__)
+    for (counter=0; counter<len/4; ++counter) {
+        __builtin_prefetch(pi+128);
+        __m128i u   = _mm_loadu_si128((const __m128i*)pi);    // [i0, q0 .. i3, q3]
+        __m128  win = _mm_loadu_ps(window);
+        __m128i lo  = _mm_srai_epi32(_mm_unpacklo_epi16(u, u), 16);
+        __m128i hi  = _mm_srai_epi32(_mm_unpackhi_epi16(u, u), 16);
+        _mm_storeu_ps(po,   _mm_mul_ps(_mm_cvtepi32_ps(lo), _mm_unpacklo_ps(win, win)));
+        _mm_storeu_ps(po+4, _mm_mul_ps(_mm_cvtepi32_ps(hi), _mm_unpackhi_ps(win, win)));
+        pi+=8, window+=4, po+=8;
+    }
+    counter *= 4;
+#endif
+    for (; counter<len; ++counter) {
+        po[0] = float(pi[0]) * *window;
+        po[1] = float(pi[1]) * *window;
+        pi+=2, window++, po+=2;
+    }
+}
+
+// x = 2^e * m, m in [1,2), for normal x > 0
+static inline float simd_log2_split(float x, int32_t* e)
+{
+    uint32_t b;
+    memcpy(&b, &x, sizeof(b));
+    *e += int32_t(b >> 23) - 127;
+    b = (b & 0x007fffff) | 0x3f800000;
+    memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+// sum(log2(re^2 + im^2 + floor)) with a single log2f():
+// the exponents are summed as integers and the mantissas multiplied together,
+// renormalizing the product every 32 samples before it can overflow.
+// floor must be a normal float so that every power is.
+float simd_sum_log2_pwr(int len, const fftwf_complex* in, float floor)
+{
+    const float* pi = reinterpret_cast<const float*>(in);
+    int32_t e_sum = 0;
+    float   m_prod = 1;
+
+    int counter=0;
+#if defined(__ARM_NEON) || defined(__SSSE3__)
+    float   lane_m[4];
+    int32_t lane_e[4];
+ #ifdef __ARM_NEON
+    const float32x4_t vfloor = vdupq_n_f32(floor);
+    const uint32x4_t  m_mask = vdupq_n_u32(0x007fffff);
+    const uint32x4_t  one    = vdupq_n_u32(0x3f800000);
+    int32x4_t   ve = vdupq_n_s32(0);                        // biased exponents
+    float32x4_t vm = vreinterpretq_f32_u32(one);
+    for (counter=0; counter<len/4; ++counter) {
+        __builtin_prefetch(pi+256);
+        float32x4x2_t u = vld2q_f32(pi);                    // [re, im]
+        float32x4_t p = vmlaq_f32(vmlaq_f32(vfloor, u.val[0], u.val[0]), u.val[1], u.val[1]);
+        uint32x4_t b = vreinterpretq_u32_f32(p);
+        ve = vaddq_s32(ve, vreinterpretq_s32_u32(vshrq_n_u32(b, 23)));
+        vm = vmulq_f32(vm, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(b, m_mask), one)));
+        if ((counter & 31) == 31) {
+            b = vreinterpretq_u32_f32(vm);
+            ve = vaddq_s32(ve, vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(b, 23)), vdupq_n_s32(127)));
+            vm = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(b, m_mask), one));
+        }
+        pi+=8;
+    }
+    vst1q_f32(lane_m, vm);
+    vst1q_s32(lane_e, ve);
+ #else
+    const __m128  vfloor = _mm_set1_ps(floor);
+    const __m128i m_mask = _mm_set1_epi32(0x007fffff);
+    const __m128i one    = _mm_set1_epi32(0x3f800000);
+    __m128i ve = _mm_setzero_si128();                       // biased exponents
+    __m128  vm = _mm_castsi128_ps(one);
+    for (counter=0; counter<len/4; ++counter) {
+        __builtin_prefetch(pi+256);
+        __m128 u0 = _mm_loadu_ps(pi), u1 = _mm_loadu_ps(pi+4);
+        __m128 p = _mm_add_ps(_mm_hadd_ps(_mm_mul_ps(u0, u0), _mm_mul_ps(u1, u1)), vfloor);
+        __m128i b = _mm_castps_si128(p);
+        ve = _mm_add_epi32(ve, _mm_srli_epi32(b, 23));
+        vm = _mm_mul_ps(vm, _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(b, m_mask), one)));
+        if ((counter & 31) == 31) {
+            b = _mm_castps_si128(vm);
+            ve = _mm_add_epi32(ve, _mm_sub_epi32(_mm_srli_epi32(b, 23), _mm_set1_epi32(127)));
+            vm = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(b, m_mask), one));
+        }
+        pi+=8;
+    }
+    _mm_storeu_ps(lane_m, vm);
+    _mm_storeu_si128((__m128i*)lane_e, ve);
+ #endif
+    for (int i=0; i<4; ++i) {
+        e_sum += lane_e[i] - 127*counter;
+        m_prod = simd_log2_split(m_prod * lane_m[i], &e_sum);
+    }
+    counter *= 4;
+#endif
+    for (; counter<len; ++counter) {
+        float p = pi[0]*pi[0] + pi[1]*pi[1] + floor;
+        m_prod = simd_log2_split(m_prod * simd_log2_split(p, &e_sum), &e_sum);
+        pi+=2;
+    }
+    return e_sum + log2f(m_prod);
+}
+
+// out = re^2 + im^2
+void simd_pwr_cf(int len, const fftwf_complex* in, float* out)
+{
+    const float* pi = reinterpret_cast<const float*>(in);
+
+    int counter=0;
+#ifdef __ARM_NEON
+    for (counter=0; counter<len/4; ++counter) {
+        __builtin_prefetch(pi+256);
+        float32x4x2_t u = vld2q_f32(pi);                    // [re, im]
+        vst1q_f32(out, vmlaq_f32(vmulq_f32(u.val[0], u.val[0]), u.val[1], u.val[1]));
+        pi+=8, out+=4;
+    }
+    counter *= 4;
+#elif defined(__SSSE3__)
+    for (counter=0; counter<len/4; ++counter) {
+        __builtin_prefetch(pi+256);
+        __m128 u0 = _mm_loadu_ps(pi), u1 = _mm_loadu_ps(pi+4);
+        _mm_storeu_ps(out, _mm_hadd_ps(_mm_mul_ps(u0, u0), _mm_mul_ps(u1, u1)));
+        pi+=8, out+=4;
+    }
+    counter *= 4;
+#endif
+    for (; counter<len; ++counter) {
+        *out++ = pi[0]*pi[0] + pi[1]*pi[1];
+        pi+=2;
+    }
+}
+
+// Several consecutive inputs usually map to the same output, so this doesn't vectorize.
+// But without the branches of the original per-bin "new output bin?" test it is still faster.
+void simd_peak_bin(int len, const float* in, const uint16_t* map, float* out)
+{
+    for (int i=0; i<len; ++i) {
+        float* po = &out[map[i]];
+        *po = fmaxf(*po, in[i]);
+    }
+}
+
+// log2(m) for m in [1,2), least squares cubic in (m-1): max error 0.0013 (0.004 dB)
+#define SIMD_LOG2_C0    0.0013327970f
+#define SIMD_LOG2_C1    1.4134955143f
+#define SIMD_LOG2_C2    -0.5677665118f
+#define SIMD_LOG2_C3    0.1539184780f
+#define SIMD_DB_LOG2    3.0102999566f   // 10*log10(2)
+
+void simd_pwr_to_wf_u8(int len, const float* in, const float* scale, float offset, uint8_t* out)
+{
+    int counter=0;
+#ifdef __ARM_NEON
+    const uint32x4_t  m_mask = vdupq_n_u32(0x007fffff);
+    const uint32x4_t  one    = vdupq_n_u32(0x3f800000);
+    const float32x4_t vfloor = vdupq_n_f32(1e-30f);
+    const float32x4_t voff   = vdupq_n_f32(offset - SIMD_DB_LOG2 * 127);   // exponent bias folded in
+    const float32x4_t vmin   = vdupq_n_f32(-200), vmax = vdupq_n_f32(0), vone = vdupq_n_f32(1);
+    for (counter=0; counter<len/8; ++counter) {
+        int16x4_t h[2];
+        for (int k=0; k<2; ++k) {
+            uint32x4_t b = vreinterpretq_u32_f32(vmlaq_f32(vfloor, vld1q_f32(in), vld1q_f32(scale)));
+            float32x4_t t = vsubq_f32(vreinterpretq_f32_u32(vorrq_u32(vandq_u32(b, m_mask), one)), vone);
+            float32x4_t l = vmlaq_f32(vdupq_n_f32(SIMD_LOG2_C2), t, vdupq_n_f32(SIMD_LOG2_C3));
+            l = vmlaq_f32(vdupq_n_f32(SIMD_LOG2_C1), t, l);
+            l = vmlaq_f32(vdupq_n_f32(SIMD_LOG2_C0), t, l);
+            l = vaddq_f32(l, vcvtq_f32_u32(vshrq_n_u32(b, 23)));
+            float32x4_t dB = vmlaq_n_f32(voff, l, SIMD_DB_LOG2);
+            dB = vsubq_f32(vminq_f32(vmaxq_f32(dB, vmin), vmax), vone);
+            h[k] = vmovn_s32(vcvtq_s32_f32(dB));            // truncates like the (int) cast
+            in+=4, scale+=4;
+        }
+        vst1_u8(out, vreinterpret_u8_s8(vmovn_s16(vcombine_s16(h[0], h[1]))));
+        out+=8;
+    }
+    counter *= 8;
+#elif defined(__SSSE3__)
+    const __m128i m_mask = _mm_set1_epi32(0x007fffff);
+    const __m128i one    = _mm_set1_epi32(0x3f800000);
+    const __m128i lo8    = _mm_set1_epi16(0x00ff);
+    const __m128  vfloor = _mm_set1_ps(1e-30f);
+    const __m128  voff   = _mm_set1_ps(offset - SIMD_DB_LOG2 * 127);
+    const __m128  vmin   = _mm_set1_ps(-200), vmax = _mm_setzero_ps(), vone = _mm_set1_ps(1);
+    for (counter=0; counter<len/8; ++counter) {
+        __m128i v[2];
+        for (int k=0; k<2; ++k) {
+            __m128i b = _mm_castps_si128(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in), _mm_loadu_ps(scale)), vfloor));
+            __m128 t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(b, m_mask), one)), vone);
+            __m128 l = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(SIMD_LOG2_C3)), _mm_set1_ps(SIMD_LOG2_C2));
+            l = _mm_add_ps(_mm_mul_ps(t, l), _mm_set1_ps(SIMD_LOG2_C1));
+            l = _mm_add_ps(_mm_mul_ps(t, l), _mm_set1_ps(SIMD_LOG2_C0));
+            l = _mm_add_ps(l, _mm_cvtepi32_ps(_mm_srli_epi32(b, 23)));
+            __m128 dB = _mm_add_ps(_mm_mul_ps(l, _mm_set1_ps(SIMD_DB_LOG2)), voff);
+            dB = _mm_sub_ps(_mm_min_ps(_mm_max_ps(dB, vmin), vmax), vone);
+            v[k] = _mm_cvttps_epi32(dB);                    // truncates like the (int) cast
+            in+=4, scale+=4;
+        }
+        // keep the low byte of each (negative) value, as the (uint8_t) cast does
+        __m128i w = _mm_and_si128(_mm_packs_epi32(v[0], v[1]), lo8);
+        _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(w, w));
+        out+=8;
+    }
+    counter *= 8;
+#endif
+    for (; counter<len; ++counter) {
+        float x = *in++ * *scale++ + 1e-30f;
+        uint32_t b;
+        memcpy(&b, &x, sizeof(b));
+        int32_t e = int32_t(b >> 23) - 127;
+        b = (b & 0x007fffff) | 0x3f800000;
+        memcpy(&x, &b, sizeof(x));
+        float t = x - 1;
+        float dB = (e + SIMD_LOG2_C0 + t*(SIMD_LOG2_C1 + t*(SIMD_LOG2_C2 + t*SIMD_LOG2_C3))) * SIMD_DB_LOG2 + offset;
+        if (dB > 0) dB = 0;
+        if (dB < -200.0f) dB = -200.0f;
+        dB--;
+        *out++ = (uint8_t) (int) dB;
+    }
+}
@@ -24,4 +24,28 @@ extern void simd_multiply_cfc(int len,
 // fv = float(2*(cv>0)-1)
 extern void simd_bit2float(int len, const int8_t* cv, float* fv);
 
+// out = { q24*scale + dc_re, i24*scale + dc_im } from packed 24-bit rx_iq_t (I/Q swapped),
+// taking every stride'th input sample (the interleaved rx_chans layout of a CmdGetRX transfer)
+extern void simd_s24iq_to_ccf(int len, const void* in, int stride, float scale, float dc_re, float dc_im, fftwf_complex* out);
+
+// out = { i*window, q*window } from 16-bit iq_t (u2_t i, q)
+// SIMD_S16IQ_WINDOW is defined when there is a vector kernel; otherwise callers should keep an inline loop
+#if defined(__ARM_NEON) || defined(__SSSE3__)
+#define SIMD_S16IQ_WINDOW
+#endif
+extern void simd_s16iq_window_cf(int len, const void* in, const float* window, fftwf_complex* out);
+
+// sum(log2(re^2 + im^2 + floor)), one log2f() per call; floor must be a normal float > 0
+extern float simd_sum_log2_pwr(int len, const fftwf_complex* in, float floor);
+
+// out = re^2 + im^2
+extern void simd_pwr_cf(int len, const fftwf_complex* in, float* out);
+
+// out[map[i]] = max(out[map[i]], in[i]), out must be zeroed first
+extern void simd_peak_bin(int len, const float* in, const uint16_t* map, float* out);
+
+// waterfall byte encoding: (uint8_t) (int) (clamp(10*log10(in*scale + 1e-30) + offset, -200, 0) - 1)
+// using a polynomial log2, error < 0.005 dB
+extern void simd_pwr_to_wf_u8(int len, const float* in, const float* scale, float offset, uint8_t* out);
+
 #endif // SUPPORT_SIMD_H
@@ -0,0 +1,42 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#include "types.h"
+#include "misc.h"
+#include "spsc_ring.h"
+
+#include <string.h>
+
+void spsc_ring_init(spsc_ring_t *r, const char *from, u4_t nel, u4_t el_size)
+{
+    assert(nel >= 2 && (nel & (nel - 1)) == 0);
+    
+    // multiple of 16 bytes so every element is as aligned as the buffer itself
+    el_size = (el_size + 15) & ~15;
+    
+    memset(r, 0, sizeof(*r));
+    r->nel = nel;
+    r->el_size = el_size;
+    r->buf = (u1_t *) kiwi_malloc(from, nel * el_size);
+    memset(r->buf, 0, nel * el_size);
+}
+
+void spsc_ring_free(spsc_ring_t *r)
+{
+    kiwi_free("spsc_ring_free", r->buf);
+    memset(r, 0, sizeof(*r));
+}
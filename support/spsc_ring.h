@@ -0,0 +1,81 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#pragma once
+
+#include "types.h"
+
+// Lock-free single-producer/single-consumer ring of fixed size elements.
+// The producer only writes wr_pos and the consumer only rd_pos. Each side publishes its index with
+// release semantics once it is done with the element and reads the other side's with acquire semantics,
+// so producer and consumer may be on different threads or cores and not just different tasks.
+// One element is kept unused to tell full from empty, so at most nel-1 are queued.
+
+typedef struct {
+    u1_t *buf;
+    u4_t nel, el_size;
+    u4_t wr_pos, rd_pos;
+    u4_t overruns;          // producer found the ring full and dropped an element
+} spsc_ring_t;
+
+// nel must be a power of 2
+void spsc_ring_init(spsc_ring_t *r, const char *from, u4_t nel, u4_t el_size);
+void spsc_ring_free(spsc_ring_t *r);
+
+static inline u4_t spsc_ring_count(spsc_ring_t *r)
+{
+    u4_t wr = __atomic_load_n(&r->wr_pos, __ATOMIC_ACQUIRE);
+    u4_t rd = __atomic_load_n(&r->rd_pos, __ATOMIC_ACQUIRE);
+    return (wr - rd) & (r->nel - 1);
+}
+
+// producer: element to fill or NULL if full
+static inline void *spsc_ring_wr_ptr(spsc_ring_t *r)
+{
+    u4_t wr = r->wr_pos;
+    if (((wr + 1) & (r->nel - 1)) == __atomic_load_n(&r->rd_pos, __ATOMIC_ACQUIRE)) {
+        r->overruns++;
+        return NULL;
+    }
+    return r->buf + wr * r->el_size;
+}
+
+// producer: element from spsc_ring_wr_ptr() is complete
+static inline void spsc_ring_wr_commit(spsc_ring_t *r)
+{
+    __atomic_store_n(&r->wr_pos, (r->wr_pos + 1) & (r->nel - 1), __ATOMIC_RELEASE);
+}
+
+// consumer: oldest element or NULL if empty
+static inline void *spsc_ring_rd_ptr(spsc_ring_t *r)
+{
+    u4_t rd = r->rd_pos;
+    if (rd == __atomic_load_n(&r->wr_pos, __ATOMIC_ACQUIRE)) return NULL;
+    return r->buf + rd * r->el_size;
+}
+
+// consumer: done with the element from spsc_ring_rd_ptr(), producer may reuse it
+static inline void spsc_ring_rd_commit(spsc_ring_t *r)
+{
+    __atomic_store_n(&r->rd_pos, (r->rd_pos + 1) & (r->nel - 1), __ATOMIC_RELEASE);
+}
+
+// consumer: discard everything queued
+static inline void spsc_ring_rd_flush(spsc_ring_t *r)
+{
+    __atomic_store_n(&r->rd_pos, __atomic_load_n(&r->wr_pos, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,110 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#include "types.h"
+#include "timer_heap.h"
+
+#include <assert.h>
+
+#define TH_PARENT(i)    (((i) - 1) / 2)
+#define TH_LEFT(i)      (2*(i) + 1)
+
+static inline void th_put(timer_heap_t *h, int i, timer_node_t *tn)
+{
+    h->node[i] = tn;
+    tn->idx = i + 1;
+}
+
+static void th_up(timer_heap_t *h, int i)
+{
+    timer_node_t *tn = h->node[i];
+    while (i > 0) {
+        int p = TH_PARENT(i);
+        if (h->node[p]->deadline <= tn->deadline) break;
+        th_put(h, i, h->node[p]);
+        i = p;
+    }
+    th_put(h, i, tn);
+}
+
+static void th_down(timer_heap_t *h, int i)
+{
+    timer_node_t *tn = h->node[i];
+    while (1) {
+        int c = TH_LEFT(i);
+        if (c >= h->n) break;
+        if (c+1 < h->n && h->node[c+1]->deadline < h->node[c]->deadline) c++;
+        if (tn->deadline <= h->node[c]->deadline) break;
+        th_put(h, i, h->node[c]);
+        i = c;
+    }
+    th_put(h, i, tn);
+}
+
+void timer_heap_init(timer_heap_t *h, timer_node_t **storage, int size)
+{
+    h->node = storage;
+    h->size = size;
+    h->n = 0;
+}
+
+void timer_heap_set(timer_heap_t *h, timer_node_t *tn, s64_t deadline)
+{
+    assert(deadline > 0);
+    
+    if (tn->idx == 0) {
+        assert(h->n < h->size);
+        tn->deadline = deadline;
+        th_put(h, h->n, tn);
+        h->n++;
+        th_up(h, h->n - 1);
+        return;
+    }
+    
+    s64_t prev = tn->deadline;
+    tn->deadline = deadline;
+    if (deadline < prev)
+        th_up(h, tn->idx - 1);
+    else
+        th_down(h, tn->idx - 1);
+}
+
+void timer_heap_cancel(timer_heap_t *h, timer_node_t *tn)
+{
+    tn->deadline = 0;
+    if (tn->idx == 0) return;
+
+    int i = tn->idx - 1;
+    tn->idx = 0;
+    h->n--;
+    if (i == h->n) return;      // was last
+
+    // move last node into the hole and restore heap order in whichever direction is needed
+    th_put(h, i, h->node[h->n]);
+    if (i > 0 && h->node[i]->deadline < h->node[TH_PARENT(i)]->deadline)
+        th_up(h, i);
+    else
+        th_down(h, i);
+}
+
+timer_node_t *timer_heap_expired(timer_heap_t *h, s64_t now)
+{
+    if (h->n == 0 || h->node[0]->deadline >= now) return NULL;
+    timer_node_t *tn = h->node[0];
+    timer_heap_cancel(h, tn);
+    return tn;
+}
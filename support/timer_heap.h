@@ -0,0 +1,52 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#pragma once
+
+#include "types.h"
+
+// Binary min-heap of timers ordered by deadline.
+// Used by the task scheduler so finding expired TaskSleepUsec() deadlines is O(1) per
+// _NextTask() and O(log n) per sleep/wakeup instead of a compare for every task on every switch.
+// Nodes are embedded in the owner's struct and must be zeroed (not queued) before first use.
+
+typedef struct {
+    s64_t deadline;     // 0 = not queued
+    int idx;            // position in heap + 1, 0 = not queued
+    void *param;
+} timer_node_t;
+
+typedef struct {
+    timer_node_t **node;
+    int n, size;
+} timer_heap_t;
+
+void timer_heap_init(timer_heap_t *h, timer_node_t **storage, int size);
+
+// insert, or move if already queued (deadline must be > 0)
+void timer_heap_set(timer_heap_t *h, timer_node_t *tn, s64_t deadline);
+
+// remove if queued, always leaves deadline = 0
+void timer_heap_cancel(timer_heap_t *h, timer_node_t *tn);
+
+// removes and returns the earliest node if its deadline is before now, otherwise NULL
+timer_node_t *timer_heap_expired(timer_heap_t *h, s64_t now);
+
+static inline s64_t timer_heap_earliest(timer_heap_t *h)
+{
+    return h->n? h->node[0]->deadline : 0;
+}
@@ -0,0 +1,146 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#include "types.h"
+#include "config.h"
+#include "kiwi.h"
+#include "misc.h"
+#include "coroutines.h"
+#include "worker.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#ifndef WORKER_DISABLE
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+worker_stats_t worker_stats;
+
+#ifdef WORKER_DISABLE
+
+void worker_init()
+{
+}
+
+void worker_run(const char *reason, funcP_t func, void *param)
+{
+    worker_stats.inline_jobs++;
+    func(param);
+}
+
+#else
+
+typedef struct {
+    funcP_t func;
+    void *param;
+    u4_t done;
+} worker_job_t;
+
+// each task has at most one job outstanding
+#define N_WORKER_Q  (MAX_TASKS / 4)
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    worker_job_t *q[N_WORKER_Q];
+    u4_t q_wr, q_rd;
+    pthread_t thread[N_WORKERS];
+} worker;
+
+static void *worker_thread(void *param)
+{
+    int id = (int) (intptr_t) param;
+
+    while (1) {
+        pthread_mutex_lock(&worker.lock);
+            while (worker.q_wr == worker.q_rd)
+                pthread_cond_wait(&worker.cond, &worker.lock);
+            worker_job_t *job = worker.q[worker.q_rd % N_WORKER_Q];
+            worker.q_rd++;
+        pthread_mutex_unlock(&worker.lock);
+
+        job->func(job->param);
+        worker_stats.jobs[id]++;
+
+        // job results must be visible before _NextTask() sees done via the task's wakeup_test
+        __sync_synchronize();
+        job->done = 1;
+    }
+
+    return NULL;
+}
+
+void worker_init()
+{
+    // core 0 is used by the main process (see set_cpu_affinity() in main.cpp)
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_stats.nworkers = MIN(ncpu - 1, N_WORKERS);
+    if (worker_stats.nworkers <= 0) {
+        worker_stats.nworkers = 0;
+        return;
+    }
+
+    pthread_mutex_init(&worker.lock, NULL);
+    pthread_cond_init(&worker.cond, NULL);
+
+    for (int i = 0; i < worker_stats.nworkers; i++) {
+        if (pthread_create(&worker.thread[i], NULL, worker_thread, (void *) (intptr_t) i) != 0)
+            sys_panic("worker pthread_create");
+
+        // Otherwise the thread would inherit the main process's affinity to core 0.
+        // Allow all the other cores rather than pinning to one: the shmem_ipc children
+        // (kiwi.waterfall, DRM) pin themselves to core 1, so the kernel is left to move
+        // workers off it while a child is busy.
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (int c = 1; c < ncpu; c++) CPU_SET(c, &cpu_set);
+        pthread_setaffinity_np(worker.thread[i], sizeof(cpu_set_t), &cpu_set);
+    }
+
+    lprintf("worker: %d threads\n", worker_stats.nworkers);
+}
+
+void worker_run(const char *reason, funcP_t func, void *param)
+{
+    if (worker_stats.nworkers == 0) {
+        worker_stats.inline_jobs++;
+        func(param);
+        return;
+    }
+
+    worker_job_t job;
+    job.func = func;
+    job.param = param;
+    job.done = 0;
+
+    pthread_mutex_lock(&worker.lock);
+        assert(worker.q_wr - worker.q_rd < N_WORKER_Q);
+        worker.q[worker.q_wr % N_WORKER_Q] = &job;
+        worker.q_wr++;
+        pthread_cond_signal(&worker.cond);
+    pthread_mutex_unlock(&worker.lock);
+
+    // similar to shmem_ipc_invoke(): let _NextTask() monitor job.done
+    while (job.done == 0) {
+        TaskSleepWakeupTest(reason, &job.done);
+    }
+    __sync_synchronize();
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+--------------------------------------------------------------------------------
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Library General Public
+License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Library General Public License for more details.
+You should have received a copy of the GNU Library General Public
+License along with this library; if not, write to the
+Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+Boston, MA  02110-1301, USA.
+--------------------------------------------------------------------------------
+*/
+
+#pragma once
+
+#include "types.h"
+
+// Pool of worker threads, kept off the main process's core 0, that run
+// self-contained DSP jobs on behalf of a coroutine task.
+// worker_run() looks synchronous to the calling task, but the task sleeps until the job
+// is done so other tasks (i.e. other channels submitting their own jobs) run meanwhile.
+//
+// The cores are shared with the shmem_ipc children (kiwi.waterfall, DRM) pinned to core 1.
+// Job counts are reported in the "/latency" JSON (see lat_hist.cpp).
+//
+// Jobs must not call any coroutine, SPI, printf or extension API.
+// Without MULTI_CORE the job is simply called inline.
+
+#ifdef MULTI_CORE
+    //#define WORKER_DISABLE
+#else
+    #define WORKER_DISABLE
+#endif
+
+#define N_WORKERS   4
+
+typedef struct {
+    int nworkers;
+    u4_t jobs[N_WORKERS], inline_jobs;
+} worker_stats_t;
+
+extern worker_stats_t worker_stats;
+
+void worker_init();
+void worker_run(const char *reason, funcP_t func, void *param);
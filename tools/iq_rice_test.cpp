@@ -0,0 +1,109 @@
+// Round-trip check of the rx/iq_rice.cpp IQ compressor: every case is encoded and decoded
+// again and must come back bit-exact. Also covers the paths a typical signal never takes.
+//	make UTIL=iq_rice_test run
+
+#include "types.h"
+#include "iq_rice.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define NSAMPS      512     // FASTFIR_OUTBUF_SIZE
+#define NRAND       2000
+
+static s2_t iq[NSAMPS*2], iq_dec[NSAMPS*2];
+static u1_t buf[IQ_RICE_MAX_BYTES(NSAMPS)];
+static int fails;
+
+static s2_t clamp_s2(double v)
+{
+	if (v > 32767) return 32767;
+	if (v < -32768) return -32768;
+	return (s2_t) lrint(v);
+}
+
+// returns the I channel header byte so the caller can check which path was taken
+static int round_trip(const char *name, int nsamps, bool quiet = false)
+{
+	int bytes = iq_rice_encode(iq, nsamps, buf);
+	bool bad = (bytes > (int) IQ_RICE_MAX_BYTES(nsamps));
+
+	memset(iq_dec, 0x55, sizeof(iq_dec));
+	int n = iq_rice_decode(buf, bytes, iq_dec, NSAMPS);
+	bad |= (n != nsamps || memcmp(iq, iq_dec, nsamps * 2 * sizeof(s2_t)) != 0);
+
+	// a truncated packet must be rejected, never read past the end
+	if (bytes > 2 && iq_rice_decode(buf, bytes-1, iq_dec, NSAMPS) != -1) bad = true;
+
+	if (bad) fails++;
+	if (bad || !quiet)
+		printf("%-28s %3d samps: %4d bytes (%5.1f%%) order %d k %2d  %s\n", name, nsamps, bytes,
+			nsamps? 100.0 * bytes / (nsamps * 2 * sizeof(s2_t)) : 0, buf[2] >> 5, buf[2] & 0x1f, bad? "FAIL" : "exact");
+	return buf[2];
+}
+
+static void expect(const char *what, bool ok)
+{
+	if (!ok) {
+		printf("  expected %s: FAIL\n", what);
+		fails++;
+	}
+}
+
+static void sine(double amp, double w, double noise)
+{
+	for (int i = 0; i < NSAMPS; i++) {
+		iq[i*2]   = clamp_s2(amp * cos(w*i) + noise * ((random() & 0xffff) - 0x8000) / 0x8000);
+		iq[i*2+1] = clamp_s2(amp * sin(w*i) + noise * ((random() & 0xffff) - 0x8000) / 0x8000);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i, hdr;
+
+	memset(iq, 0, sizeof(iq));
+	round_trip("silence", NSAMPS);
+	round_trip("empty", 0);
+	round_trip("one sample", 1);
+
+	sine(8000, 0.05, 20);
+	round_trip("sine + noise", NSAMPS);
+
+	// full-scale white noise can't be compressed
+	for (i = 0; i < NSAMPS*2; i++) iq[i] = random();
+	hdr = round_trip("white noise (raw fallback)", NSAMPS);
+	expect("raw", (hdr >> 5) == IQ_RICE_RAW);
+
+	// small k from the quiet samples, so the spikes exceed IQ_RICE_ESC
+	memset(iq, 0, sizeof(iq));
+	for (i = 0; i < NSAMPS*2; i++) iq[i] = (random() & 3) - 2;
+	iq[100*2] = 30000; iq[101*2] = -30000; iq[300*2+1] = -32768;
+	hdr = round_trip("spikes (escape)", NSAMPS);
+	expect("escape", (hdr >> 5) != IQ_RICE_RAW && (60000 >> (hdr & 0x1f)) >= IQ_RICE_ESC);
+
+	// The largest order-2 residual is x[n] - 2*x[n-1] + x[n-2] = +/- 4*32767 (and a bit), in the
+	// middle of a signal smooth enough that order 2 is still chosen.
+	sine(30000, 0.1, 0);
+	iq[200*2] = 32767; iq[201*2] = -32768; iq[202*2] = 32767;
+	iq[400*2] = -32768; iq[401*2] = 32767; iq[402*2] = -32768;
+	hdr = round_trip("max order-2 residual", NSAMPS);
+	expect("order 2", (hdr >> 5) == 2);
+	expect("escape", (131070*2 >> (hdr & 0x1f)) >= IQ_RICE_ESC);
+	expect("zigzagged residual to fit IQ_RICE_ESC_BITS", 131072*2 < (1 << IQ_RICE_ESC_BITS));
+
+	// random mixes of the above at random lengths
+	for (int n = 0; n < NRAND; n++) {
+		int nsamps = random() % (NSAMPS+1);
+		double amp = (random() % 4 == 0)? 40000 : (random() % 32768);
+		sine(amp, (random() % 1000) / 1000.0, random() % 256);
+		for (int s = nsamps? random() % 4 : 0; s; s--) iq[random() % (nsamps*2)] = random();
+		round_trip("random", nsamps, true);
+	}
+	printf("%d random packets\n", NRAND);
+
+	printf("%s\n", fails? "FAIL" : "PASS");
+	return fails? 1 : 0;
+}
@@ -0,0 +1,114 @@
+// Scheduler microbenchmark: finding expired TaskSleepUsec() deadlines in _NextTask()
+// by scanning every task (original) vs the support/timer_heap.cpp min-heap, as the task count grows.
+//	make UTIL=sched_bench run
+
+#include "types.h"
+#include "timer_heap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NSWITCH     200000
+#define MAX_T       1024
+
+static double time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// the subset of TASK the deadline search touches, same spread across memory as the real struct
+typedef struct {
+	s64_t deadline;
+	bool stopped;
+	timer_node_t timer;
+	char pad[512];
+} task_t;
+
+static task_t tasks[MAX_T];
+static timer_node_t *heap_node[MAX_T];
+static s64_t sleep_us[MAX_T];
+
+// each switch the clock advances 50 us and every woken task goes back to sleep for its period
+static u4_t run_scan(int nt)
+{
+	u4_t woke = 0;
+	s64_t now = 1;
+	for (int i=0; i < nt; i++) tasks[i].deadline = now + sleep_us[i];
+
+	for (int n=0; n < NSWITCH; n++, now += 50) {
+		for (int i=0; i < nt; i++) {
+			task_t *t = &tasks[i];
+			if (t->deadline > 0 && t->deadline < now) {
+				t->deadline = 0;
+				t->stopped = false;
+				woke++;
+			}
+		}
+		for (int i=0; i < nt; i++) {
+			task_t *t = &tasks[i];
+			if (!t->stopped) {
+				t->stopped = true;
+				t->deadline = now + sleep_us[i];
+			}
+		}
+	}
+	return woke;
+}
+
+static u4_t run_heap(int nt)
+{
+	timer_heap_t h;
+	timer_heap_init(&h, heap_node, MAX_T);
+	u4_t woke = 0;
+	s64_t now = 1;
+	for (int i=0; i < nt; i++) {
+		tasks[i].timer.param = &tasks[i];
+		timer_heap_set(&h, &tasks[i].timer, now + sleep_us[i]);
+	}
+
+	task_t *runq[MAX_T];
+	for (int n=0; n < NSWITCH; n++, now += 50) {
+		int nrun = 0;
+		timer_node_t *tn;
+		while ((tn = timer_heap_expired(&h, now)) != NULL) {
+			task_t *t = (task_t *) tn->param;
+			t->stopped = false;
+			runq[nrun++] = t;
+			woke++;
+		}
+		for (int i=0; i < nrun; i++) {
+			task_t *t = runq[i];
+			t->stopped = true;
+			timer_heap_set(&h, &t->timer, now + sleep_us[t - tasks]);
+		}
+	}
+	for (int i=0; i < nt; i++) timer_heap_cancel(&h, &tasks[i].timer);
+	return woke;
+}
+
+int main(int argc, char *argv[])
+{
+	const int ntasks[] = { 16, 64, 128, 256, 512, 1024 };
+
+	// sleep periods typical of the server: 1 ms (audio/wf) to 1 s (housekeeping)
+	for (int i=0; i < MAX_T; i++)
+		sleep_us[i] = (i & 1)? (1000 + random() % 10000) : (100000 + random() % 900000);
+
+	for (int k=0; k < ARRAY_LEN(ntasks); k++) {
+		int nt = ntasks[k];
+		double t0 = time_ns();
+		u4_t w_scan = run_scan(nt);
+		double t1 = time_ns();
+		u4_t w_heap = run_heap(nt);
+		double t2 = time_ns();
+
+		double scan_ns = (t1-t0)/NSWITCH, heap_ns = (t2-t1)/NSWITCH;
+		printf("%4d tasks: scan %8.1f ns/switch  heap %8.1f ns/switch  x%.2f  wakeups %u %s\n",
+			nt, scan_ns, heap_ns, scan_ns/heap_ns, w_heap, (w_scan == w_heap)? "same" : "DIFFERENT");
+	}
+
+	return 0;
+}
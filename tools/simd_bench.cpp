@@ -0,0 +1,355 @@
+// Microbenchmarks for the support/simd.cpp kernels against the scalar code they replace.
+// Build and run on the target (Beagle) as well as the development machine:
+//	make UTIL=simd_bench run
+
+#include "types.h"
+#include "kiwi.gen.h"
+#include "config.h"
+#include "simd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define NITER   20000
+
+static double time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+typedef struct {
+	u2_t i, q;
+	u1_t q3, i3;
+} __attribute__((packed)) rx_iq_t;
+
+typedef struct { float re, im; } cpx_t;
+
+static rx_iq_t iq[MAX_NRX_SAMPS * MAX_RX_CHANS];
+static cpx_t out_ref[MAX_RX_CHANS][MAX_NRX_SAMPS], out_simd[MAX_RX_CHANS][MAX_NRX_SAMPS];
+
+// the original per-sample loop from data_pump.cpp:snd_service()
+static void unpack_scalar(int nsamps, int nch, const bool *enabled, float rescale, float dc_i, float dc_q)
+{
+	cpx_t *i_samps[MAX_RX_CHANS];
+	for (int ch=0; ch < nch; ch++) i_samps[ch] = out_ref[ch];
+	rx_iq_t *iqp = iq;
+
+	for (int j=0; j < nsamps; j++) {
+		for (int ch=0; ch < nch; ch++) {
+			if (enabled[ch]) {
+				s4_t i = S24_8_16(iqp->i3, iqp->i);
+				s4_t q = S24_8_16(iqp->q3, iqp->q);
+				i_samps[ch]->re = q * rescale + dc_i;
+				i_samps[ch]->im = i * rescale + dc_q;
+				i_samps[ch]++;
+			}
+			iqp++;
+		}
+	}
+}
+
+static void unpack_simd(int nsamps, int nch, const bool *enabled, float rescale, float dc_i, float dc_q)
+{
+	for (int ch=0; ch < nch; ch++)
+		if (enabled[ch]) simd_s24iq_to_ccf(nsamps, &iq[ch], nch, rescale, dc_i, dc_q, (fftwf_complex *) out_simd[ch]);
+}
+
+static void bench_s24iq(int nch, int nen)
+{
+	int nsamps = NRX_SAMPS_CHANS(nch);
+	float rescale = powf(2, -(24-1) + 15), dc_i = 0.01, dc_q = -0.02;
+	bool enabled[MAX_RX_CHANS];
+	for (int ch=0; ch < nch; ch++) enabled[ch] = (ch < nen);
+
+	for (int k=0; k < nsamps * nch; k++) {
+		s4_t i = (random() & 0xffffff) - 0x800000, q = (random() & 0xffffff) - 0x800000;
+		iq[k].i = i & 0xffff; iq[k].i3 = (i >> 16) & 0xff;
+		iq[k].q = q & 0xffff; iq[k].q3 = (q >> 16) & 0xff;
+	}
+
+	double t0 = time_ns();
+	for (int n=0; n < NITER; n++) unpack_scalar(nsamps, nch, enabled, rescale, dc_i, dc_q);
+	double t1 = time_ns();
+	for (int n=0; n < NITER; n++) unpack_simd(nsamps, nch, enabled, rescale, dc_i, dc_q);
+	double t2 = time_ns();
+
+	int mismatch = 0;
+	for (int ch=0; ch < nen; ch++)
+		if (memcmp(out_ref[ch], out_simd[ch], nsamps * sizeof(cpx_t)) != 0) mismatch++;
+
+	#if defined(__ARM_NEON) || defined(__SSSE3__)
+		const char *kernel = "";
+	#else
+		const char *kernel = "  (no vector kernel, simd column is the strided scalar loop)";
+	#endif
+	double ref_ns = (t1-t0)/NITER, simd_ns = (t2-t1)/NITER;
+	printf("s24iq unpack rx%-2d %2d enabled %3d samps: scalar %8.1f ns  simd %8.1f ns  x%.2f  %s%s\n",
+		nch, nen, nsamps, ref_ns, simd_ns, ref_ns/simd_ns, mismatch? "MISMATCH" : "exact", kernel);
+}
+
+// rx_sound.cpp S-meter: per-sample EMA of the dB power (original) vs one EMA step per half block
+#define SM_NS       512     // FASTFIR_OUTBUF_SIZE
+#define SM_NBLK     2000
+#define SM_MAX_VAL  ((float) ((1 << (15-2)) - 1))
+#define SM_MAX_PWR  (SM_MAX_VAL * SM_MAX_VAL)
+
+static cpx_t sm_in[SM_NBLK][SM_NS];
+static float sm_ref[SM_NBLK], sm_blk[SM_NBLK];
+
+static void bench_smeter(int rate)
+{
+	float alpha = 1.0 - expf(-1.0/((float) rate * .01));
+	
+	// noise with a carrier stepping between -100 and -20 dBFS every 100 blocks
+	for (int b=0; b < SM_NBLK; b++) {
+		float ampl = SM_MAX_VAL * powf(10, (((b/100) & 1)? -20 : -100) / 20.0);
+		for (int j=0; j < SM_NS; j++) {
+			float n_re = ((random() & 0xffff) - 0x8000) / 65536.0, n_im = ((random() & 0xffff) - 0x8000) / 65536.0;
+			sm_in[b][j].re = ampl * cosf(j * 0.1) + n_re * SM_MAX_VAL * 1e-4;
+			sm_in[b][j].im = ampl * sinf(j * 0.1) + n_im * SM_MAX_VAL * 1e-4;
+		}
+	}
+
+	double t0 = time_ns();
+	for (int n=0; n < NITER/SM_NBLK*10; n++) {
+		float avg = 0;
+		for (int b=0; b < SM_NBLK; b++) {
+			cpx_t *f_sa = sm_in[b];
+			for (int j=0; j < SM_NS; j++) {
+				float re = f_sa->re, im = f_sa->im;
+				float pwr = re*re + im*im;
+				float pwr_dB = 10.0 * log10f((pwr / SM_MAX_PWR) + 1e-30);
+				avg = (1.0 - alpha)*avg + alpha*pwr_dB;
+				f_sa++;
+			}
+			sm_ref[b] = avg;
+		}
+	}
+	double t1 = time_ns();
+	float max_dB10 = 10.0 * log10(SM_MAX_PWR);
+	for (int n=0; n < NITER/SM_NBLK*10; n++) {
+		float avg = 0;
+		for (int b=0; b < SM_NBLK; b++) {
+			for (int h=0; h < 2; h++) {
+				int ns = SM_NS/2;
+				float mean_dB = 3.01029995663981f * simd_sum_log2_pwr(ns, (fftwf_complex *) &sm_in[b][h*ns], 1e-30f * SM_MAX_PWR) / ns - max_dB10;
+				float decay = powf(1.0f - alpha, ns);
+				avg = decay*avg + (1.0f - decay)*mean_dB;
+			}
+			sm_blk[b] = avg;
+		}
+	}
+	double t2 = time_ns();
+
+	// compare once settled (ignore the blocks right after each step)
+	// NB: the per-sample EMA itself fluctuates on noise by more than max diff, the mean diff shows there is no bias
+	float max_err = 0, sum_err = 0;
+	int nerr = 0;
+	for (int b=0; b < SM_NBLK; b++) {
+		if ((b % 100) < 10) continue;
+		max_err = fmaxf(max_err, fabsf(sm_ref[b] - sm_blk[b]));
+		sum_err += sm_blk[b] - sm_ref[b];
+		nerr++;
+	}
+
+	int nblk = NITER/SM_NBLK*10 * SM_NBLK;
+	double ref_ns = (t1-t0)/nblk, blk_ns = (t2-t1)/nblk;
+	printf("S-meter %5d Hz %3d samps: per-sample %8.1f ns  block %8.1f ns  x%.2f  settled diff max %.3f mean %+.4f dB\n",
+		rate, SM_NS, ref_ns, blk_ns, ref_ns/blk_ns, max_err, sum_err/nerr);
+}
+
+// rx_waterfall.cpp compute_frame(): power, peak binning through fft2wf_map and dB byte encoding
+#define WF_NBIN     4096    // WF_C_NFFT / WF_USING_HALF_FFT
+#define WF_NPX      1024    // WF_WIDTH
+#define WF_NFRM     64
+
+static cpx_t wf_fft[WF_NFRM][WF_NBIN];
+static float wf_pwr[WF_NBIN], wf_peak[WF_NPX], wf_sum[WF_NPX], wf_scale[WF_NPX];
+static u2_t wf_map[WF_NBIN];
+static u1_t wf_ref[WF_NFRM][WF_NPX], wf_simd[WF_NFRM][WF_NPX];
+
+static void wf_frame_scalar(cpx_t *fft, int nbin, u1_t *bp, float offset)
+{
+	int i, bin, _bin = -1;
+	for (i=2; i < nbin; i++)
+		wf_pwr[i] = fft[i].re*fft[i].re + fft[i].im*fft[i].im;
+	wf_pwr[0] = wf_pwr[1] = 0;
+	memset(wf_peak, 0, sizeof(wf_peak));
+	for (i=0; i < nbin; i++) {
+		float p = wf_pwr[i];
+		bin = wf_map[i];
+		if (bin >= WF_NPX) break;
+		if (bin == _bin) {
+			if (p > wf_peak[bin]) wf_peak[bin] = p;
+			wf_sum[bin] += p;
+		} else {
+			wf_peak[bin] = p;
+			wf_sum[bin] = p;
+			_bin = bin;
+		}
+	}
+	for (i=0; i < WF_NPX; i++) {
+		float dB = 10.0 * log10f(wf_peak[i] * wf_scale[i] + 1e-30F) + offset;
+		if (dB > 0) dB = 0;
+		if (dB < -200.0) dB = -200.0;
+		dB--;
+		*bp++ = (u1_t) (int) dB;
+	}
+}
+
+static void wf_frame_simd(cpx_t *fft, int nbin, int limit, u1_t *bp, float offset)
+{
+	simd_pwr_cf(limit-2, (fftwf_complex *) &fft[2], &wf_pwr[2]);
+	wf_pwr[0] = wf_pwr[1] = 0;
+	memset(wf_peak, 0, sizeof(wf_peak));
+	simd_peak_bin(limit, wf_pwr, wf_map, wf_peak);
+	simd_pwr_to_wf_u8(WF_NPX, wf_peak, wf_scale, offset, bp);
+}
+
+static void bench_wf(int zoom)
+{
+	int nbin = zoom? WF_NBIN/2 : WF_NBIN;
+	int plot_width = WF_NPX * 33.333 / 30.0;
+	float maxmag = zoom? nbin : nbin/2, offset = zoom? -0.08 : -0.8;
+	int i, limit;
+
+	for (i=0; i < nbin; i++) wf_map[i] = plot_width * i / nbin;
+	for (limit=0; limit < nbin && wf_map[limit] < WF_NPX; limit++)
+		;
+	for (i=0; i < WF_NPX; i++) wf_scale[i] = (i % 97 == 0)? 0 : 5.0 / (maxmag * maxmag);   // some masked
+
+	// noise floor from -140 to -40 dB plus some strong carriers
+	for (int f=0; f < WF_NFRM; f++) {
+		for (i=0; i < nbin; i++) {
+			float ampl = maxmag * powf(10, (-140 + (random() % 10000) / 100.0) / 20.0);
+			if (random() % 200 == 0) ampl = maxmag * powf(10, -(random() % 40) / 20.0);
+			float ph = (random() & 0xffff) / 65536.0 * 2 * M_PI;
+			wf_fft[f][i].re = ampl * cosf(ph);
+			wf_fft[f][i].im = ampl * sinf(ph);
+		}
+	}
+
+	int nrep = NITER/WF_NFRM/4;
+	double t0 = time_ns();
+	for (int n=0; n < nrep; n++)
+		for (int f=0; f < WF_NFRM; f++) wf_frame_scalar(wf_fft[f], nbin, wf_ref[f], offset);
+	double t1 = time_ns();
+	for (int n=0; n < nrep; n++)
+		for (int f=0; f < WF_NFRM; f++) wf_frame_simd(wf_fft[f], nbin, limit, wf_simd[f], offset);
+	double t2 = time_ns();
+
+	// bytes can differ by one where the dB value is within the log approximation error of an integer
+	int diff1 = 0, diffn = 0;
+	for (int f=0; f < WF_NFRM; f++) {
+		for (i=0; i < WF_NPX; i++) {
+			int d = abs((int) wf_ref[f][i] - (int) wf_simd[f][i]);
+			if (d == 1 || d == 255) diff1++; else if (d) diffn++;
+		}
+	}
+
+	double ref_ns = (t1-t0)/nrep/WF_NFRM, simd_ns = (t2-t1)/nrep/WF_NFRM;
+	printf("WF frame z%d %4d bins: scalar %8.1f ns  simd %8.1f ns  x%.2f  bytes off by one %.3f%%  more %d\n",
+		zoom, nbin, ref_ns, simd_ns, ref_ns/simd_ns, diff1 * 100.0 / (WF_NFRM * WF_NPX), diffn);
+}
+
+// Error of the dB approximation: sweep each input down 1.5 dB in 0.001 dB steps (using scale[])
+// and compare where the output byte changes with where the exact value crosses the integer.
+// The first 0.1 dB is skipped so the fast value can't have crossed before the start of the sweep.
+#define WF_ERR_STEPS    1500
+#define WF_ERR_SKIP     100
+
+static void bench_wf_dB_err()
+{
+	static float in[WF_ERR_STEPS], scale[WF_ERR_STEPS];
+	static u1_t out[WF_ERR_STEPS];
+	int max_steps = 0;
+
+	for (int k=0; k < WF_ERR_STEPS; k++) scale[k] = pow(10, -(k * 0.001) / 10);
+	for (int j=0; j < 20000; j++) {
+		float p = pow(10, -(20000 + random() % 1880000) / 10000.0 / 10);   // -2 .. -190 dB, clear of the clamps
+		for (int k=0; k < WF_ERR_STEPS; k++) in[k] = p;
+		simd_pwr_to_wf_u8(WF_ERR_STEPS, in, scale, 0, out);
+
+		// first step where each falls below the exact starting value
+		int k_fast = -1, k_exact = -1;
+		int b0 = (int) (10 * log10((double) p * scale[WF_ERR_SKIP]) - 1);
+		for (int k = WF_ERR_SKIP; k < WF_ERR_STEPS; k++) {
+			if (k_fast < 0 && (int) out[k] - 256 < b0) k_fast = k;     // all values are negative
+			if (k_exact < 0 && (int) (10 * log10((double) p * scale[k]) - 1) < b0) k_exact = k;
+		}
+		if (k_fast >= 0 && k_exact >= 0 && abs(k_fast - k_exact) > max_steps) max_steps = abs(k_fast - k_exact);
+	}
+	printf("WF dB approximation: max error %.3f dB\n", max_steps * 0.001);
+}
+
+// rx_waterfall.cpp sample_wf(): 16-bit IQ to windowed complex float, one hardware waterfall buffer
+#define WF_NSAMPS   8192    // WF_C_NSAMPS
+
+typedef struct { u2_t i, q; } wf_iq_t;
+static wf_iq_t wf_iq[WF_NSAMPS];
+static float wf_window[WF_NSAMPS];
+static cpx_t wf_samps_ref[WF_NSAMPS], wf_samps_simd[WF_NSAMPS];
+
+static void bench_wf_window()
+{
+	int k;
+	for (k=0; k < WF_NSAMPS; k++) {
+		wf_iq[k].i = random();
+		wf_iq[k].q = random();
+		wf_window[k] = 0.5 - 0.5 * cos(2 * M_PI * k / (WF_NSAMPS-1));
+	}
+
+	int nrep = NITER/20;
+	double t0 = time_ns();
+	for (int n=0; n < nrep; n++) {
+		wf_iq_t *iqp = wf_iq;
+		for (k=0; k < WF_NSAMPS; k++, iqp++) {
+			s4_t ii = (s4_t) (s2_t) iqp->i;
+			s4_t qq = (s4_t) (s2_t) iqp->q;
+			wf_samps_ref[k].re = ((float) ii) * wf_window[k];
+			wf_samps_ref[k].im = ((float) qq) * wf_window[k];
+		}
+		asm volatile("" ::: "memory");		// keep -O3 from hoisting the invariant loop out of the reps
+	}
+	double t1 = time_ns();
+	for (int n=0; n < nrep; n++) {
+		simd_s16iq_window_cf(WF_NSAMPS, wf_iq, wf_window, (fftwf_complex *) wf_samps_simd);
+		asm volatile("" ::: "memory");
+	}
+	double t2 = time_ns();
+
+	bool mismatch = memcmp(wf_samps_ref, wf_samps_simd, sizeof(wf_samps_ref)) != 0;
+	double ref_ns = (t1-t0)/nrep, simd_ns = (t2-t1)/nrep;
+	#ifdef SIMD_S16IQ_WINDOW
+		const char *kernel = "";
+	#else
+		const char *kernel = "  (no vector kernel, sample_wf() keeps the inline loop)";
+	#endif
+	printf("WF window %d samps: scalar %8.1f ns  simd %8.1f ns  x%.2f  %s%s\n",
+		WF_NSAMPS, ref_ns, simd_ns, ref_ns/simd_ns, mismatch? "MISMATCH" : "exact", kernel);
+}
+
+int main(int argc, char *argv[])
+{
+	const int nch[] = { 3, 4, 8, 14 };
+
+	for (int k=0; k < ARRAY_LEN(nch); k++) {
+		bench_s24iq(nch[k], 1);
+		bench_s24iq(nch[k], nch[k]);
+	}
+
+	bench_smeter(12000);
+	bench_smeter(20250);
+
+	bench_wf(0);
+	bench_wf(1);
+	bench_wf_dB_err();
+	bench_wf_window();
+
+	return 0;
+}
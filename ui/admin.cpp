@@ -39,6 +39,7 @@ Boston, MA  02110-1301, USA.
 
 #ifndef CFG_GPS_ONLY
  #include "data_pump.h"
+ #include "lat_hist.h"
  #include "ext_int.h"
 #endif
 
@@ -322,6 +323,9 @@ void c2s_admin(void *param)
 			if (i == 0) {
 			    dpump.force_reset = true;
 			    dpump.resets = 0;
+			    memset(dpump.edf_miss, 0, sizeof(dpump.edf_miss));
+			    memset(&wf_cache_stats, 0, sizeof(wf_cache_stats));
+			    lat_reset();
 				continue;
 			}
 #endif
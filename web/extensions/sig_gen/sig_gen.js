@@ -214,7 +214,7 @@ function sig_gen_blur()
 	//console.log('### sig_gen_blur');
 	gen_set(0, 0, true);
 	ext_send('SET run=0');
-	ext_send('SET wf_comp=1');
+	ext_send('SET wf_comp='+ wf_compression);
 }
 
 // called to display HTML for configuration parameters in admin interface
@@ -26,7 +26,9 @@ function status_html()
             ),
             w3_div('w3-container',
                w3_div('id-status-dp-hist'),
-               w3_div('id-status-in-hist')
+               w3_div('id-status-in-hist'),
+               w3_div('id-status-edf-miss'),
+               w3_div('id-status-wf-cache')
             )
          )
       ) : '';
@@ -271,6 +273,13 @@ function control_html()
 				w3_text('w3-text-black w3-center',
 				   'Set "yes" to save Internet bandwidth by preventing <br>' +
 				   'the waterfall and spectrum from being displayed.'
+				),
+				w3_div('w3-margin-T-16', '<b>Virtual waterfalls?</b>'),
+            w3_switch('', 'Yes', 'No', 'cfg.virt_wf', cfg.virt_wf, 'admin_radio_YN_cb'),
+				w3_text('w3-text-black w3-center',
+				   'Set "yes" to give every channel a waterfall. <br>' +
+				   'One hardware waterfall computes the full span and <br>' +
+				   'the others are cropped from it (less detail when zoomed in).'
 				)
 			)
 		) +
@@ -1086,7 +1086,7 @@ function gps_stats_cb(acquiring, tracking, good, fixes, adc_clock, adc_gps_clk_c
 	}
 }
 
-function admin_stats_cb(audio_dropped, underruns, seq_errors, dp_resets, dp_hist_cnt, dp_hist, in_hist_cnt, in_hist)
+function admin_stats_cb(audio_dropped, underruns, seq_errors, dp_resets, dp_hist_cnt, dp_hist, in_hist_cnt, in_hist, edf_miss, wf_cache)
 {
    if (audio_dropped == undefined) return;
    
@@ -1114,6 +1114,23 @@ function admin_stats_cb(audio_dropped, underruns, seq_errors, dp_resets, dp_hist
 		}
       el.innerHTML = s;
 	}
+
+	el = w3_el('id-status-edf-miss');
+	if (el && edf_miss) {
+	   var s = 'EDF misses: ';
+		for (var i = 0; i < edf_miss.length; i++) {
+		   s += (i? ', ':'') + edf_miss[i].toUnits();
+		}
+      el.innerHTML = s;
+	}
+
+	el = w3_el('id-status-wf-cache');
+	if (el && wf_cache) {
+	   var frames = wf_cache[0] + wf_cache[1];
+      el.innerHTML = 'WF cache: '+ wf_cache[0].toUnits() +' hits, '+ wf_cache[1].toUnits() +' computed'+
+         (frames? (' ('+ (wf_cache[0] * 100 / frames).toFixed(0) +'% hit)') : '') +
+         (wf_cache[2]? (', '+ wf_cache[2].toUnits() +' skipped (slow clients)') : '');
+	}
 }
 
 function kiwi_too_busy(rx_chans)
@@ -1716,7 +1733,7 @@ function kiwi_msg(param, ws)
 				   kiwi.GPS_fixes = o.gf;
 				   //console.log('stat kiwi.WSPR_rgrid='+ kiwi.WSPR_rgrid);
 				}
-				admin_stats_cb(o.ad, o.au, o.ae, o.ar, o.an, o.ap, o.an2, o.ai);
+				admin_stats_cb(o.ad, o.au, o.ae, o.ar, o.an, o.ap, o.an2, o.ai, o.am, o.wc);
 				time_display_cb(o);
 			} catch(ex) {
 				console.log('<'+ param[1] +'>');
@@ -684,6 +684,64 @@ function audio_periodic()
 	*/
 }
 
+// see rx/iq_rice.{h,cpp}
+var IQ_RICE_RAW = 3, IQ_RICE_ESC = 24, IQ_RICE_ESC_BITS = 20;
+
+function audio_iq_rice_decode_chan(br, x, ch, n)
+{
+   var b = br.b;
+   if (br.p >= b.length) return false;
+   var order = b[br.p] >> 5, k = b[br.p] & 0x1f;
+   br.p++;
+   var i;
+   
+   if (order == IQ_RICE_RAW) {
+      if (b.length - br.p < n*2) return false;
+      for (i = 0; i < n; i++, br.p += 2)
+         x[i*2 + ch] = (b[br.p] << 24 | b[br.p+1] << 16) >> 16;
+      return true;
+   }
+   if (order > 2 || k > 19) return false;
+
+   var acc = 0, nbits = 0;
+   var get = function(nb) {
+      while (nbits < nb) {
+         if (br.p >= b.length) throw 'short';
+         acc = (acc << 8) | b[br.p++];
+         nbits += 8;
+      }
+      nbits -= nb;
+      return (acc >>> nbits) & ((1 << nb) - 1);
+   };
+   
+   var x1 = 0, x2 = 0;
+   try {
+      for (i = 0; i < n; i++) {
+         var q = 0, u;
+         while (q < IQ_RICE_ESC && get(1)) q++;
+         u = (q < IQ_RICE_ESC)? ((q << k) | (k? get(k) : 0)) : get(IQ_RICE_ESC_BITS);
+         var s = ((u & 1)? -((u + 1) >>> 1) : (u >>> 1)) + ((order == 0)? 0 : ((order == 1)? x1 : (2*x1 - x2)));
+         x[i*2 + ch] = s;
+         x2 = x1; x1 = s;
+      }
+   } catch(ex) {
+      return false;
+   }
+   return true;
+}
+
+// returns the number of 16b I,Q samps written to out[] or -1
+function audio_iq_rice_decode(b, out)
+{
+   if (b.length < 2) return -1;
+   var nsamps = (b[0] << 8) | b[1];
+   if (nsamps*2 > out.length) return -1;
+   var br = { b:b, p:2 };
+   if (!audio_iq_rice_decode_chan(br, out, 0, nsamps)) return -1;
+   if (!audio_iq_rice_decode_chan(br, out, 1, nsamps)) return -1;
+   return nsamps*2;
+}
+
 function audio_recv(data)
 {
    //if (!audio_running) console.log('AUDIO audio_recv running='+ audio_running);
@@ -699,6 +757,7 @@ function audio_recv(data)
 	var smeter = (sm8[0] << 8) | sm8[1];
 	
 	var isIQ = (flags & audio_flags.SND_FLAG_MODE_IQ);
+	var iq_comp = isIQ? (new Uint8Array(data, 11, 1))[0] : 0;
 	var offset = isIQ? 20 : 10;
 	var data_view = new DataView(data, offset);
 	var bytes = data_view.byteLength;
@@ -771,7 +830,13 @@ function audio_recv(data)
 	   audio_mode_iq = false;
 	}
 
+	if (iq_comp) {
+	   samps = audio_iq_rice_decode(new Uint8Array(data, offset), audio_data);
+	   if (samps < 0) { console.log('AUDIO bad iq_comp packet'); return; }
+	} else
 	if (audio_compression) {
+      // server has reset its encoder (e.g. reinit, shared listen change)
+      if (flags & audio_flags.SND_FLAG_RESTART) audio_adpcm.index = audio_adpcm.previousValue = 0;
       //console.log('AUDIO COMP bytes='+ bytes);
 		decode_ima_adpcm_e8_i16(data_view, audio_data, bytes, audio_adpcm);
 		samps = bytes*2;		// i.e. 1024 8b bytes -> 2048 16b real samps, 1KB -> 4KB, 4:1 over uncompressed
@@ -1141,7 +1206,7 @@ function audio_stats()
    if (isNaN(out_sps)) out_sps = 0;
    w3_innerHTML('id-status-audio',
       w3_text(optbar_prefix_color, 'WF'),
-      w3_text('', kiwi.wf_fps.toFixed(0) +' fps'),
+      w3_text('', kiwi.wf_fps.toFixed(0) +' fps'+ ((wf_fps_eff < wf_fps)? ' (slowed)' : '')),
       w3_text(optbar_prefix_color, 'Audio'),
       w3_text('', (out_sps/1000).toFixed(1) +'k, Qlen '+ audio_prepared_buffers.length)
    );
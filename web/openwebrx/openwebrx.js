@@ -54,7 +54,7 @@ var height_top_bar_parts = 67;
 var height_spectrum_canvas = 200;
 
 var cur_mode;
-var wf_fps, wf_fps_max;
+var wf_fps, wf_fps_max, wf_fps_eff;
 
 var ws_snd, ws_wf;
 
@@ -63,7 +63,8 @@ var gen_freq = 0, gen_attn = 0;
 var squelch_threshold = 0;
 var wf_rate = '';
 var wf_mm = '';
-var wf_compression = 1;
+var wf_compression = 2;      // 0 = none, 1 = ADPCM, 2 = delta (see rx/wf_delta.h)
+var wf_history = 0;      // minutes
 var debug_v = 0;		// a general value settable from the URI to be used during debugging
 var sb_trace = 0;
 var kiwi_gc = 1;
@@ -83,6 +84,8 @@ var override_pbw = '';
 var override_pbc = '';
 var nb_click = false;
 var no_geoloc = false;
+var shared_listen = false;
+var iq_comp = false;
 var mobile_laptop_test = false;
 
 var freq_memory = [];
@@ -193,10 +196,13 @@ function kiwi_main()
 	s = 'mute'; if (q[s]) muted_initially = parseInt(q[s]);
 	s = 'wf'; if (q[s]) wf_rate = q[s];
 	s = 'wfm'; if (q[s]) wf_mm = q[s];
+	s = 'wfavg'; if (q[s]) wf.avg = w3_clamp(parseInt(q[s]), 0, wf.avg_s.length - 1, 0);
 	s = 'cmap'; if (q[s]) wf.cmap_override = w3_clamp(parseInt(q[s]), 0, wf.cmap_s.length - 1, 0);
 	s = 'sqrt'; if (q[s]) wf.sqrt = w3_clamp(parseInt(q[s]), 0, 4, 0);
 	s = 'peak'; if (q[s]) peak_initially = parseInt(q[s]);
 	s = 'no_geo'; if (q[s]) no_geoloc = true;
+	s = 'shared'; if (q[s]) shared_listen = true;
+	s = 'iq_comp'; if (q[s]) iq_comp = true;
 	s = 'keys'; if (q[s]) shortcut.keys = q[s];
 	// 'no_wf' is handled in kiwi_util.js
 
@@ -207,6 +213,7 @@ function kiwi_main()
 	s = 'ncc'; if (q[s]) no_clk_corr = parseInt(q[s]);
 	s = 'wfdly'; if (q[s]) waterfall_delay = parseFloat(q[s]);
 	s = 'wf_comp'; if (q[s]) wf_compression = parseInt(q[s]);
+	s = 'wfh'; if (q[s]) wf_history = parseFloat(q[s]);
 	s = 'gen'; if (q[s]) gen_freq = parseFloat(q[s]);
 	s = 'attn'; if (q[s]) gen_attn = parseInt(q[s]);
 	s = 'blen'; if (q[s]) audio_buffer_min_length_sec = parseFloat(q[s])/1000;
@@ -268,6 +275,8 @@ function kiwi_main()
 	snd_send("SERVER DE CLIENT openwebrx.js SND");
 	snd_send("SET dbug_v="+ debug_v);
 	snd_send("SET squelch=0 max="+ squelch_threshold.toFixed(0));
+	if (shared_listen) snd_send("SET shared_listen=1");
+	if (iq_comp) snd_send("SET iq_comp=1");
 
    if (gen_attn != 0) {
       var dB = gen_attn;
@@ -288,11 +297,12 @@ function kiwi_main()
 	// fixme: okay to remove this now?
 	wf_send("SET zoom=0 start=0");
 	wf_send("SET maxdb=0 mindb=-100");
-	if (wf_compression == 0) wf_send('SET wf_comp=0');
+	if (wf_compression != 1) wf_send('SET wf_comp='+ wf_compression);
 	wf_speed = wf_rates[wf_rate];
 	//console.log('wf_rate="'+ wf_rate +'" wf_speed='+ wf_speed);
 	if (wf_speed == undefined) wf_speed = WF_SPEED_FAST;
 	wf_send('SET wf_speed='+ wf_speed);
+	if (wf.avg) wf_send('SET wf_avg='+ wf.avg);
 }
 
 var ptype = { HIDE:0, POPUP:1, TOGGLE:2 };
@@ -3422,6 +3432,7 @@ var wfavg = [];
 // amounts empirically determined
 var wf_swallow_samples = [ 2, 4, 8, 18 ];    // for zoom: 11, 12, 13, 14
 var x_bin_server_last, wf_swallow = 0;
+var wf_flags = { COMPRESSED:1, HISTORY:2, DELTA:4 };
 
 function waterfall_add(data_raw, audioFFT)
 {
@@ -3441,7 +3452,6 @@ function waterfall_add(data_raw, audioFFT)
       if (kiwi_gc_wf) u32View = null;	// gc
       var x_zoom_server = u32 & 0xffff;
       var flags = (u32 >> 16) & 0xffff;
-      var wf_flags = { COMPRESSED:1 };
    
       data_arr_u8 = new Uint8Array(data_raw, 16);	// unsigned dBm values, converted to signed later on
       var bytes = data_arr_u8.length;
@@ -3459,6 +3469,10 @@ function waterfall_add(data_raw, audioFFT)
          need_clear_wf_sp_avg = need_clear_wfavg = need_clear_specavg = false;
       }
       
+      if (flags & wf_flags.DELTA) {
+         data = waterfall_delta_decode(data_arr_u8);
+         if (data == null) return;     // predicted from a row we didn't get, wait for a key row
+      } else
       if (flags & wf_flags.COMPRESSED) {
          decomp_data = new Uint8Array(bytes*2);
          var wf_adpcm = { index:0, previousValue:0 };
@@ -4012,7 +4026,13 @@ function waterfall_add_queue(what, ws, firstChars)
    
 	var u32View = new Uint32Array(what, 4, 3);
 	var seq = u32View[2];
+	var flags = (u32View[1] >> 16) & 0xffff;
 	if (kiwi_gc_wf) u32View = null;	// gc
+	
+	if (flags & wf_flags.HISTORY) {
+	   waterfall_history(what, seq);
+	   return;
+	}
 
 	var now = Date.now();
 	var spacing = waterfall_last_add? (now - waterfall_last_add) : 0;
@@ -4022,6 +4042,78 @@ function waterfall_add_queue(what, ws, firstChars)
 	if (kiwi_gc_wf) what = null;	// gc
 }
 
+// see rx/wf_delta.{h,cpp}
+var WF_DELTA_RAW = 3, WF_DELTA_ESC = 16, WF_DELTA_ESC_BITS = 9, WF_DELTA_HDR = 3;
+var wf_delta = { prev: null, seq: -1 };
+
+function waterfall_delta_decode(b)
+{
+   var n = 1024;
+   if (b.length < WF_DELTA_HDR) return null;
+   var seq = b[0], pred = b[1] >> 5, k = b[1] & 0x1f, q = b[2];
+   if (wf_delta.prev == null) wf_delta.prev = new Uint8Array(n);
+   var prev = wf_delta.prev, out = new Uint8Array(n);
+   var chained = (wf_delta.seq >= 0 && seq == ((wf_delta.seq + 1) & 0xff));
+   wf_delta.seq = -1;
+   var i;
+   
+   if (pred == WF_DELTA_RAW) {
+      if (b.length < WF_DELTA_HDR + n) return null;
+      out.set(b.subarray(WF_DELTA_HDR, WF_DELTA_HDR + n));
+   } else {
+      if (pred > 2 || k > 8 || (pred != 0 && !chained)) return null;
+      var p = WF_DELTA_HDR, acc = 0, nbits = 0;
+      var get = function(nb) {
+         while (nbits < nb) {
+            if (p >= b.length) throw 'short';
+            acc = ((acc << 8) | b[p++]) & 0xffffff;
+            nbits += 8;
+         }
+         nbits -= nb;
+         return (acc >>> nbits) & ((1 << nb) - 1);
+      };
+   
+      var left = 0, upleft = 0;
+      try {
+         for (i = 0; i < n; i++) {
+            var up = prev[i], pr;
+            if (pred == 0) pr = left; else
+            if (pred == 1) pr = up; else {
+               var mx = Math.max(left, up), mn = Math.min(left, up);
+               pr = (upleft >= mx)? mn : ((upleft <= mn)? mx : (left + up - upleft));
+            }
+            var qq = 0;
+            while (qq < WF_DELTA_ESC && get(1)) qq++;
+            var u = (qq < WF_DELTA_ESC)? ((qq << k) | (k? get(k) : 0)) : get(WF_DELTA_ESC_BITS);
+            var r = pr + ((u & 1)? -((u + 1) >>> 1) : (u >>> 1)) * q;
+            out[i] = (r < 0)? 0 : ((r > 255)? 255 : r);
+            upleft = up; left = out[i];
+         }
+      } catch(ex) {
+         return null;
+      }
+   }
+   
+   prev.set(out);
+   wf_delta.seq = seq;
+   return out;
+}
+
+// Rows from the server's history (SET wf_history=secs), oldest first. seq is the number of rows,
+// each preceded by its length. They're drawn straight away instead of being synchronized to the audio.
+function waterfall_history(what, nrows)
+{
+   var dv = new DataView(what);
+   var off = 16;
+   
+   for (var i = 0; i < nrows && off + 2 <= what.byteLength; i++) {
+      var len = dv.getUint16(off, true);
+      off += 2;
+      waterfall_add(what.slice(off, off + len), 0);
+      off += len;
+   }
+}
+
 var init_zoom_set = false;
 var waterfall_last_out = 0;
 var wf_dq_onesec = 0;
@@ -6990,6 +7082,7 @@ function panels_setup()
       w3_inline('w3-halign-space-between w3-margin-T-2/',
          w3_select('|color:red', '', 'colormap', 'wf.cmap', wf.cmap, wf.cmap_s, 'wf_cmap_cb'),
          w3_select('|color:red', '', 'aperture', 'wf.aper', wf.aper, wf.aper_s, 'wf_aper_cb'),
+         w3_select('|color:red', '', 'avg', 'wf.avg', wf.avg, wf.avg_s, 'wf_avg_cb'),
          //w3_select('|color:red', '', 'contrast', 'wf.contr', W3_SELECT_SHOW_TITLE, wf_contr_s, 'wf_contr_cb'),
          w3_select('|color:red', '', 'wf', 'wf_filter', wf_filter, wf_sp_menu_s, 'wf_sp_menu_cb', 1),
          w3_select('|color:red', '', 'spec', 'spec_filter', spec_filter, wf_sp_menu_s, 'wf_sp_menu_cb', 0)
@@ -7251,6 +7344,9 @@ var wf = {
    cmap_override: -1,
    custom_colormaps: [ new Uint8Array(3*256), new Uint8Array(3*256), new Uint8Array(3*256), new Uint8Array(3*256) ],
 
+   avg_s: [ 'single', 'average', 'peak hold', 'min hold' ],    // see WF_AVG_* in rx_waterfall.h
+   avg: 0,
+
    aper_s: [ 'man', 'auto' ],
    aper_e: { man:0, auto:1 },
    aper: 0,
@@ -7440,6 +7536,15 @@ function wf_cmap_cb(path, idx, first)
    freqset_select();
 }
 
+// Server combines the spectra sampled during each frame interval. Most useful at the slow WF rates.
+function wf_avg_cb(path, idx, first)
+{
+   if (first) return;
+   wf.avg = w3_clamp(+idx, 0, wf.avg_s.length - 1, 0);
+   w3_select_value(path, wf.avg);
+   wf_send('SET wf_avg='+ wf.avg);
+}
+
 function wf_aper_cb(path, idx, first)
 {
    if (first) return;
@@ -8570,6 +8675,7 @@ function owrx_msg_cb(param, ws)
 	switch (param[0]) {
 		case "wf_setup":
 			   waterfall_init();
+			   if (wf_history) wf_send('SET wf_history='+ Math.round(wf_history * 60));
 			break;					
 		case "extint_list_json":
 			extint_list_json(param[1]);
@@ -8591,7 +8697,10 @@ function owrx_msg_cb(param, ws)
 			wf_fps_max = parseInt(param[1]);
 			break;
 		case "wf_fps":
-			wf_fps = parseInt(param[1]);
+			wf_fps = wf_fps_eff = parseInt(param[1]);
+			break;
+		case "wf_fps_eff":    // server slowed the waterfall because we're not keeping up
+			wf_fps_eff = parseFloat(param[1]);
 			break;
 		case "start":
 			bin_server = parseInt(param[1]);
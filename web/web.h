@@ -89,6 +89,7 @@ void web_to_app_done(conn_t *c, nbuf_t *nb);
 
 // server to client
 void app_to_web(conn_t *c, char *s, int sl);
+void app_to_web_ref(conn_t *c, char *buf, int sl);
 char *rx_server_ajax(struct mg_connection *mc);
 int web_request(struct mg_connection *mc, enum mg_event ev);
 void reload_index_params();
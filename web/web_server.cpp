@@ -33,6 +33,7 @@ Boston, MA  02110-1301, USA.
 #include "clk.h"
 #include "ext_int.h"
 #include "debug.h"
+#include "lat_hist.h"
 
 #include <string.h>
 #include <time.h>
@@ -91,13 +92,13 @@ void webserver_connection_cleanup(conn_t *c)
 		// polled push of data _to_ web server
 		TASK:
 		web_server()
-			mg_poll_server()	// also forces mongoose internal buffering to write to sockets
 			mg_iterate_over_connections()
 				iterate_callback()
 					is_websocket:
-						[app_to_web() =>] nbuf_dequeue(s2c) => mg_websocket_write()
+						[app_to_web() =>] nbuf_dequeue(s2c) => mg_websocket_writev()	// one writev() per batch
 					other:
 						ERROR
+			mg_poll_server()	// also forces mongoose internal buffering to write to sockets
 			LOOP
 					
 */
@@ -149,7 +150,16 @@ void app_to_web(conn_t *c, char *s, int sl)
 	    return;
 	}
 	nbuf_allocq(&c->s2c, s, sl);
-	//NextTask("s2c");
+	c->ui->s2c_pending = 1;
+}
+
+// same as app_to_web() but buf is a refcounted nbuf_ref_alloc() payload shared by several connections
+void app_to_web_ref(conn_t *c, char *buf, int sl)
+{
+	if (c->stop_data) return;
+	if (c->internal_connection) return;
+	nbuf_allocq_ref(&c->s2c, buf, sl);
+	c->ui->s2c_pending = 1;
 }
 
 
@@ -179,6 +189,23 @@ static int ev_handler(struct mg_connection *mc, enum mg_event evt) {
     }
 }
 
+// Audio (ND_CLS_AUDIO) connections are serviced in a pass of their own before the others.
+static bool web_audio_pass;
+
+#define WEB_BACKLOG_AUDIO	1024		// bytes the socket didn't take
+#define WEB_BACKLOG_BULK	(32*1024)
+
+// Bulk (W/F) data stays queued while its own socket or the socket of the user's audio connection
+// is backed up. It's then coalesced in the queue (ND_CLS_BULK drops the oldest) and
+// wf_backpressure() slows the waterfall down instead of it competing with audio for the link.
+static bool web_hold_bulk(conn_t *c, struct mg_connection *mc)
+{
+	if (mg_send_backlog(mc) > WEB_BACKLOG_BULK) return true;
+	conn_t *snd = c->other;
+	return (snd && snd->valid && snd->other == c && snd->mc && snd->s2c.cls == ND_CLS_AUDIO &&
+		mg_send_backlog(snd->mc) > WEB_BACKLOG_AUDIO);
+}
+
 // polled send of data _to_ web server
 static int iterate_callback(struct mg_connection *mc, enum mg_event evt)
 {
@@ -188,14 +215,22 @@ static int iterate_callback(struct mg_connection *mc, enum mg_event evt)
 	if (evt == MG_POLL && mc->is_websocket) {
 		conn_t *c = rx_server_websocket(WS_MODE_LOOKUP, mc);
 		if (c == NULL)  return MG_FALSE;
+		if ((c->s2c.cls == ND_CLS_AUDIO) != web_audio_pass) return MG_TRUE;
+		if (c->s2c.cls == ND_CLS_BULK && web_hold_bulk(c, mc)) return MG_TRUE;
 
         evWS(EC_EVENT, EV_WS, 0, "WEB_SERVER", "iterate_callback..");
-		while (TRUE) {
-			if (c->stop_data) break;
-			nb = nbuf_dequeue(&c->s2c);
-			//printf("s2c CHK port %d nb %p\n", mc->remote_port, nb);
-			
-			if (nb) {
+		// Gather what's queued into one mg_websocket_writev() per MG_WS_WRITEV_MAX buffers.
+		// The nbufs can't be marked done (and so freed) until it returns.
+		nbuf_t *nbs[MG_WS_WRITEV_MAX];
+		const char *bufs[MG_WS_WRITEV_MAX];
+		size_t lens[MG_WS_WRITEV_MAX];
+		int i, n;
+		
+		do {
+			for (n = 0; n < MG_WS_WRITEV_MAX && !c->stop_data; n++) {
+				nb = nbuf_dequeue(&c->s2c);
+				//printf("s2c CHK port %d nb %p\n", mc->remote_port, nb);
+				if (!nb) break;
 				assert(!nb->done && nb->buf && nb->len);
 
 				#ifdef SND_TIMING_CK
@@ -234,13 +269,20 @@ static int iterate_callback(struct mg_connection *mc, enum mg_event evt)
 				#endif
 
 				//printf("s2c %d WEBSOCKET: %d %p\n", mc->remote_port, nb->len, nb->buf);
-				ret = mg_websocket_write(mc, WS_OPCODE_BINARY, nb->buf, nb->len);
-				if (ret<=0) printf("$$$$$$$$ socket write ret %d\n", ret);
-				nb->done = TRUE;
-			} else {
-				break;
+				if (c->type == STREAM_SOUND)
+					lat_rx(c->rx_channel, LAT_S2C, timer_us64() - nb->enq_us);
+				
+				nbs[n] = nb;
+				bufs[n] = nb->buf;
+				lens[n] = nb->len;
 			}
-		}
+			if (n == 0) break;
+
+			ret = mg_websocket_writev(mc, WS_OPCODE_BINARY, bufs, lens, n);
+			if (ret<=0) printf("$$$$$$$$ socket write ret %d\n", ret);
+			for (i = 0; i < n; i++)
+				nbs[i]->done = TRUE;
+		} while (n == MG_WS_WRITEV_MAX);
         evWS(EC_EVENT, EV_WS, 0, "WEB_SERVER", "..iterate_callback");
 	} else {
 		if (evt != MG_POLL) printf("$$$$$$$$ s2c %d OTHER: %d len %d\n", mc->remote_port, (int) evt, (int) mc->content_len);
@@ -258,12 +300,23 @@ void web_server(void *param)
 	const char *err;
 	
 	while (1) {
-		mg_poll_server(server, 0);		// passing 0 effects a poll
+		// Move s2c data into the mongoose send buffers before polling so it's written out
+		// by this poll if the socket is writable rather than one poll interval later.
+		// Audio connections first (see iterate_callback()).
+		// app_to_web() sets s2c_pending which ends the sleep below early.
+		ui->s2c_pending = 0;
+		web_audio_pass = true;
 		mg_iterate_over_connections(server, iterate_callback);
+		web_audio_pass = false;
+		mg_iterate_over_connections(server, iterate_callback);
+		int nconn = mg_poll_server(server, 0);		// passing 0 effects a poll (scheduler can't block)
+		
+		// incoming data must still be polled for, but less often with no connections
+		int poll_us = nconn? WEB_SERVER_POLL_US : WEB_SERVER_IDLE_US;
 		
 		//#define MEAS_WEB_SERVER
 		#ifdef MEAS_WEB_SERVER
-		    u4_t quanta = FROM_VOID_PARAM(TaskSleepUsec(WEB_SERVER_POLL_US));
+		    u4_t quanta = FROM_VOID_PARAM(TaskSleepWakeupTestUsec("web_server", poll_us, &ui->s2c_pending));
             static u4_t last, cps, max_quanta, sum_quanta;
             u4_t now = timer_sec();
             if (last != now) {
@@ -282,7 +335,7 @@ void web_server(void *param)
                 cps++;
             }
         #else
-            TaskSleepUsec(WEB_SERVER_POLL_US);
+            TaskSleepWakeupTestUsec("web_server", poll_us, &ui->s2c_pending);
         #endif
 		
 		//#define CHECK_ECPU_STACK